@@ -8,24 +8,46 @@ LAZYCSV_INDEX_DTYPE = os.environ.get("LAZYCSV_INDEX_DTYPE", "uint16_t")
 LAZYCSV_INCLUDE_NUMPY = int("LAZYCSV_INCLUDE_NUMPY" in os.environ)
 LAZYCSV_INCLUDE_NUMPY_LEGACY = int("LAZYCSV_INCLUDE_NUMPY_LEGACY" in os.environ)
 
+LAZYCSV_INCLUDE_ZLIB = int("LAZYCSV_INCLUDE_ZLIB" in os.environ)
+LAZYCSV_INCLUDE_ZSTD = int("LAZYCSV_INCLUDE_ZSTD" in os.environ)
+
+LAZYCSV_INCLUDE_COUNTERS = int("LAZYCSV_INCLUDE_COUNTERS" in os.environ)
+LAZYCSV_INCLUDE_PROBES = int("LAZYCSV_INCLUDE_PROBES" in os.environ)
+
 include_dirs = (
     [__import__("numpy").get_include()]
     if (LAZYCSV_INCLUDE_NUMPY | LAZYCSV_INCLUDE_NUMPY_LEGACY)
     else []
 )
 
+libraries = (["z"] if LAZYCSV_INCLUDE_ZLIB else []) + (
+    ["zstd"] if LAZYCSV_INCLUDE_ZSTD else []
+)
+
 if not LAZYCSV_INDEX_DTYPE.startswith(("unsigned", "uint")):
     raise ValueError("specified LAZYCSV_INDEX_DTYPE must be an unsigned integer type")
 
 extensions = [
     Extension(
         "lazycsv.lazycsv",
-        [os.path.join("src", "lazycsv", "lazycsv.c")],
+        [
+            os.path.join("src", "lazycsv", "lazycsv.c"),
+            os.path.join("src", "lazycsv", "core.c"),
+        ],
+        depends=[
+            os.path.join("src", "lazycsv", "core.h"),
+            os.path.join("src", "lazycsv", "lazycsv.h"),
+        ],
         include_dirs=include_dirs,
+        libraries=libraries,
         define_macros=[
             ("INDEX_DTYPE", LAZYCSV_INDEX_DTYPE),
             ("INCLUDE_NUMPY", LAZYCSV_INCLUDE_NUMPY),
             ("INCLUDE_NUMPY_LEGACY", LAZYCSV_INCLUDE_NUMPY_LEGACY),
+            ("INCLUDE_ZLIB", LAZYCSV_INCLUDE_ZLIB),
+            ("INCLUDE_ZSTD", LAZYCSV_INCLUDE_ZSTD),
+            ("INCLUDE_COUNTERS", LAZYCSV_INCLUDE_COUNTERS),
+            ("INCLUDE_PROBES", LAZYCSV_INCLUDE_PROBES),
             ("DEBUG", LAZYCSV_DEBUG),
         ],
     )
@@ -0,0 +1,4382 @@
+// the index pass, decompression and the public interface of the lazycsv
+// library, nothing here depends on CPython.
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "core.h"
+
+static size_t INDEX_DTYPE_MAX = ((INDEX_DTYPE) ~(INDEX_DTYPE)0);
+
+size_t LAZYCSV_PAGESIZE = 4096;
+
+
+static inline void LazyCSV_BufferWrite(int fd, LazyCSV_Buffer *buffer,
+                                       void *data, size_t size) {
+
+    if (buffer->size + size >= buffer->capacity) {
+        LAZYCSV_PROBE2(buffer__flush, fd, buffer->size);
+        write(fd, buffer->data, buffer->size);
+        buffer->size = 0;
+        if (size >= buffer->capacity) {
+            LAZYCSV_PROBE2(buffer__flush, fd, size);
+            write(fd, data, size);
+            return;
+        }
+    }
+    memcpy(&buffer->data[buffer->size], data, size);
+    buffer->size += size;
+}
+
+
+static inline void LazyCSV_BufferFlush(int comma_file, LazyCSV_Buffer *buffer) {
+    LAZYCSV_PROBE2(buffer__flush, comma_file, buffer->size);
+    write(comma_file, buffer->data, buffer->size);
+    buffer->size = 0;
+    fsync(comma_file);
+}
+
+
+static inline void LazyCSV_RowToDisk(size_t value, size_t *rows,
+                                     size_t *anchors, LazyCSV_RowBlock *block,
+                                     int nfile, LazyCSV_Buffer *nbuf,
+                                     int afile, LazyCSV_Buffer *abuf) {
+
+    if (*rows % LAZYCSV_ROW_BLOCK == 0) {
+        LazyCSV_RowBlock header = {.offset = value, .anchor = *anchors};
+        LazyCSV_BufferWrite(nfile, nbuf, &header, sizeof(LazyCSV_RowBlock));
+        *block = header;
+    }
+
+    // the anchor delta is assumed to fit, 2**32 anchors within a block
+    // would take at least a terabyte of data even with a uint8_t index.
+
+    LazyCSV_RowEntry entry = {
+        .offset = value - block->offset,
+        .anchor = *anchors - block->anchor
+    };
+
+    if (value - block->offset >= LAZYCSV_ROW_SPILL) {
+        LazyCSV_AnchorPoint apnt = {.value = value, .col = 0};
+        LazyCSV_BufferWrite(afile, abuf, &apnt, sizeof(LazyCSV_AnchorPoint));
+        *anchors += 1;
+        entry.offset = LAZYCSV_ROW_SPILL;
+    }
+
+    LazyCSV_BufferWrite(nfile, nbuf, &entry, sizeof(LazyCSV_RowEntry));
+    *rows += 1;
+}
+
+
+static void LazyCSV_CommaFlush(LazyCSV_CommaWriter *writer, int cfile,
+                               LazyCSV_Buffer *cbuf, int afile,
+                               LazyCSV_Buffer *abuf) {
+
+    uint64_t deltas[LAZYCSV_COMMA_BLOCK];
+    uint64_t words[LAZYCSV_COMMA_BLOCK] = {0};
+    size_t prev = writer->base, max = 0;
+
+    // a partial last block is padded with zero deltas
+    for (size_t i = 0; i < LAZYCSV_COMMA_BLOCK; i++) {
+        size_t value = i < writer->count ? writer->values[i] : prev;
+        deltas[i] = value - prev;
+        max |= deltas[i];
+        prev = value;
+    }
+
+    size_t width = max ? 64 - __builtin_clzll(max) : 0;
+
+    for (size_t i = 0, bit = 0; width && i < LAZYCSV_COMMA_BLOCK;
+         i++, bit += width) {
+        size_t word = bit >> 6, shift = bit & 63;
+        words[word] |= deltas[i] << shift;
+        if (shift + width > 64)
+            words[word+1] |= deltas[i] >> (64 - shift);
+    }
+
+    LazyCSV_CommaBlock block = {
+        .base = writer->base,
+        .packed = writer->words << 8 | width
+    };
+    LazyCSV_BufferWrite(afile, abuf, &block, sizeof(LazyCSV_CommaBlock));
+
+    size_t count = LAZYCSV_COMMA_BLOCK*width/64;
+    LazyCSV_BufferWrite(cfile, cbuf, words, count*sizeof(uint64_t));
+
+    writer->words += count;
+    writer->base = prev;
+    writer->count = 0;
+}
+
+
+static inline void LazyCSV_ValueToDisk(size_t value, size_t *anchors,
+                                       LazyCSV_AnchorPoint *apnt,
+                                       size_t col_index, int cfile,
+                                       LazyCSV_Buffer *cbuf, int afile,
+                                       LazyCSV_Buffer *abuf,
+                                       LazyCSV_CommaWriter *writer) {
+
+    if (writer && writer->mode == LAZYCSV_INDEX_ROWS) {
+        size_t k = writer->count++;
+        if (k && writer->every && k % writer->every == 0) {
+            uint32_t checkpoint = value - writer->base < LAZYCSV_CHECKPOINT_NONE
+                ? value - writer->base
+                : LAZYCSV_CHECKPOINT_NONE;
+            LazyCSV_BufferWrite(cfile, cbuf, &checkpoint, sizeof(uint32_t));
+        }
+        return;
+    }
+
+    if (writer) {
+        writer->values[writer->count++] = value;
+        if (writer->count == LAZYCSV_COMMA_BLOCK)
+            LazyCSV_CommaFlush(writer, cfile, cbuf, afile, abuf);
+        return;
+    }
+
+    size_t target = value - apnt->value;
+
+    if (target > INDEX_DTYPE_MAX) {
+        *apnt = (LazyCSV_AnchorPoint){.value = value, .col = col_index+1};
+        LazyCSV_BufferWrite(afile, abuf, apnt, sizeof(LazyCSV_AnchorPoint));
+        *anchors += 1;
+        target = 0;
+    }
+
+    INDEX_DTYPE item = target;
+
+    LazyCSV_BufferWrite(cfile, cbuf, &item, sizeof(INDEX_DTYPE));
+}
+
+
+static void LazyCSV_ScanChunk(LazyCSV_Scanner *s, char *chunk, size_t len,
+                              size_t base) {
+
+    char quoted = s->quoted, cm1 = s->cm1, row_start = s->row_start, c;
+    char delimiter = s->delimiter, quotechar = s->quotechar;
+    char overflow = s->overflow, newline_pending = s->newline_pending;
+    int newline = s->newline;
+    size_t cols = s->cols, col_index = s->col_index;
+
+    // the scanner state is copied into locals for the duration of the loop,
+    // writes through the buffers would otherwise force it to be reloaded
+    // from memory on every iteration.
+
+    int cfile = s->comma_file, afile = s->anchor_file;
+    int nfile = s->newline_file;
+    LazyCSV_Buffer cbuf = s->comma_buffer, abuf = s->anchor_buffer;
+    LazyCSV_Buffer nbuf = s->newline_buffer;
+    size_t rows = s->row_count, anchors = s->anchor_count;
+    size_t escapes = s->escaped_quotes;
+    LazyCSV_RowBlock block = s->block;
+    LazyCSV_AnchorPoint apnt = s->apnt;
+    LazyCSV_CommaWriter* writer = s->writer;
+
+    for (size_t j = 0; j < len; j++) {
+
+        c = chunk[j];
+
+        // overflow happens when a row has more columns than the header row,
+        // if this happens during the parse, the comma of the nth col will
+        // indicate the line ending and the rest of the row is skipped.
+        // Underflow happens when a row has less columns than the header row,
+        // and missing values will be appended to the row as an empty field.
+
+        if (overflow && c != LINE_FEED && c != CARRIAGE_RETURN) {
+            continue;
+        }
+
+        size_t i = base + j;
+
+        if (newline_pending) {
+            // the first line ending was a carriage return, which is only
+            // known to be part of a \r\n once the next char is seen.
+            newline = c == LINE_FEED
+                ? LINE_FEED + CARRIAGE_RETURN
+                : CARRIAGE_RETURN;
+            newline_pending = 0;
+        }
+
+        // a row starts on the first char after a line ending, other than
+        // the line feed of a \r\n. Line endings within quotes don't end a
+        // row, so each row start is paired with exactly one row end.
+
+        if (row_start
+            && !(c == LINE_FEED && cm1 == CARRIAGE_RETURN
+                 && newline == (CARRIAGE_RETURN+LINE_FEED))) {
+            size_t val = i;
+            row_start = 0;
+
+            if (!writer || writer->mode == LAZYCSV_INDEX_ROWS)
+                LazyCSV_RowToDisk(val, &rows, &anchors, &block, nfile, &nbuf,
+                                  afile, &abuf);
+            if (writer && writer->mode == LAZYCSV_INDEX_ROWS) {
+                writer->count = 0;
+                writer->base = val;
+            }
+
+            apnt = (LazyCSV_AnchorPoint){.value = val, .col = col_index};
+
+            LazyCSV_ValueToDisk(val, &anchors, &apnt, col_index, cfile, &cbuf,
+                                afile, &abuf, writer);
+        }
+
+        if (c == quotechar) {
+            // a quote reopening a quoted field right after it was closed is
+            // the second of an escaped pair.
+            escapes += !quoted && cm1 == quotechar;
+            quoted = !quoted;
+        }
+
+        else if (!quoted && c == delimiter) {
+            size_t val = i + 1;
+            LazyCSV_ValueToDisk(val, &anchors, &apnt, col_index, cfile, &cbuf,
+                                afile, &abuf, writer);
+            if (cols == SIZE_MAX || col_index < cols) {
+                col_index += 1;
+            }
+            else {
+                s->overflow_warning =
+                    "column overflow encountered while parsing CSV, "
+                    "extra values will be truncated!";
+                s->overflow_rows += 1;
+                overflow = 1;
+            }
+        }
+
+        else if (!quoted && c == LINE_FEED && cm1 == CARRIAGE_RETURN) {
+            // no-op, don't match next block for \r\n
+        }
+
+        else if (!quoted && (c == CARRIAGE_RETURN || c == LINE_FEED)) {
+            size_t val = i + 1;
+
+            if (!overflow) {
+                LazyCSV_ValueToDisk(val, &anchors, &apnt, col_index, cfile,
+                                    &cbuf, afile, &abuf, writer);
+            }
+            else {
+                overflow = 0;
+            }
+
+            if (s->row_index == 0) {
+                cols = col_index;
+            }
+
+            else if (col_index < cols) {
+                s->underflow_warning =
+                    "column underflow encountered while parsing CSV, "
+                    "missing values will be filled with the empty bytestring!";
+                s->underflow_rows += 1;
+                while (col_index < cols) {
+                  LazyCSV_ValueToDisk(val, &anchors, &apnt, col_index, cfile,
+                                      &cbuf, afile, &abuf, writer);
+                  col_index += 1;
+                }
+            }
+
+            if (newline == -1) {
+                if (c == CARRIAGE_RETURN)
+                    newline_pending = 1;
+                else
+                    newline = c;
+            }
+
+            col_index = 0;
+            row_start = 1;
+            s->row_index += 1;
+        }
+
+        cm1 = c;
+    }
+
+    s->comma_buffer = cbuf;
+    s->anchor_buffer = abuf;
+    s->newline_buffer = nbuf;
+    s->row_count = rows;
+    s->anchor_count = anchors;
+    s->escaped_quotes = escapes;
+    s->block = block;
+    s->apnt = apnt;
+    s->quoted = quoted;
+    s->overflow = overflow;
+    s->newline_pending = newline_pending;
+    s->newline = newline;
+    s->cm1 = cm1;
+    s->row_start = row_start;
+    s->cols = cols;
+    s->col_index = col_index;
+}
+
+
+static inline char LazyCSV_ScanFinish(LazyCSV_Scanner *s, size_t file_len) {
+
+    // returns 1 if the file ends on a line ending, in which case the last
+    // row has already been written to the index.
+
+    char overcount = s->cm1 == CARRIAGE_RETURN || s->cm1 == LINE_FEED;
+
+    if (s->newline_pending) {
+        s->newline = CARRIAGE_RETURN;
+        s->newline_pending = 0;
+    }
+
+    if (!overcount) {
+        LazyCSV_ValueToDisk(file_len + 1, &s->anchor_count, &s->apnt,
+                            s->col_index, s->comma_file, &s->comma_buffer,
+                            s->anchor_file, &s->anchor_buffer, s->writer);
+
+        // a last row without a line ending is filled like any other, rather
+        // than leaving its missing values past the end of the index.
+        if (s->row_index > 0 && s->col_index < s->cols) {
+            s->underflow_warning =
+                "column underflow encountered while parsing CSV, "
+                "missing values will be filled with the empty bytestring!";
+            s->underflow_rows += 1;
+            for (size_t i = s->col_index; i < s->cols; i++)
+                LazyCSV_ValueToDisk(file_len + 1, &s->anchor_count, &s->apnt,
+                                    i, s->comma_file, &s->comma_buffer,
+                                    s->anchor_file, &s->anchor_buffer,
+                                    s->writer);
+        }
+    }
+
+    if (s->writer && s->writer->mode == LAZYCSV_INDEX_COMPRESSED) {
+        if (s->writer->count)
+            LazyCSV_CommaFlush(s->writer, s->comma_file, &s->comma_buffer,
+                               s->anchor_file, &s->anchor_buffer);
+    }
+    else {
+        // the sentinel entry closes the anchor range of the last row
+        LazyCSV_RowToDisk(file_len + 1, &s->row_count, &s->anchor_count,
+                          &s->block, s->newline_file, &s->newline_buffer,
+                          s->anchor_file, &s->anchor_buffer);
+    }
+
+    return overcount;
+}
+
+
+// readahead indexing, a background thread fills a ring of buffers with
+// pread() while the index pass consumes them, so that on cold files the scan
+// never waits on a page fault at each page boundary.
+
+#define LAZYCSV_READAHEAD_DEPTH 4
+
+typedef struct {
+    int fd;
+    int error;
+    size_t file_len;
+    size_t block_size;
+    size_t head;
+    size_t tail;
+    char* blocks[LAZYCSV_READAHEAD_DEPTH];
+    size_t sizes[LAZYCSV_READAHEAD_DEPTH];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} LazyCSV_Readahead;
+
+
+static void* LazyCSV_ReadaheadWorker(void *arg) {
+    LazyCSV_Readahead *ra = (LazyCSV_Readahead*)arg;
+
+    for (size_t offset = 0; offset < ra->file_len; ) {
+        pthread_mutex_lock(&ra->lock);
+        while (ra->head - ra->tail == LAZYCSV_READAHEAD_DEPTH && !ra->error)
+            pthread_cond_wait(&ra->cond, &ra->lock);
+        size_t slot = ra->head % LAZYCSV_READAHEAD_DEPTH;
+        int error = ra->error;
+        pthread_mutex_unlock(&ra->lock);
+
+        if (error) break;
+
+        size_t want = ra->file_len - offset;
+        want = want < ra->block_size ? want : ra->block_size;
+
+        size_t size = 0;
+        while (size < want) {
+            ssize_t got = pread(ra->fd, ra->blocks[slot] + size, want - size,
+                                offset + size);
+            if (got <= 0) {
+                error = 1;
+                break;
+            }
+            size += got;
+        }
+
+        pthread_mutex_lock(&ra->lock);
+        ra->sizes[slot] = size;
+        ra->error |= error;
+        ra->head += !error;
+        pthread_cond_signal(&ra->cond);
+        pthread_mutex_unlock(&ra->lock);
+
+        if (error) break;
+        offset += size;
+    }
+
+    return NULL;
+}
+
+
+static int LazyCSV_ScanReadahead(LazyCSV_Scanner *s, int fd, size_t file_len,
+                                 size_t block_size) {
+
+    LazyCSV_Readahead ra = {.fd = fd,
+                            .error = 0,
+                            .file_len = file_len,
+                            .block_size = block_size,
+                            .head = 0,
+                            .tail = 0};
+
+    for (size_t i = 0; i < LAZYCSV_READAHEAD_DEPTH; i++) {
+        ra.blocks[i] = malloc(block_size);
+        if (!ra.blocks[i]) {
+            for (size_t j = 0; j < i; j++)
+                free(ra.blocks[j]);
+            return -1;
+        }
+    }
+
+    pthread_mutex_init(&ra.lock, NULL);
+    pthread_cond_init(&ra.cond, NULL);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    pthread_t worker;
+    int error = pthread_create(&worker, NULL, LazyCSV_ReadaheadWorker, &ra);
+    int started = !error;
+
+    for (size_t offset = 0; !error && offset < file_len; ) {
+        pthread_mutex_lock(&ra.lock);
+        while (ra.head == ra.tail && !ra.error)
+            pthread_cond_wait(&ra.cond, &ra.lock);
+        size_t slot = ra.tail % LAZYCSV_READAHEAD_DEPTH;
+        error = ra.head == ra.tail;
+        pthread_mutex_unlock(&ra.lock);
+
+        if (error) break;
+
+        LazyCSV_ScanChunk(s, ra.blocks[slot], ra.sizes[slot], offset);
+        offset += ra.sizes[slot];
+
+        pthread_mutex_lock(&ra.lock);
+        ra.tail += 1;
+        pthread_cond_signal(&ra.cond);
+        pthread_mutex_unlock(&ra.lock);
+    }
+
+    // the consumer only stops early when the worker has failed, at which
+    // point the worker has already exited.
+    if (started)
+        pthread_join(worker, NULL);
+
+    pthread_mutex_destroy(&ra.lock);
+    pthread_cond_destroy(&ra.cond);
+
+    for (size_t i = 0; i < LAZYCSV_READAHEAD_DEPTH; i++)
+        free(ra.blocks[i]);
+
+    return error ? -1 : 0;
+}
+
+
+// streams (pipes, sockets, python file objects) are read in blocks which are
+// indexed and appended to a data file in the same pass, the data file is then
+// memory mapped in place of a user file once the stream is exhausted.
+
+#define LAZYCSV_STREAM_BLOCK 1048576 // 2**20
+
+static int LazyCSV_ScanStream(LazyCSV_Scanner *s, LazyCSV_Reader reader,
+                              void *context, int fd, size_t block_size,
+                              size_t *file_len, LazyCSV_Error *error) {
+
+    char* block = malloc(block_size);
+    if (!block) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for the stream"
+        };
+        return -1;
+    }
+
+    int failed = 0;
+    size_t offset = 0;
+
+    for (;;) {
+        ssize_t size = reader(context, block, block_size);
+
+        if (size <= 0) {
+            if (size < 0) {
+                *error = (LazyCSV_Error){
+                    LAZYCSV_ERROR_READER,
+                    "unable to read data file"
+                };
+                failed = 1;
+            }
+            break;
+        }
+
+        LazyCSV_ScanChunk(s, block, size, offset);
+
+        for (ssize_t written = 0; written < size; ) {
+            ssize_t n = write(fd, block + written, size - written);
+            if (n < 0) {
+                *error = (LazyCSV_Error){
+                    LAZYCSV_ERROR_RUNTIME,
+                    "unable to write to data file"
+                };
+                failed = 1;
+                break;
+            }
+            written += n;
+        }
+
+        if (failed) break;
+        offset += size;
+    }
+
+    free(block);
+
+    *file_len = offset;
+    return failed ? -1 : 0;
+}
+
+
+#if INCLUDE_ZLIB || INCLUDE_ZSTD
+static int LazyCSV_CheckpointToDisk(int fd, LazyCSV_Checkpoint *cpnt) {
+    char* data = (char*)cpnt;
+    for (size_t written = 0; written < sizeof(LazyCSV_Checkpoint); ) {
+        ssize_t n = write(fd, data + written,
+                          sizeof(LazyCSV_Checkpoint) - written);
+        if (n < 0) return -1;
+        written += n;
+    }
+    return 0;
+}
+#endif
+
+
+static inline int LazyCSV_CodecFromMagic(char *file, size_t file_len) {
+    unsigned char* magic = (unsigned char*)file;
+    if (file_len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return LAZYCSV_CODEC_GZIP;
+    if (file_len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5
+            && magic[2] == 0x2f && magic[3] == 0xfd)
+        return LAZYCSV_CODEC_ZSTD;
+    return LAZYCSV_CODEC_NONE;
+}
+
+
+#if INCLUDE_ZLIB
+static inline void LazyCSV_InflateRefill(z_stream *strm, unsigned char *comp,
+                                         size_t comp_len) {
+    if (!strm->avail_in) {
+        size_t remaining = comp_len - (strm->next_in - comp);
+        strm->avail_in = remaining > UINT_MAX ? UINT_MAX : remaining;
+    }
+}
+
+
+static inline int LazyCSV_GzipMember(unsigned char *comp, size_t comp_len,
+                                     size_t in) {
+    return in + 2 <= comp_len && comp[in] == 0x1f && comp[in + 1] == 0x8b;
+}
+
+
+static int LazyCSV_ScanGzip(LazyCSV_Scanner *s, char *file, size_t file_len,
+                            int zfile, size_t *data_len) {
+
+    // inflate the file into a circular window of the last 32K of output,
+    // which is both scanned and saved along with a checkpoint whenever
+    // inflate stops at a deflate block boundary a span past the last one.
+
+    unsigned char* comp = (unsigned char*)file;
+    unsigned char* window = malloc(LAZYCSV_WINDOW);
+    LazyCSV_Checkpoint* cpnt = malloc(sizeof(LazyCSV_Checkpoint));
+
+    z_stream strm = {.zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL};
+    strm.next_in = comp;
+    strm.avail_in = 0;
+
+    if (!window || !cpnt || inflateInit2(&strm, 47) != Z_OK) {
+        free(window);
+        free(cpnt);
+        return -1;
+    }
+
+    size_t out = 0, last = 0;
+    int ret, error = 0;
+
+    *cpnt = (LazyCSV_Checkpoint){.out = 0, .in = 0, .bits = -1};
+    error = LazyCSV_CheckpointToDisk(zfile, cpnt);
+
+    strm.avail_out = 0;
+
+    while (!error) {
+        if (!strm.avail_out) {
+            strm.next_out = window;
+            strm.avail_out = LAZYCSV_WINDOW;
+        }
+        LazyCSV_InflateRefill(&strm, comp, file_len);
+
+        unsigned char* next_out = strm.next_out;
+        ret = inflate(&strm, Z_BLOCK);
+
+        size_t produced = strm.next_out - next_out;
+        LazyCSV_ScanChunk(s, (char*)next_out, produced, out);
+        out += produced;
+
+        if (ret == Z_STREAM_END) {
+            size_t in = strm.next_in - comp;
+            if (!LazyCSV_GzipMember(comp, file_len, in))
+                break;
+
+            // concatenated gzip members (i.e. from pigz or bgzip) each start
+            // with a fresh deflate stream, no history is required.
+            inflateReset(&strm);
+            *cpnt = (LazyCSV_Checkpoint){.out = out, .in = in, .bits = -1};
+            error = LazyCSV_CheckpointToDisk(zfile, cpnt);
+            last = out;
+            continue;
+        }
+
+        if (ret != Z_OK || (!produced && strm.next_in == comp + file_len)) {
+            error = 1;
+            break;
+        }
+
+        int boundary = (strm.data_type & 128) && !(strm.data_type & 64);
+
+        if (boundary && out - last > LAZYCSV_SPAN) {
+            size_t left = strm.avail_out;
+            size_t in = strm.next_in - comp;
+
+            cpnt->out = out;
+            cpnt->in = in;
+            cpnt->bits = strm.data_type & 7;
+
+            if (left)
+                memcpy(cpnt->window, window + LAZYCSV_WINDOW - left, left);
+            if (left < LAZYCSV_WINDOW)
+                memcpy(cpnt->window + left, window, LAZYCSV_WINDOW - left);
+
+            error = LazyCSV_CheckpointToDisk(zfile, cpnt);
+            last = out;
+        }
+    }
+
+    inflateEnd(&strm);
+    free(window);
+    free(cpnt);
+
+    *data_len = out;
+    return error ? -1 : 0;
+}
+#endif
+
+
+#if INCLUDE_ZSTD
+static int LazyCSV_ScanZstd(LazyCSV_Scanner *s, char *file, size_t file_len,
+                            int zfile, size_t *data_len) {
+
+    // the decoder state of a zstd frame can't be saved, so checkpoints are
+    // only recorded at frame boundaries. Random access into single frame
+    // files decompresses from the start of the file.
+
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    size_t capacity = ZSTD_DStreamOutSize();
+    char* block = malloc(capacity);
+    LazyCSV_Checkpoint* cpnt = malloc(sizeof(LazyCSV_Checkpoint));
+
+    int error = !dctx || !block || !cpnt;
+
+    ZSTD_inBuffer input = {.src = file, .size = file_len, .pos = 0};
+    size_t out = 0;
+
+    if (!error) {
+        *cpnt = (LazyCSV_Checkpoint){.out = 0, .in = 0, .bits = -1};
+        error = LazyCSV_CheckpointToDisk(zfile, cpnt);
+    }
+
+    while (!error && input.pos < input.size) {
+        ZSTD_outBuffer output = {.dst = block, .size = capacity, .pos = 0};
+        size_t ret = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(ret)) {
+            error = 1;
+            break;
+        }
+
+        LazyCSV_ScanChunk(s, block, output.pos, out);
+        out += output.pos;
+
+        if (!ret && input.pos < input.size) {
+            *cpnt = (LazyCSV_Checkpoint){
+                .out = out, .in = input.pos, .bits = -1
+            };
+            error = LazyCSV_CheckpointToDisk(zfile, cpnt);
+        }
+    }
+
+    ZSTD_freeDCtx(dctx);
+    free(block);
+    free(cpnt);
+
+    *data_len = out;
+    return error ? -1 : 0;
+}
+#endif
+
+
+static inline LazyCSV_Checkpoint *LazyCSV_CheckpointFromOffset(
+    LazyCSV_Table *table, size_t offset) {
+
+    LazyCSV_Checkpoint* cpnts =
+        (LazyCSV_Checkpoint*)table->checkpoints->data;
+    size_t L = 0, R =
+        table->checkpoints->st.st_size / sizeof(LazyCSV_Checkpoint);
+
+    // the first checkpoint is always at offset 0, find the last checkpoint
+    // at or before offset.
+
+    while (R - L > 1) {
+        size_t M = L + ((R - L)/2);
+        if (cpnts[M].out <= offset)
+            L = M;
+        else
+            R = M;
+    }
+    return cpnts + L;
+}
+
+
+void LazyCSV_SpanFree(LazyCSV_Table *table, LazyCSV_Span *span) {
+    if (span->state) {
+#if INCLUDE_ZLIB
+        if (table->codec == LAZYCSV_CODEC_GZIP) {
+            inflateEnd((z_stream*)span->state);
+            free(span->state);
+        }
+#endif
+#if INCLUDE_ZSTD
+        if (table->codec == LAZYCSV_CODEC_ZSTD)
+            ZSTD_freeDCtx((ZSTD_DCtx*)span->state);
+#endif
+    }
+    free(span->data);
+    *span = (LazyCSV_Span){0};
+}
+
+
+static int LazyCSV_SpanRestart(LazyCSV_Table *table, LazyCSV_Span *span,
+                               LazyCSV_Checkpoint *cpnt) {
+
+    span->in = cpnt->in;
+    span->live = 0;
+
+#if INCLUDE_ZLIB
+    if (table->codec == LAZYCSV_CODEC_GZIP) {
+        z_stream* strm = (z_stream*)span->state;
+        unsigned char* comp = (unsigned char*)table->data->data;
+
+        if (!strm) {
+            strm = calloc(1, sizeof(z_stream));
+            if (!strm || inflateInit2(strm, 47) != Z_OK) {
+                free(strm);
+                return -1;
+            }
+            span->state = strm;
+        }
+
+        // checkpoints at member starts are read with their gzip header,
+        // checkpoints inside of a member restart a raw deflate stream from
+        // the saved bit offset and window.
+
+        span->raw = cpnt->bits != -1;
+        if (inflateReset2(strm, span->raw ? -15 : 47) != Z_OK)
+            return -1;
+
+        strm->next_in = comp + cpnt->in;
+        strm->avail_in = 0;
+
+        if (span->raw) {
+            if (cpnt->bits) {
+                strm->next_in -= 1;
+                int prime = comp[cpnt->in - 1] >> (8 - cpnt->bits);
+                if (inflatePrime(strm, cpnt->bits, prime) != Z_OK)
+                    return -1;
+                strm->next_in += 1;
+            }
+            if (inflateSetDictionary(strm, cpnt->window,
+                                     LAZYCSV_WINDOW) != Z_OK)
+                return -1;
+        }
+    }
+#endif
+#if INCLUDE_ZSTD
+    if (table->codec == LAZYCSV_CODEC_ZSTD) {
+        if (!span->state) {
+            span->state = ZSTD_createDCtx();
+            if (!span->state)
+                return -1;
+        }
+        ZSTD_DCtx_reset((ZSTD_DCtx*)span->state, ZSTD_reset_session_only);
+    }
+#endif
+
+    span->live = 1;
+    return 0;
+}
+
+
+static size_t LazyCSV_SpanRead(LazyCSV_Table *table, LazyCSV_Span *span,
+                               char *dst, size_t size) {
+
+    // decompress up to `size` bytes into dst, returns the number of bytes
+    // produced which is only short of `size` at the end of the data, or
+    // SIZE_MAX if the data is corrupt.
+
+    size_t produced = 0;
+
+#if INCLUDE_ZLIB
+    if (table->codec == LAZYCSV_CODEC_GZIP) {
+        z_stream* strm = (z_stream*)span->state;
+        unsigned char* comp = (unsigned char*)table->data->data;
+        size_t comp_len = table->data->st.st_size;
+
+        while (produced < size) {
+            size_t want = size - produced;
+            strm->next_out = (unsigned char*)dst + produced;
+            strm->avail_out = want > UINT_MAX ? UINT_MAX : want;
+            LazyCSV_InflateRefill(strm, comp, comp_len);
+
+            unsigned char* next_out = strm->next_out;
+            int ret = inflate(strm, Z_NO_FLUSH);
+            produced += strm->next_out - next_out;
+
+            if (ret == Z_STREAM_END) {
+                size_t in = strm->next_in - comp;
+
+                // a raw stream stops before the gzip trailer of its member
+                if (span->raw)
+                    in += 8;
+                if (!LazyCSV_GzipMember(comp, comp_len, in))
+                    break;
+
+                span->raw = 0;
+                inflateReset2(strm, 47);
+                strm->next_in = comp + in;
+                strm->avail_in = 0;
+            }
+            else if (ret != Z_OK) {
+                span->live = 0;
+                return SIZE_MAX;
+            }
+        }
+    }
+#endif
+#if INCLUDE_ZSTD
+    if (table->codec == LAZYCSV_CODEC_ZSTD) {
+        ZSTD_inBuffer input = {
+            .src = table->data->data,
+            .size = table->data->st.st_size,
+            .pos = span->in
+        };
+        ZSTD_outBuffer output = {.dst = dst, .size = size, .pos = 0};
+
+        while (output.pos < output.size && input.pos < input.size) {
+            size_t ret = ZSTD_decompressStream((ZSTD_DCtx*)span->state,
+                                               &output, &input);
+            if (ZSTD_isError(ret)) {
+                span->live = 0;
+                return SIZE_MAX;
+            }
+        }
+        span->in = input.pos;
+        produced = output.pos;
+    }
+#endif
+
+    return produced;
+}
+
+
+char* LazyCSV_SpanFill(LazyCSV_Table *table, LazyCSV_Span *span,
+                       size_t offset, size_t len) {
+
+    // decompress a span sized window starting a little before offset, or
+    // mostly before it when reading backwards, so that iterating in either
+    // direction stays inside of the window for a while. moving forward
+    // resumes the decoder where it left off rather than restarting from a
+    // checkpoint whenever that is no further back.
+
+    size_t behind = span->data && offset < span->start
+        ? LAZYCSV_SPAN - LAZYCSV_SPAN/4
+        : LAZYCSV_SPAN/4;
+
+    size_t lo = offset > behind ? offset - behind : 0;
+    size_t hi = offset + len > lo + LAZYCSV_SPAN
+        ? offset + len
+        : lo + LAZYCSV_SPAN;
+
+    if (span->capacity < hi - lo) {
+        char* data = realloc(span->data, hi - lo);
+        if (!data) {
+            span->error = (LazyCSV_Error){
+                LAZYCSV_ERROR_MEMORY,
+                "unable to allocate memory for decompression"
+            };
+            return NULL;
+        }
+        span->data = data;
+        span->capacity = hi - lo;
+    }
+
+    LazyCSV_Checkpoint* cpnt = LazyCSV_CheckpointFromOffset(table, lo);
+
+    size_t pos;
+    if (span->live && span->start <= lo && cpnt->out <= span->end) {
+        if (lo < span->end)
+            memmove(span->data, span->data + (lo - span->start),
+                    span->end - lo);
+        pos = span->end;
+    }
+    else {
+        if (LazyCSV_SpanRestart(table, span, cpnt) < 0) {
+            span->error = (LazyCSV_Error){
+                LAZYCSV_ERROR_RUNTIME,
+                "unable to initialize decompression"
+            };
+            return NULL;
+        }
+        pos = cpnt->out;
+    }
+
+    span->start = span->end = 0;
+
+    // output ahead of lo is decompressed into the window and discarded
+
+    size_t read = 0;
+    while (pos < lo) {
+        size_t skip = lo - pos > span->capacity ? span->capacity : lo - pos;
+        read = LazyCSV_SpanRead(table, span, span->data, skip);
+        if (read == SIZE_MAX || read < skip)
+            goto corrupt;
+        pos += read;
+    }
+
+    read = LazyCSV_SpanRead(table, span, span->data + (pos - lo), hi - pos);
+    if (read == SIZE_MAX)
+        goto corrupt;
+
+    span->start = lo;
+    span->end = pos + read;
+
+    if (offset + len > span->end)
+        goto corrupt;
+
+    return span->data + (offset - lo);
+
+corrupt:
+    span->live = 0;
+    span->error = (LazyCSV_Error){
+        LAZYCSV_ERROR_VALUE,
+        "unable to decompress data file, the file may be corrupt"
+    };
+    return NULL;
+}
+
+
+// names are kept absolute, so that a process with another working directory
+// attaching to a shared table finds the same files. A name is kept as it is
+// if it can't be resolved.
+
+static char* LazyCSV_AbsoluteName(char *name) {
+    char* absolute = name ? realpath(name, NULL) : NULL;
+    if (!absolute)
+        return name;
+    free(name);
+    return absolute;
+}
+
+
+static int LazyCSV_FileFromName(LazyCSV_File **file, char *name, int flags) {
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) < 0) {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    char* data = st.st_size
+        ? mmap(NULL, st.st_size, PROT_READ, flags, fd, 0)
+        : NULL;
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return -1;
+
+    *file = malloc(sizeof(LazyCSV_File));
+    (*file)->name = LazyCSV_AbsoluteName(name);
+    (*file)->data = data;
+    (*file)->st = st;
+    (*file)->owned = 1;
+    (*file)->pid = getpid();
+
+    return 0;
+}
+
+
+static void LazyCSV_FileFree(LazyCSV_File *file) {
+    if (!file)
+        return;
+    if (file->data)
+        munmap(file->data, file->st.st_size);
+    // a forked child sharing the table leaves the files to its parent
+    if (file->owned && file->pid == getpid())
+        remove(file->name);
+    free(file->name);
+    free(file);
+}
+
+
+static void LazyCSV_FileAdvise(LazyCSV_File *file,
+                               const LazyCSV_TableOptions *options) {
+    madvise(file->data, file->st.st_size, options->advice);
+#ifdef MADV_HUGEPAGE
+    if (options->hugepages)
+        madvise(file->data, file->st.st_size, MADV_HUGEPAGE);
+#endif
+}
+
+
+// state of a table under construction. Index files are removed on failure,
+// and once mapped belong to the LazyCSV_File mapping them.
+
+typedef struct {
+    const LazyCSV_TableOptions* options;
+    LazyCSV_Error* error;
+    const char* path;
+    char* data_index;
+    char* comma_index;
+    char* anchor_index;
+    char* newline_index;
+    char* checkpoint_index;
+    int ufd;
+    int codec;
+    char* file;
+    size_t file_len;
+    size_t data_len;
+    struct stat ust;
+    LazyCSV_Scanner scanner;
+    char overcount;
+    double scan_seconds;
+    double flush_seconds;
+} LazyCSV_TableBuild;
+
+
+static inline int LazyCSV_BuildError(LazyCSV_TableBuild *build, int code,
+                                     const char *message) {
+    *build->error = (LazyCSV_Error){code, message};
+    return -1;
+}
+
+
+static pthread_once_t LazyCSV_PageSizeOnce = PTHREAD_ONCE_INIT;
+
+static void LazyCSV_PageSizeInit(void) {
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pagesize > 0)
+        LAZYCSV_PAGESIZE = pagesize;
+}
+
+
+static int LazyCSV_BuildOpen(LazyCSV_TableBuild *build) {
+    build->ufd = build->path ? open(build->path, O_RDONLY) : -1;
+    if (build->ufd == -1) {
+        return LazyCSV_BuildError(
+            build,
+            LAZYCSV_ERROR_NOT_FOUND,
+            "unable to open data file,"
+            " check to be sure that the user has read permissions"
+            " and/or ownership of the file, and that the file exists."
+        );
+    }
+
+    if (fstat(build->ufd, &build->ust) < 0) {
+        return LazyCSV_BuildError(
+            build,
+            LAZYCSV_ERROR_RUNTIME,
+            "unable to stat user file"
+        );
+    }
+
+    build->file_len = build->ust.st_size;
+    if (build->file_len) {
+        build->file = mmap(NULL, build->file_len, PROT_READ, MAP_PRIVATE,
+                           build->ufd, 0);
+        if (build->file == MAP_FAILED) {
+            build->file = NULL;
+            return LazyCSV_BuildError(
+                build,
+                LAZYCSV_ERROR_RUNTIME,
+                "unable to map data file"
+            );
+        }
+        build->codec = LazyCSV_CodecFromMagic(build->file, build->file_len);
+    }
+
+    if (build->codec == LAZYCSV_CODEC_GZIP && !INCLUDE_ZLIB)
+        return LazyCSV_BuildError(
+            build,
+            LAZYCSV_ERROR_VALUE,
+            "gzip compressed files require lazycsv to be built"
+            " with LAZYCSV_INCLUDE_ZLIB=1"
+        );
+    if (build->codec == LAZYCSV_CODEC_ZSTD && !INCLUDE_ZSTD)
+        return LazyCSV_BuildError(
+            build,
+            LAZYCSV_ERROR_VALUE,
+            "zstd compressed files require lazycsv to be built"
+            " with LAZYCSV_INCLUDE_ZSTD=1"
+        );
+
+    return 0;
+}
+
+
+static int LazyCSV_BuildSpool(LazyCSV_TableBuild *build,
+                              const char *index_dir) {
+
+    // non-seekable inputs are spooled into a data file next to the index
+    // files while they are being indexed.
+
+    build->data_index = tempnam(index_dir, "LzyD_");
+    build->ufd = build->data_index
+        ? open(build->data_index, O_RDWR|O_CREAT|O_EXCL, S_IRWXU)
+        : -1;
+    if (build->ufd == -1) {
+        return LazyCSV_BuildError(
+            build,
+            LAZYCSV_ERROR_RUNTIME,
+            "unable to create data file in index directory"
+        );
+    }
+    return 0;
+}
+
+
+static int LazyCSV_BuildScan(LazyCSV_TableBuild *build, const char *index_dir,
+                             LazyCSV_Reader reader, void *context) {
+
+    const LazyCSV_TableOptions* options = build->options;
+
+    // fields of a row index are found by scanning the data, which isn't
+    // addressable in place for compressed files.
+    if (options->index_mode == LAZYCSV_INDEX_ROWS && build->codec)
+        return LazyCSV_BuildError(
+            build,
+            LAZYCSV_ERROR_VALUE,
+            "index_mode='rows' is not supported for compressed files"
+        );
+
+    LazyCSV_CommaWriter* writer = NULL;
+    if (options->index_mode != LAZYCSV_INDEX_FLAT) {
+        writer = calloc(1, sizeof(LazyCSV_CommaWriter));
+        if (!writer)
+            return LazyCSV_BuildError(
+                build,
+                LAZYCSV_ERROR_MEMORY,
+                "unable to allocate memory for the comma index"
+            );
+        writer->mode = options->index_mode;
+        writer->every = options->checkpoint_cols;
+    }
+
+    build->comma_index = tempnam(index_dir, "LzyC_");
+    build->anchor_index = tempnam(index_dir, "LzyA_");
+    build->newline_index = tempnam(index_dir, "LzyN_");
+    if (build->codec)
+        build->checkpoint_index = tempnam(index_dir, "LzyZ_");
+
+    int file_flags = O_WRONLY|O_CREAT|O_EXCL;
+
+    int comma_file = open(build->comma_index, file_flags, S_IRWXU);
+    int anchor_file = open(build->anchor_index, file_flags, S_IRWXU);
+    int newline_file = open(build->newline_index, file_flags, S_IRWXU);
+    int checkpoint_file = build->codec
+        ? open(build->checkpoint_index, file_flags, S_IRWXU)
+        : -1;
+
+    size_t buffer_capacity = options->buffer_capacity;
+
+    build->scanner = (LazyCSV_Scanner){
+        .quoted = 0,
+        .cm1 = LINE_FEED,
+        .row_start = 1,
+        .delimiter = options->delimiter,
+        .quotechar = options->quotechar,
+        .overflow = 0,
+        .newline_pending = 0,
+        .newline = -1,
+        .cols = SIZE_MAX,
+        .row_index = 0,
+        .col_index = 0,
+        .overflow_warning = NULL,
+        .underflow_warning = NULL,
+        .row_count = 0,
+        .anchor_count = 0,
+        .writer = writer,
+        .comma_file = comma_file,
+        .anchor_file = anchor_file,
+        .newline_file = newline_file,
+        .comma_buffer = {.data = malloc(buffer_capacity),
+                         .size = 0,
+                         .capacity = buffer_capacity},
+        .anchor_buffer = {.data = malloc(buffer_capacity),
+                          .size = 0,
+                          .capacity = buffer_capacity},
+        .newline_buffer = {.data = malloc(buffer_capacity),
+                           .size = 0,
+                           .capacity = buffer_capacity},
+    };
+
+    LazyCSV_Scanner* scanner = &build->scanner;
+    int scan_error = 0;
+    double started = LazyCSV_Now();
+
+    if (reader) {
+        size_t block_size = options->readahead
+            ? options->readahead
+            : LAZYCSV_STREAM_BLOCK;
+        scan_error = LazyCSV_ScanStream(scanner, reader, context, build->ufd,
+                                        block_size, &build->file_len,
+                                        build->error);
+        build->data_len = build->file_len;
+    }
+    else if (build->codec) {
+        // compressed files are decompressed once front to back, the
+        // readahead pipeline doesn't apply.
+        madvise(build->file, build->file_len, MADV_SEQUENTIAL);
+#if INCLUDE_ZLIB
+        if (build->codec == LAZYCSV_CODEC_GZIP)
+            scan_error = LazyCSV_ScanGzip(scanner, build->file,
+                                          build->file_len, checkpoint_file,
+                                          &build->data_len);
+#endif
+#if INCLUDE_ZSTD
+        if (build->codec == LAZYCSV_CODEC_ZSTD)
+            scan_error = LazyCSV_ScanZstd(scanner, build->file,
+                                          build->file_len, checkpoint_file,
+                                          &build->data_len);
+#endif
+        if (scan_error)
+            LazyCSV_BuildError(
+                build,
+                LAZYCSV_ERROR_VALUE,
+                "unable to decompress data file, the file may be corrupt"
+            );
+    }
+    else if (options->readahead) {
+        scan_error = LazyCSV_ScanReadahead(scanner, build->ufd,
+                                           build->file_len,
+                                           options->readahead);
+        if (scan_error)
+            LazyCSV_BuildError(
+                build,
+                LAZYCSV_ERROR_RUNTIME,
+                "unable to read data file"
+            );
+        build->data_len = build->file_len;
+    }
+    else {
+        // the index pass reads the file front to back exactly once, let the
+        // kernel read ahead aggressively and drop pages behind the scan.
+        madvise(build->file, build->file_len, MADV_SEQUENTIAL);
+        LazyCSV_ScanChunk(scanner, build->file, build->file_len, 0);
+        build->data_len = build->file_len;
+    }
+
+    build->overcount = LazyCSV_ScanFinish(scanner, build->data_len);
+
+    double scanned = LazyCSV_Now();
+    build->scan_seconds = scanned - started;
+
+    LazyCSV_BufferFlush(comma_file, &scanner->comma_buffer);
+    LazyCSV_BufferFlush(anchor_file, &scanner->anchor_buffer);
+    LazyCSV_BufferFlush(newline_file, &scanner->newline_buffer);
+
+    close(comma_file);
+    close(anchor_file);
+    close(newline_file);
+    if (build->codec)
+        close(checkpoint_file);
+
+    free(scanner->comma_buffer.data);
+    free(scanner->anchor_buffer.data);
+    free(scanner->newline_buffer.data);
+    free(scanner->writer);
+
+    build->flush_seconds = LazyCSV_Now() - scanned;
+
+    if (scan_error)
+        return -1;
+
+    if (!build->data_len) {
+        return LazyCSV_BuildError(
+            build,
+            LAZYCSV_ERROR_VALUE,
+            "unable to index an empty file"
+        );
+    }
+
+    if (reader) {
+        if (fstat(build->ufd, &build->ust) < 0) {
+            return LazyCSV_BuildError(
+                build,
+                LAZYCSV_ERROR_RUNTIME,
+                "unable to stat data file"
+            );
+        }
+        build->file = mmap(NULL, build->file_len, PROT_READ, MAP_PRIVATE,
+                           build->ufd, 0);
+        if (build->file == MAP_FAILED) {
+            build->file = NULL;
+            return LazyCSV_BuildError(
+                build,
+                LAZYCSV_ERROR_RUNTIME,
+                "unable to map data file"
+            );
+        }
+    }
+
+    // the maps stay valid once the descriptor is closed, which keeps a
+    // dataset of many files from running out of descriptors.
+    close(build->ufd);
+    build->ufd = -1;
+
+    return 0;
+}
+
+
+static void LazyCSV_BuildCleanup(LazyCSV_TableBuild *build) {
+    char* names[] = {
+        build->comma_index,
+        build->anchor_index,
+        build->newline_index,
+        build->checkpoint_index,
+        build->data_index,
+    };
+
+    for (size_t i = 0; i < sizeof(names)/sizeof(char*); i++) {
+        if (names[i]) {
+            remove(names[i]);
+            free(names[i]);
+        }
+    }
+
+    if (build->file)
+        munmap(build->file, build->file_len);
+    if (build->ufd != -1)
+        close(build->ufd);
+}
+
+
+static LazyCSV_Table* LazyCSV_BuildFinish(LazyCSV_TableBuild *build) {
+    const LazyCSV_TableOptions* options = build->options;
+    LazyCSV_Scanner* scanner = &build->scanner;
+
+    int index_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (options->populate) index_flags |= MAP_POPULATE;
+#endif
+
+    LazyCSV_File *_commas = NULL, *_anchors = NULL, *_newlines = NULL;
+    LazyCSV_File* _checkpoints = NULL;
+    LazyCSV_Table* table = NULL;
+    double started = LazyCSV_Now();
+
+    const char* map_err = NULL;
+    if (LazyCSV_FileFromName(&_commas, build->comma_index, index_flags) < 0)
+        map_err = "unable to map comma file";
+    else if (LazyCSV_FileFromName(&_anchors, build->anchor_index,
+                                  index_flags) < 0)
+        map_err = "unable to map anchor file";
+    else if (LazyCSV_FileFromName(&_newlines, build->newline_index,
+                                  index_flags) < 0)
+        map_err = "unable to map newline file";
+    else if (build->codec
+             && LazyCSV_FileFromName(&_checkpoints, build->checkpoint_index,
+                                     MAP_PRIVATE) < 0)
+        map_err = "unable to map checkpoint file";
+
+    // names which were mapped now belong to their LazyCSV_File
+    build->comma_index = _commas ? NULL : build->comma_index;
+    build->anchor_index = _anchors ? NULL : build->anchor_index;
+    build->newline_index = _newlines ? NULL : build->newline_index;
+    build->checkpoint_index =
+        _checkpoints ? NULL : build->checkpoint_index;
+
+    if (map_err) {
+        LazyCSV_BuildError(build, LAZYCSV_ERROR_RUNTIME, map_err);
+        goto free_files;
+    }
+
+    table = calloc(1, sizeof(LazyCSV_Table));
+    LazyCSV_File* _data = malloc(sizeof(LazyCSV_File));
+    char* name = build->data_index
+        ? build->data_index
+        : realpath(build->path, NULL);
+    name = name ? name : strdup(build->path);
+
+    if (!table || !_data || !name) {
+        free(_data);
+        if (!build->data_index)
+            free(name);
+        LazyCSV_BuildError(
+            build,
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for the table"
+        );
+        goto free_files;
+    }
+
+    madvise(build->file, build->file_len, options->advice);
+    LazyCSV_FileAdvise(_commas, options);
+    LazyCSV_FileAdvise(_anchors, options);
+    LazyCSV_FileAdvise(_newlines, options);
+
+    // a spooled stream is removed along with the index files
+    _data->name = build->data_index ? LazyCSV_AbsoluteName(name) : name;
+    _data->data = build->file;
+    _data->st = build->ust;
+    _data->owned = build->data_index != NULL;
+    _data->pid = getpid();
+
+    build->data_index = NULL;
+    build->file = NULL;
+
+    table->rows = scanner->row_index - build->overcount
+        + options->skip_headers;
+    table->cols = scanner->cols + 1;
+    table->skip_headers = options->skip_headers;
+    table->unquote = options->unquote;
+    table->delimiter = options->delimiter;
+    table->quotechar = options->quotechar;
+    table->newline = scanner->newline;
+    table->codec = build->codec;
+    table->index_mode = options->index_mode;
+    table->checkpoint_cols = options->checkpoint_cols;
+    table->prefetch = options->prefetch;
+    table->warnings =
+        (scanner->overflow_warning ? LAZYCSV_WARN_OVERFLOW : 0)
+        | (scanner->underflow_warning ? LAZYCSV_WARN_UNDERFLOW : 0);
+    table->overflow_rows = scanner->overflow_rows;
+    table->underflow_rows = scanner->underflow_rows;
+    table->escaped_quotes = scanner->escaped_quotes;
+    table->scan_seconds = build->scan_seconds;
+    table->flush_seconds = build->flush_seconds;
+    table->map_seconds = LazyCSV_Now() - started;
+    table->span = (LazyCSV_Span){0};
+    table->data = _data;
+    table->commas = _commas;
+    table->anchors = _anchors;
+    table->newlines = _newlines;
+    table->checkpoints = _checkpoints;
+
+    LAZYCSV_PROBE3(index__done, build->data_len, table->rows, table->cols);
+
+    LazyCSV_BuildCleanup(build);
+    return table;
+
+free_files:
+    free(table);
+    LazyCSV_FileFree(_commas);
+    LazyCSV_FileFree(_anchors);
+    LazyCSV_FileFree(_newlines);
+    LazyCSV_FileFree(_checkpoints);
+    LazyCSV_BuildCleanup(build);
+    return NULL;
+}
+
+
+static LazyCSV_Table* LazyCSV_TableBuildRun(const char *path,
+                                            LazyCSV_Reader reader,
+                                            void *context,
+                                            const char *index_dir,
+                                            const LazyCSV_TableOptions *options,
+                                            LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    LazyCSV_TableBuild build = {
+        .options = options,
+        .error = error ? error : &ignored,
+        .path = path,
+        .ufd = -1,
+    };
+
+    pthread_once(&LazyCSV_PageSizeOnce, LazyCSV_PageSizeInit);
+
+    if (options->index_mode < LAZYCSV_INDEX_FLAT
+        || options->index_mode > LAZYCSV_INDEX_ROWS) {
+        LazyCSV_BuildError(
+            &build,
+            LAZYCSV_ERROR_VALUE,
+            "index_mode must be one of LAZYCSV_INDEX_FLAT,"
+            " LAZYCSV_INDEX_COMPRESSED or LAZYCSV_INDEX_ROWS"
+        );
+        return NULL;
+    }
+
+    int opened = reader
+        ? LazyCSV_BuildSpool(&build, index_dir)
+        : LazyCSV_BuildOpen(&build);
+
+    if (opened < 0) {
+        LazyCSV_BuildCleanup(&build);
+        return NULL;
+    }
+
+    LAZYCSV_PROBE2(index__start, build.file_len, options->index_mode);
+
+    if (LazyCSV_BuildScan(&build, index_dir, reader, context) < 0) {
+        LazyCSV_BuildCleanup(&build);
+        return NULL;
+    }
+
+    return LazyCSV_BuildFinish(&build);
+}
+
+
+void LazyCSV_TableOptionsInit(LazyCSV_TableOptions *options) {
+    *options = (LazyCSV_TableOptions){
+        .delimiter = ',',
+        .quotechar = '"',
+        .skip_headers = 0,
+        .unquote = 1,
+        .index_mode = LAZYCSV_INDEX_FLAT,
+        .checkpoint_cols = 0,
+        .buffer_capacity = 2097152, // 2**21
+        .readahead = 0,
+        .prefetch = 0,
+        .advice = MADV_NORMAL,
+        .populate = 0,
+        .hugepages = 0,
+    };
+}
+
+
+LazyCSV_Table* LazyCSV_TableIndex(const char *path, const char *index_dir,
+                                  const LazyCSV_TableOptions *options,
+                                  LazyCSV_Error *error) {
+    return LazyCSV_TableBuildRun(path, NULL, NULL, index_dir, options, error);
+}
+
+
+LazyCSV_Table* LazyCSV_TableIndexStream(LazyCSV_Reader reader,
+                                        void *context,
+                                        const char *index_dir,
+                                        const LazyCSV_TableOptions *options,
+                                        LazyCSV_Error *error) {
+    return LazyCSV_TableBuildRun(NULL, reader, context, index_dir, options,
+                                 error);
+}
+
+
+LazyCSV_Table* LazyCSV_TableAttach(const LazyCSV_TableShare *share,
+                                   const LazyCSV_TableOptions *options,
+                                   LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    LazyCSV_TableOptions defaults;
+    error = error ? error : &ignored;
+
+    if (!options) {
+        LazyCSV_TableOptionsInit(&defaults);
+        options = &defaults;
+    }
+
+    pthread_once(&LazyCSV_PageSizeOnce, LazyCSV_PageSizeInit);
+
+    if (share->index_mode < LAZYCSV_INDEX_FLAT
+        || share->index_mode > LAZYCSV_INDEX_ROWS
+        || share->codec < LAZYCSV_CODEC_NONE
+        || share->codec > LAZYCSV_CODEC_ZSTD
+        || (share->codec && !share->checkpoint_name)
+        || (share->codec == LAZYCSV_CODEC_GZIP && !INCLUDE_ZLIB)
+        || (share->codec == LAZYCSV_CODEC_ZSTD && !INCLUDE_ZSTD)) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "shared index is not supported by this build of lazycsv"
+        };
+        return NULL;
+    }
+
+    LazyCSV_Table* table = calloc(1, sizeof(LazyCSV_Table));
+    if (!table) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for the table"
+        };
+        return NULL;
+    }
+
+    int index_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (options->populate) index_flags |= MAP_POPULATE;
+#endif
+
+    const char* names[] = {
+        share->data_name, share->comma_name, share->anchor_name,
+        share->newline_name, share->checkpoint_name,
+    };
+    size_t sizes[] = {
+        share->data_bytes, share->comma_bytes, share->anchor_bytes,
+        share->newline_bytes, share->checkpoint_bytes,
+    };
+    LazyCSV_File** files[] = {
+        &table->data, &table->commas, &table->anchors, &table->newlines,
+        &table->checkpoints,
+    };
+
+    for (size_t i = 0; i < 5; i++) {
+        if (!names[i] && i == 4)
+            continue;
+
+        char* name = names[i] ? strdup(names[i]) : NULL;
+        int flags = i == 0 || i == 4 ? MAP_PRIVATE : index_flags;
+        if (!name || LazyCSV_FileFromName(files[i], name, flags) < 0) {
+            free(name);
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_NOT_FOUND,
+                "unable to open shared index file, the table which built it"
+                " may have been closed"
+            };
+            goto free_table;
+        }
+
+        (*files[i])->owned = 0;
+        if ((size_t)(*files[i])->st.st_size != sizes[i]) {
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_VALUE,
+                "shared index file has changed since it was shared"
+            };
+            goto free_table;
+        }
+    }
+
+    madvise(table->data->data, table->data->st.st_size, options->advice);
+    LazyCSV_FileAdvise(table->commas, options);
+    LazyCSV_FileAdvise(table->anchors, options);
+    LazyCSV_FileAdvise(table->newlines, options);
+
+    table->rows = share->rows;
+    table->cols = share->cols;
+    table->skip_headers = share->skip_headers;
+    table->unquote = share->unquote;
+    table->delimiter = share->delimiter;
+    table->quotechar = share->quotechar;
+    table->newline = share->newline;
+    table->codec = share->codec;
+    table->index_mode = share->index_mode;
+    table->checkpoint_cols = share->checkpoint_cols;
+    table->prefetch = share->prefetch;
+    table->escaped_quotes = share->escaped_quotes;
+    table->warnings = share->warnings;
+
+    return table;
+
+free_table:
+    LazyCSV_TableClose(table);
+    return NULL;
+}
+
+
+void LazyCSV_TableClose(LazyCSV_Table *table) {
+    if (!table)
+        return;
+
+    LazyCSV_SpanFree(table, &table->span);
+
+    LazyCSV_FileFree(table->data);
+    LazyCSV_FileFree(table->commas);
+    LazyCSV_FileFree(table->anchors);
+    LazyCSV_FileFree(table->newlines);
+    LazyCSV_FileFree(table->checkpoints);
+
+    for (size_t i = 0; table->keys && i < table->cols; i++)
+        LazyCSV_FileFree(table->keys[i]);
+    free(table->keys);
+
+    for (size_t i = 0; table->columns && i < table->cols; i++)
+        LazyCSV_FileFree(table->columns[i]);
+    free(table->columns);
+
+    free(table);
+}
+
+
+size_t LazyCSV_TableRows(const LazyCSV_Table *table) {
+    return table->rows;
+}
+
+
+size_t LazyCSV_TableCols(const LazyCSV_Table *table) {
+    return table->cols;
+}
+
+
+int LazyCSV_TableWarnings(const LazyCSV_Table *table) {
+    return table->warnings;
+}
+
+
+const char* LazyCSV_TableDataName(const LazyCSV_Table *table) {
+    return table->data->name;
+}
+
+
+void LazyCSV_TableShareGet(const LazyCSV_Table *table,
+                           LazyCSV_TableShare *share) {
+    LazyCSV_File* checkpoints = table->checkpoints;
+
+    *share = (LazyCSV_TableShare){
+        .data_name = table->data->name,
+        .comma_name = table->commas->name,
+        .anchor_name = table->anchors->name,
+        .newline_name = table->newlines->name,
+        .checkpoint_name = checkpoints ? checkpoints->name : NULL,
+        .data_bytes = table->data->st.st_size,
+        .comma_bytes = table->commas->st.st_size,
+        .anchor_bytes = table->anchors->st.st_size,
+        .newline_bytes = table->newlines->st.st_size,
+        .checkpoint_bytes = checkpoints ? checkpoints->st.st_size : 0,
+        .rows = table->rows,
+        .cols = table->cols,
+        .checkpoint_cols = table->checkpoint_cols,
+        .prefetch = table->prefetch,
+        .escaped_quotes = table->escaped_quotes,
+        .skip_headers = table->skip_headers,
+        .unquote = table->unquote,
+        .index_mode = table->index_mode,
+        .codec = table->codec,
+        .warnings = table->warnings,
+        .delimiter = table->delimiter,
+        .quotechar = table->quotechar,
+        .newline = table->newline,
+    };
+}
+
+
+void LazyCSV_TableStatsGet(LazyCSV_Table *table, LazyCSV_TableStats *stats) {
+    size_t anchors = 0, max_row_anchors = 0;
+
+    // anchors are only looked up through the newline index, which the
+    // compressed index doesn't have, its anchor file holds skip headers.
+    if (table->index_mode != LAZYCSV_INDEX_COMPRESSED) {
+        anchors = table->anchors->st.st_size / sizeof(LazyCSV_AnchorPoint);
+
+        LazyCSV_Row row;
+        size_t rows = table->rows + !table->skip_headers;
+        for (size_t i = 0; anchors && i < rows; i++) {
+            LazyCSV_RowFromIndex(table, i, &row);
+            if (row.count > max_row_anchors)
+                max_row_anchors = row.count;
+        }
+    }
+
+    *stats = (LazyCSV_TableStats){
+        .data_bytes = table->data->st.st_size,
+        .comma_bytes = table->commas->st.st_size,
+        .anchor_bytes = table->anchors->st.st_size,
+        .newline_bytes = table->newlines->st.st_size,
+        .checkpoint_bytes =
+            table->checkpoints ? table->checkpoints->st.st_size : 0,
+        .anchors = anchors,
+        .max_row_anchors = max_row_anchors,
+        .overflow_rows = table->overflow_rows,
+        .underflow_rows = table->underflow_rows,
+        .escaped_quotes = table->escaped_quotes,
+        .scan_seconds = table->scan_seconds,
+        .flush_seconds = table->flush_seconds,
+        .map_seconds = table->map_seconds,
+        .values_served = table->counters.values,
+        .bytes_served = table->counters.bytes,
+    };
+}
+
+
+static inline int LazyCSV_TableValue(LazyCSV_Table *table, LazyCSV_Span *span,
+                                     size_t offset, size_t len,
+                                     const char **data, size_t *size,
+                                     LazyCSV_Error *error) {
+
+    if (len == 0 || len == SIZE_MAX) {
+        *data = "";
+        *size = 0;
+        return 0;
+    }
+
+    char* addr = LazyCSV_DataAt(table, span, offset, len);
+    if (!addr) {
+        if (error)
+            *error = span->error;
+        return -1;
+    }
+
+    char strip_quotes = (
+        len > 1
+        && table->unquote
+        && addr[0] == table->quotechar
+        && addr[len-1] == table->quotechar
+    );
+
+    *data = strip_quotes ? addr + 1 : addr;
+    *size = strip_quotes ? len - 2 : len;
+    return 0;
+}
+
+
+int LazyCSV_TableHeader(LazyCSV_Table *table, size_t col, const char **data,
+                        size_t *len, LazyCSV_Error *error) {
+
+    if (table->skip_headers || col >= table->cols) {
+        if (error)
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_VALUE,
+                "provided value not in bounds of index"
+            };
+        return -1;
+    }
+
+    size_t offset, size;
+    LazyCSV_FieldFromIndex(table, 0, col, &offset, &size);
+
+    return LazyCSV_TableValue(table, &table->span, offset, size, data, len,
+                              error);
+}
+
+
+int LazyCSV_TableField(LazyCSV_Table *table, size_t row, size_t col,
+                       const char **data, size_t *len, LazyCSV_Error *error) {
+
+    if (row >= table->rows || col >= table->cols) {
+        if (error)
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_VALUE,
+                "provided value not in bounds of index"
+            };
+        return -1;
+    }
+
+    size_t offset, size;
+    LazyCSV_FieldFromIndex(table, row + !table->skip_headers, col, &offset,
+                           &size);
+    LAZYCSV_COUNT(&table->counters, size);
+
+    return LazyCSV_TableValue(table, &table->span, offset, size, data, len,
+                              error);
+}
+
+
+static int LazyCSV_KeyValue(LazyCSV_Table *table, LazyCSV_Span *span,
+                            size_t offset, size_t size, const char **data,
+                            size_t *len, LazyCSV_Buffer *scratch,
+                            LazyCSV_Error *error) {
+
+    // keys are compared unescaped, which only needs a copy in tables with
+    // escaped quotes.
+
+    if (LazyCSV_TableValue(table, span, offset, size, data, len, error) < 0)
+        return -1;
+
+    if (!table->escaped_quotes || !memchr(*data, table->quotechar, *len))
+        return 0;
+
+    if (*len > scratch->capacity) {
+        char* grown = realloc(scratch->data, *len);
+        if (!grown) {
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_MEMORY,
+                "unable to allocate memory for key"
+            };
+            return -1;
+        }
+        scratch->data = grown;
+        scratch->capacity = *len;
+    }
+
+    *len = LazyCSV_Unescape(scratch->data, *data, *len, table->quotechar);
+    *data = scratch->data;
+    return 0;
+}
+
+
+int LazyCSV_TableKeyIndex(LazyCSV_Table *table, size_t col,
+                          LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    if (col >= table->cols) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "provided value not in bounds of index"
+        };
+        return -1;
+    }
+
+    if (table->rows >= LAZYCSV_KEY_ROW_MASK) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "too many rows for a key index"
+        };
+        return -1;
+    }
+
+    if (table->keys && table->keys[col])
+        return 0;
+
+    if (!table->keys && !(table->keys = calloc(table->cols,
+                                                sizeof(LazyCSV_File*)))) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for key index"
+        };
+        return -1;
+    }
+
+    // the key index is written next to the other index files, and sized
+    // for a load factor of at most 2/3.
+
+    char* dir = strdup(table->commas->name);
+    char* sep = dir ? strrchr(dir, '/') : NULL;
+    if (sep)
+        *sep = '\0';
+    char* name = dir ? tempnam(sep ? dir : ".", "LzyK_") : NULL;
+    free(dir);
+
+    size_t slots = 16;
+    while (slots < table->rows + table->rows / 2)
+        slots <<= 1;
+    size_t size = sizeof(LazyCSV_KeyHeader) + slots*sizeof(uint64_t);
+
+    int fd = name ? open(name, O_RDWR|O_CREAT|O_EXCL, S_IRWXU) : -1;
+    char* data = fd != -1 && ftruncate(fd, size) == 0
+        ? mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+
+    if (fd != -1)
+        close(fd);
+
+    if (data == MAP_FAILED) {
+        if (fd != -1)
+            remove(name);
+        free(name);
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_RUNTIME,
+            "unable to create key index file"
+        };
+        return -1;
+    }
+
+    *(LazyCSV_KeyHeader*)data = (LazyCSV_KeyHeader){col, slots};
+    uint64_t* entries = (uint64_t*)(data + sizeof(LazyCSV_KeyHeader));
+
+    // the column is read through an iterator of its own, which isn't
+    // counted towards the values served by the table.
+
+    LazyCSV_TableIter iter = {
+        .table = table,
+        .row = SIZE_MAX,
+        .col = col,
+        .stop = table->rows,
+        .step = 1,
+    };
+    LazyCSV_IterColCache(&iter);
+    LazyCSV_Buffer scratch = {0};
+    const char* key;
+    size_t offset, len, keylen;
+    int failed = 0;
+
+    for (size_t row = 0; row < table->rows; row++) {
+        LazyCSV_IterCol(&iter, &offset, &len);
+        if (LazyCSV_KeyValue(table, &iter.span, offset, len, &key, &keylen,
+                             &scratch, error) < 0) {
+            failed = 1;
+            break;
+        }
+
+        uint64_t hash = LazyCSV_KeyHash(key, keylen);
+        size_t slot = hash & (slots - 1);
+        while (entries[slot])
+            slot = (slot + 1) & (slots - 1);
+        entries[slot] = (hash & ~LAZYCSV_KEY_ROW_MASK) | (row + 1);
+    }
+
+    LazyCSV_SpanFree(table, &iter.span);
+    free(iter.commas.values);
+    free(scratch.data);
+    munmap(data, size);
+
+    if (failed || LazyCSV_FileFromName(&table->keys[col], name,
+                                       MAP_PRIVATE) < 0) {
+        remove(name);
+        free(name);
+        if (!failed)
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_RUNTIME,
+                "unable to map key index file"
+            };
+        return -1;
+    }
+
+    LazyCSV_File* keys = table->keys[col];
+    madvise(keys->data, keys->st.st_size, MADV_RANDOM);
+    return 0;
+}
+
+
+int LazyCSV_TableLookup(LazyCSV_Table *table, size_t col, const char *key,
+                        size_t len, size_t *row, LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    if (col >= table->cols || !table->keys || !table->keys[col]) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "no key index has been built for the column"
+        };
+        return -1;
+    }
+
+    char* data = table->keys[col]->data;
+    size_t slots = ((LazyCSV_KeyHeader*)data)->slots;
+    uint64_t* entries = (uint64_t*)(data + sizeof(LazyCSV_KeyHeader));
+
+    uint64_t hash = LazyCSV_KeyHash(key, len);
+    uint64_t tag = hash & ~LAZYCSV_KEY_ROW_MASK;
+    LazyCSV_Buffer scratch = {0};
+    const char* value;
+    size_t offset, size, valuelen;
+    int found = 0;
+
+    for (size_t slot = hash & (slots - 1); entries[slot];
+         slot = (slot + 1) & (slots - 1)) {
+
+        if ((entries[slot] & ~LAZYCSV_KEY_ROW_MASK) != tag)
+            continue;
+
+        size_t candidate = (entries[slot] & LAZYCSV_KEY_ROW_MASK) - 1;
+        LazyCSV_FieldFromIndex(table, candidate + !table->skip_headers, col,
+                               &offset, &size);
+        if (LazyCSV_KeyValue(table, &table->span, offset, size, &value,
+                             &valuelen, &scratch, error) < 0) {
+            found = -1;
+            break;
+        }
+
+        if (valuelen == len && !memcmp(value, key, len)) {
+            *row = candidate;
+            found = 1;
+            break;
+        }
+    }
+
+    free(scratch.data);
+    return found;
+}
+
+
+// the column kernels below split the rows of a table into a range per
+// thread, of at least LAZYCSV_KERNEL_RANGE rows so that combining the
+// results of the ranges is worth it.
+
+#define LAZYCSV_KERNEL_RANGE 16384
+
+static size_t LazyCSV_KernelWorkers(size_t rows, size_t threads) {
+    size_t workers = threads ? threads : 1;
+    return workers > rows / LAZYCSV_KERNEL_RANGE + 1
+        ? rows / LAZYCSV_KERNEL_RANGE + 1
+        : workers;
+}
+
+
+static void LazyCSV_KernelRun(void* (*worker)(void*), void *ranges,
+                              size_t size, size_t workers) {
+
+    // the calling thread works through the first range, along with any
+    // range whose thread couldn't be started
+
+    pthread_t* pool = malloc(workers*sizeof(pthread_t));
+    size_t started = 1;
+    for (; pool && started < workers; started++) {
+        if (pthread_create(pool + started, NULL, worker,
+                           (char*)ranges + started*size))
+            break;
+    }
+    for (size_t i = 0; i < workers; i++) {
+        if (i == 0 || i >= started)
+            worker((char*)ranges + i*size);
+    }
+    for (size_t i = 1; pool && i < started; i++)
+        pthread_join(pool[i], NULL);
+    free(pool);
+}
+
+
+// argsort sorts an item per row, keyed by the first eight bytes of its value
+// read big endian, or by the bits of its value as a double flipped so that
+// they order as unsigned integers. Each thread keys and radix sorts a range
+// of rows, the ranges are merged, and in byte order runs of equal keys are
+// then sorted by their whole values. Every step is stable.
+
+typedef struct {
+    uint64_t key;
+    size_t row;
+} LazyCSV_SortItem;
+
+
+typedef struct {
+    LazyCSV_Table* table;
+    size_t col;
+    int numeric;
+    LazyCSV_SortItem* items;
+    LazyCSV_SortItem* spare;
+    size_t lo;
+    size_t hi;
+    int failed;
+    LazyCSV_Error error;
+} LazyCSV_SortRange;
+
+
+// the values of a run of equal keys, loaded once before the run is sorted
+
+typedef struct {
+    char* data;
+    size_t* offsets;
+} LazyCSV_SortValues;
+
+
+typedef int (*LazyCSV_SortCompare)(const LazyCSV_SortItem *a,
+                                   const LazyCSV_SortItem *b, void *context);
+
+
+// whether a value is a number other than nan, allowing surrounding spaces
+
+static int LazyCSV_ParseNumber(const char *data, size_t len, double *value) {
+    char buf[64], *end;
+    if (!len || len >= sizeof(buf))
+        return 0;
+
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+    *value = strtod(buf, &end);
+    while (end < buf + len && isspace((unsigned char)*end))
+        end++;
+
+    return end != buf && end == buf + len && *value == *value;
+}
+
+
+static uint64_t LazyCSV_SortKey(const char *data, size_t len, int numeric) {
+    uint64_t key = 0;
+    double value;
+
+    if (!numeric) {
+        for (size_t i = 0; i < sizeof(uint64_t) && i < len; i++)
+            key |= (uint64_t)(unsigned char)data[i] << (56 - 8*i);
+        return key;
+    }
+
+    // values which aren't numbers sort last
+    if (!LazyCSV_ParseNumber(data, len, &value))
+        return UINT64_MAX;
+
+    value = value == 0 ? 0 : value;
+    memcpy(&key, &value, sizeof(uint64_t));
+    return key >> 63 ? ~key : key | ((uint64_t)1 << 63);
+}
+
+
+static void LazyCSV_RadixSort(LazyCSV_SortItem *items,
+                              LazyCSV_SortItem *spare, size_t n) {
+
+    // counts for every byte are taken in a single pass, and bytes which are
+    // the same for every item are skipped, as the leading bytes of numbers
+    // and the trailing bytes of short values usually are.
+
+    size_t counts[8][256] = {{0}};
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < 8; b++)
+            counts[b][(items[i].key >> (8*b)) & 0xff]++;
+    }
+
+    LazyCSV_SortItem *src = items, *dst = spare;
+    for (size_t b = 0; b < 8; b++) {
+        if (counts[b][(items[0].key >> (8*b)) & 0xff] == n)
+            continue;
+
+        size_t total = 0;
+        for (size_t d = 0; d < 256; d++) {
+            size_t count = counts[b][d];
+            counts[b][d] = total;
+            total += count;
+        }
+        for (size_t i = 0; i < n; i++)
+            dst[counts[b][(src[i].key >> (8*b)) & 0xff]++] = src[i];
+
+        LazyCSV_SortItem* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != items)
+        memcpy(items, src, n*sizeof(LazyCSV_SortItem));
+}
+
+
+static void LazyCSV_SortMerge(const LazyCSV_SortItem *a, size_t na,
+                              const LazyCSV_SortItem *b, size_t nb,
+                              LazyCSV_SortItem *out, LazyCSV_SortCompare cmp,
+                              void *context) {
+    size_t i = 0, j = 0;
+    while (i < na && j < nb)
+        *out++ = cmp(b + j, a + i, context) < 0 ? b[j++] : a[i++];
+    memcpy(out, a + i, (na - i)*sizeof(LazyCSV_SortItem));
+    memcpy(out + (na - i), b + j, (nb - j)*sizeof(LazyCSV_SortItem));
+}
+
+
+static void LazyCSV_SortRuns(LazyCSV_SortItem *items, LazyCSV_SortItem *spare,
+                             size_t n, size_t width, LazyCSV_SortCompare cmp,
+                             void *context) {
+
+    // merges sorted runs of `width` items pairwise until one is left
+
+    LazyCSV_SortItem *src = items, *dst = spare;
+    for (; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2*width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2*width < n ? lo + 2*width : n;
+            LazyCSV_SortMerge(src + lo, mid - lo, src + mid, hi - mid,
+                              dst + lo, cmp, context);
+        }
+        LazyCSV_SortItem* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != items)
+        memcpy(items, src, n*sizeof(LazyCSV_SortItem));
+}
+
+
+static int LazyCSV_SortCompareKeys(const LazyCSV_SortItem *a,
+                                   const LazyCSV_SortItem *b, void *context) {
+    (void)context;
+    return (a->key > b->key) - (a->key < b->key);
+}
+
+
+static int LazyCSV_SortCompareValues(const LazyCSV_SortItem *a,
+                                     const LazyCSV_SortItem *b,
+                                     void *context) {
+
+    // within a run the key of an item is replaced by its position
+    LazyCSV_SortValues* values = (LazyCSV_SortValues*)context;
+    size_t* offsets = values->offsets;
+    size_t alen = offsets[a->key + 1] - offsets[a->key];
+    size_t blen = offsets[b->key + 1] - offsets[b->key];
+
+    size_t len = alen < blen ? alen : blen;
+    int result = len
+        ? memcmp(values->data + offsets[a->key],
+                 values->data + offsets[b->key], len)
+        : 0;
+    return result ? result : (alen > blen) - (alen < blen);
+}
+
+
+static void* LazyCSV_SortWorker(void *arg) {
+    LazyCSV_SortRange* range = (LazyCSV_SortRange*)arg;
+    LazyCSV_Table* table = range->table;
+
+    LazyCSV_TableIter iter = {
+        .table = table,
+        .row = SIZE_MAX,
+        .col = range->col,
+        .position = range->lo,
+        .stop = range->hi,
+        .step = 1,
+    };
+    LazyCSV_IterColCache(&iter);
+    LazyCSV_Buffer scratch = {0};
+    const char* value;
+    size_t offset, len, size;
+
+    for (size_t row = range->lo; row < range->hi; row++) {
+        LazyCSV_IterCol(&iter, &offset, &len);
+        if (LazyCSV_KeyValue(table, &iter.span, offset, len, &value, &size,
+                             &scratch, &range->error) < 0) {
+            range->failed = 1;
+            break;
+        }
+        range->items[row] = (LazyCSV_SortItem){
+            LazyCSV_SortKey(value, size, range->numeric), row
+        };
+    }
+
+    LazyCSV_SpanFree(table, &iter.span);
+    free(iter.commas.values);
+    free(scratch.data);
+
+    if (!range->failed)
+        LazyCSV_RadixSort(range->items + range->lo, range->spare + range->lo,
+                          range->hi - range->lo);
+    return NULL;
+}
+
+
+static int LazyCSV_SortTies(LazyCSV_Table *table, size_t col,
+                            LazyCSV_SortItem *items, LazyCSV_SortItem *spare,
+                            size_t n, LazyCSV_Error *error) {
+
+    LazyCSV_TableIter iter = {.table = table};
+    LazyCSV_Buffer data = {0}, scratch = {0};
+    LazyCSV_SortValues values = {0};
+    size_t capacity = 0;
+    const char* value;
+    size_t offset, len, size;
+    int failed = 0;
+
+    for (size_t lo = 0, hi; !failed && lo < n; lo = hi) {
+        for (hi = lo + 1; hi < n && items[hi].key == items[lo].key; hi++);
+        if (hi - lo == 1)
+            continue;
+
+        if (hi - lo + 1 > capacity) {
+            capacity = 2*(hi - lo + 1);
+            free(values.offsets);
+            if (!(values.offsets = malloc(capacity*sizeof(size_t)))) {
+                failed = 1;
+                break;
+            }
+        }
+
+        data.size = 0;
+        for (size_t i = lo; i < hi; i++) {
+            LazyCSV_FieldFromIndex(table, items[i].row + !table->skip_headers,
+                                   col, &offset, &len);
+            if (LazyCSV_KeyValue(table, &iter.span, offset, len, &value,
+                                 &size, &scratch, error) < 0) {
+                failed = -1;
+                break;
+            }
+            if (data.size + size > data.capacity) {
+                size_t grown = 2*(data.size + size);
+                char* _data = realloc(data.data, grown);
+                if (!_data) {
+                    failed = 1;
+                    break;
+                }
+                data.data = _data;
+                data.capacity = grown;
+            }
+            values.offsets[i - lo] = data.size;
+            if (size)
+                memcpy(data.data + data.size, value, size);
+            data.size += size;
+            items[i].key = i - lo;
+        }
+        values.offsets[hi - lo] = data.size;
+        values.data = data.data;
+
+        if (!failed)
+            LazyCSV_SortRuns(items + lo, spare + lo, hi - lo, 1,
+                             LazyCSV_SortCompareValues, &values);
+    }
+
+    if (failed > 0)
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for argsort"
+        };
+
+    LazyCSV_SpanFree(table, &iter.span);
+    free(iter.commas.values);
+    free(values.offsets);
+    free(data.data);
+    free(scratch.data);
+    return failed ? -1 : 0;
+}
+
+
+int LazyCSV_TableArgsort(LazyCSV_Table *table, size_t col, int numeric,
+                         size_t threads, size_t *order,
+                         LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    if (col >= table->cols) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "provided value not in bounds of index"
+        };
+        return -1;
+    }
+
+    size_t n = table->rows;
+    if (!n)
+        return 0;
+
+    size_t workers = LazyCSV_KernelWorkers(n, threads);
+    LazyCSV_SortItem* items = malloc(n*sizeof(LazyCSV_SortItem));
+    LazyCSV_SortItem* spare = malloc(n*sizeof(LazyCSV_SortItem));
+    LazyCSV_SortRange* ranges = calloc(workers, sizeof(LazyCSV_SortRange));
+
+    if (!items || !spare || !ranges) {
+        free(items);
+        free(spare);
+        free(ranges);
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for argsort"
+        };
+        return -1;
+    }
+
+    size_t width = (n + workers - 1) / workers;
+    for (size_t i = 0; i < workers; i++) {
+        ranges[i] = (LazyCSV_SortRange){
+            .table = table,
+            .col = col,
+            .numeric = numeric,
+            .items = items,
+            .spare = spare,
+            .lo = i*width < n ? i*width : n,
+            .hi = (i + 1)*width < n ? (i + 1)*width : n,
+        };
+    }
+
+    LazyCSV_KernelRun(LazyCSV_SortWorker, ranges, sizeof(LazyCSV_SortRange),
+                      workers);
+
+    int failed = 0;
+    for (size_t i = 0; !failed && i < workers; i++) {
+        if (ranges[i].failed) {
+            *error = ranges[i].error;
+            failed = 1;
+        }
+    }
+
+    if (!failed) {
+        LazyCSV_SortRuns(items, spare, n, width, LazyCSV_SortCompareKeys,
+                         NULL);
+        if (!numeric)
+            failed = LazyCSV_SortTies(table, col, items, spare, n, error);
+    }
+
+    if (!failed) {
+        for (size_t i = 0; i < n; i++)
+            order[i] = items[i].row;
+    }
+
+    free(items);
+    free(spare);
+    free(ranges);
+    return failed ? -1 : 0;
+}
+
+
+// groups are collected by each thread for a range of rows into a hash table
+// of their own, probed linearly, whose slots hold a group's index plus one.
+// Groups are kept in order of their first row, so the tables of later
+// ranges are merged into the first one in turn.
+
+typedef struct {
+    LazyCSV_Group* groups;
+    uint64_t* hashes;
+    size_t* offsets;
+    size_t count;
+    size_t capacity;
+    size_t* slots;
+    size_t mask;
+    LazyCSV_Buffer keys;
+} LazyCSV_GroupTable;
+
+
+typedef struct {
+    LazyCSV_Table* table;
+    size_t key_col;
+    size_t value_col;
+    size_t lo;
+    size_t hi;
+    LazyCSV_GroupTable groups;
+    int failed;
+    LazyCSV_Error error;
+} LazyCSV_GroupRange;
+
+
+static void LazyCSV_GroupTableFree(LazyCSV_GroupTable *groups) {
+    free(groups->groups);
+    free(groups->hashes);
+    free(groups->offsets);
+    free(groups->slots);
+    free(groups->keys.data);
+}
+
+
+static int LazyCSV_GroupTableGrow(LazyCSV_GroupTable *groups) {
+    size_t size = groups->slots ? 2*(groups->mask + 1) : 64;
+    size_t* slots = calloc(size, sizeof(size_t));
+    if (!slots)
+        return -1;
+
+    for (size_t i = 0; i < groups->count; i++) {
+        size_t slot = groups->hashes[i] & (size - 1);
+        while (slots[slot])
+            slot = (slot + 1) & (size - 1);
+        slots[slot] = i + 1;
+    }
+
+    free(groups->slots);
+    groups->slots = slots;
+    groups->mask = size - 1;
+    return 0;
+}
+
+
+static LazyCSV_Group* LazyCSV_GroupFind(LazyCSV_GroupTable *groups,
+                                        const char *key, size_t len,
+                                        uint64_t hash) {
+
+    // returns the group of a key, adding it if it's new, or NULL if there
+    // is no memory for it.
+
+    if ((!groups->slots || 3*(groups->count + 1) > 2*(groups->mask + 1))
+        && LazyCSV_GroupTableGrow(groups) < 0)
+        return NULL;
+
+    size_t slot = hash & groups->mask;
+    for (; groups->slots[slot]; slot = (slot + 1) & groups->mask) {
+        size_t i = groups->slots[slot] - 1;
+        if (groups->hashes[i] == hash && groups->groups[i].len == len
+            && (!len || !memcmp(groups->keys.data + groups->offsets[i], key,
+                                len)))
+            return groups->groups + i;
+    }
+
+    if (groups->count == groups->capacity) {
+        size_t capacity = groups->capacity ? 2*groups->capacity : 64;
+        LazyCSV_Group* _groups =
+            realloc(groups->groups, capacity*sizeof(LazyCSV_Group));
+        if (_groups)
+            groups->groups = _groups;
+        uint64_t* hashes =
+            realloc(groups->hashes, capacity*sizeof(uint64_t));
+        if (hashes)
+            groups->hashes = hashes;
+        size_t* offsets = realloc(groups->offsets, capacity*sizeof(size_t));
+        if (offsets)
+            groups->offsets = offsets;
+        if (!_groups || !hashes || !offsets)
+            return NULL;
+        groups->capacity = capacity;
+    }
+
+    LazyCSV_Buffer* keys = &groups->keys;
+    if (keys->size + len > keys->capacity) {
+        size_t capacity = 2*(keys->size + len);
+        char* data = realloc(keys->data, capacity);
+        if (!data)
+            return NULL;
+        keys->data = data;
+        keys->capacity = capacity;
+    }
+
+    size_t i = groups->count++;
+    if (len)
+        memcpy(keys->data + keys->size, key, len);
+    groups->offsets[i] = keys->size;
+    groups->hashes[i] = hash;
+    keys->size += len;
+
+    groups->slots[slot] = i + 1;
+    groups->groups[i] = (LazyCSV_Group){
+        .len = len,
+        .min = INFINITY,
+        .max = -INFINITY,
+    };
+    return groups->groups + i;
+}
+
+
+static void* LazyCSV_GroupWorker(void *arg) {
+    LazyCSV_GroupRange* range = (LazyCSV_GroupRange*)arg;
+    LazyCSV_Table* table = range->table;
+
+    LazyCSV_TableIter keys = {
+        .table = table,
+        .row = SIZE_MAX,
+        .col = range->key_col,
+        .position = range->lo,
+        .stop = range->hi,
+        .step = 1,
+    };
+    LazyCSV_TableIter values = keys;
+    values.col = range->value_col;
+    LazyCSV_IterColCache(&keys);
+    LazyCSV_IterColCache(&values);
+
+    LazyCSV_Buffer scratch = {0};
+    const char *key, *value;
+    size_t offset, len, size;
+    double number;
+
+    for (size_t row = range->lo; row < range->hi; row++) {
+        LazyCSV_IterCol(&keys, &offset, &len);
+        if (LazyCSV_KeyValue(table, &keys.span, offset, len, &key, &size,
+                             &scratch, &range->error) < 0) {
+            range->failed = 1;
+            break;
+        }
+
+        LazyCSV_Group* group = LazyCSV_GroupFind(
+            &range->groups, key, size, LazyCSV_KeyHash(key, size));
+        if (!group) {
+            range->error = (LazyCSV_Error){
+                LAZYCSV_ERROR_MEMORY,
+                "unable to allocate memory for groups"
+            };
+            range->failed = 1;
+            break;
+        }
+        group->rows += 1;
+
+        if (range->value_col == SIZE_MAX)
+            continue;
+
+        LazyCSV_IterCol(&values, &offset, &len);
+        if (LazyCSV_TableValue(table, &values.span, offset, len, &value,
+                               &size, &range->error) < 0) {
+            range->failed = 1;
+            break;
+        }
+
+        if (LazyCSV_ParseNumber(value, size, &number)) {
+            group->count += 1;
+            group->sum += number;
+            group->min = number < group->min ? number : group->min;
+            group->max = number > group->max ? number : group->max;
+        }
+    }
+
+    LazyCSV_SpanFree(table, &keys.span);
+    LazyCSV_SpanFree(table, &values.span);
+    free(keys.commas.values);
+    free(values.commas.values);
+    free(scratch.data);
+    return NULL;
+}
+
+
+static int LazyCSV_GroupMerge(LazyCSV_GroupTable *into,
+                              LazyCSV_GroupTable *from) {
+
+    for (size_t i = 0; i < from->count; i++) {
+        LazyCSV_Group* source = from->groups + i;
+        LazyCSV_Group* group = LazyCSV_GroupFind(
+            into, from->keys.data + from->offsets[i], source->len,
+            from->hashes[i]);
+        if (!group)
+            return -1;
+
+        group->rows += source->rows;
+        group->count += source->count;
+        group->sum += source->sum;
+        group->min = source->min < group->min ? source->min : group->min;
+        group->max = source->max > group->max ? source->max : group->max;
+    }
+    return 0;
+}
+
+
+int LazyCSV_TableGroupBy(LazyCSV_Table *table, size_t key_col,
+                         size_t value_col, size_t threads,
+                         LazyCSV_Groups *groups, LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    *groups = (LazyCSV_Groups){0};
+
+    if (key_col >= table->cols
+        || (value_col != SIZE_MAX && value_col >= table->cols)) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "provided value not in bounds of index"
+        };
+        return -1;
+    }
+
+    size_t n = table->rows;
+    size_t workers = LazyCSV_KernelWorkers(n, threads);
+    LazyCSV_GroupRange* ranges = calloc(workers, sizeof(LazyCSV_GroupRange));
+
+    if (!ranges) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for groups"
+        };
+        return -1;
+    }
+
+    size_t width = (n + workers - 1) / workers;
+    for (size_t i = 0; i < workers; i++) {
+        ranges[i].table = table;
+        ranges[i].key_col = key_col;
+        ranges[i].value_col = value_col;
+        ranges[i].lo = i*width < n ? i*width : n;
+        ranges[i].hi = (i + 1)*width < n ? (i + 1)*width : n;
+    }
+
+    LazyCSV_KernelRun(LazyCSV_GroupWorker, ranges,
+                      sizeof(LazyCSV_GroupRange), workers);
+
+    int failed = 0;
+    for (size_t i = 0; i < workers; i++) {
+        if (!failed && ranges[i].failed) {
+            *error = ranges[i].error;
+            failed = 1;
+        }
+        if (!failed && i
+            && LazyCSV_GroupMerge(&ranges[0].groups, &ranges[i].groups) < 0) {
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_MEMORY,
+                "unable to allocate memory for groups"
+            };
+            failed = 1;
+        }
+        if (i)
+            LazyCSV_GroupTableFree(&ranges[i].groups);
+    }
+
+    LazyCSV_GroupTable* merged = &ranges[0].groups;
+    if (!failed) {
+        for (size_t i = 0; i < merged->count; i++) {
+            merged->groups[i].key = merged->keys.data
+                ? merged->keys.data + merged->offsets[i]
+                : "";
+        }
+        *groups = (LazyCSV_Groups){
+            .groups = merged->groups,
+            .count = merged->count,
+            .keys = merged->keys.data,
+        };
+        merged->groups = NULL;
+        merged->keys.data = NULL;
+    }
+
+    LazyCSV_GroupTableFree(merged);
+    free(ranges);
+    return failed ? -1 : 0;
+}
+
+
+void LazyCSV_GroupsFree(LazyCSV_Groups *groups) {
+    free(groups->groups);
+    free(groups->keys);
+    *groups = (LazyCSV_Groups){0};
+}
+
+
+// each thread reduces a range of rows into a LazyCSV_Reduction of its own,
+// with a histogram of its own, which are then added together.
+
+typedef struct {
+    LazyCSV_Table* table;
+    size_t col;
+    size_t lo;
+    size_t hi;
+    LazyCSV_Reduction reduction;
+    int failed;
+    LazyCSV_Error error;
+} LazyCSV_ReduceRange;
+
+
+static void* LazyCSV_ReduceWorker(void *arg) {
+    LazyCSV_ReduceRange* range = (LazyCSV_ReduceRange*)arg;
+    LazyCSV_Reduction* reduction = &range->reduction;
+    LazyCSV_Table* table = range->table;
+
+    LazyCSV_TableIter iter = {
+        .table = table,
+        .row = SIZE_MAX,
+        .col = range->col,
+        .position = range->lo,
+        .stop = range->hi,
+        .step = 1,
+    };
+    LazyCSV_IterColCache(&iter);
+    const double* numbers = LazyCSV_IterColNumbers(&iter);
+    const char* value;
+    size_t offset, len, size;
+    double number;
+
+    size_t bins = reduction->bins;
+    double lo = reduction->lo, hi = reduction->hi;
+    double scale = hi > lo ? bins / (hi - lo) : 0;
+
+    for (size_t row = range->lo; row < range->hi; row++) {
+        // a typed column cache holds nan where a value isn't a number
+        if (numbers) {
+            number = numbers[row];
+        }
+        else {
+            LazyCSV_IterCol(&iter, &offset, &len);
+            if (LazyCSV_TableValue(table, &iter.span, offset, len, &value,
+                                   &size, &range->error) < 0) {
+                range->failed = 1;
+                break;
+            }
+            if (!LazyCSV_ParseNumber(value, size, &number))
+                number = NAN;
+        }
+
+        if (number != number) {
+            reduction->nulls += 1;
+            continue;
+        }
+
+        reduction->count += 1;
+        reduction->sum += number;
+        reduction->min = number < reduction->min ? number : reduction->min;
+        reduction->max = number > reduction->max ? number : reduction->max;
+
+        if (!isfinite(number))
+            continue;
+
+        reduction->finite_min = number < reduction->finite_min
+            ? number
+            : reduction->finite_min;
+        reduction->finite_max = number > reduction->finite_max
+            ? number
+            : reduction->finite_max;
+
+        // as with numpy, the last bin includes the upper edge
+        if (bins && number >= lo && number <= hi) {
+            size_t bin = (size_t)((number - lo) * scale);
+            reduction->histogram[bin < bins ? bin : bins - 1] += 1;
+        }
+    }
+
+    LazyCSV_SpanFree(table, &iter.span);
+    free(iter.commas.values);
+    return NULL;
+}
+
+
+int LazyCSV_TableReduce(LazyCSV_Table *table, size_t col, size_t start,
+                        size_t stop, size_t threads,
+                        LazyCSV_Reduction *reduction, LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    if (col >= table->cols) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "provided value not in bounds of index"
+        };
+        return -1;
+    }
+
+    stop = stop < table->rows ? stop : table->rows;
+    start = start < stop ? start : stop;
+
+    size_t bins = reduction->histogram ? reduction->bins : 0;
+    size_t workers = LazyCSV_KernelWorkers(stop - start, threads);
+    LazyCSV_ReduceRange* ranges = calloc(workers, sizeof(LazyCSV_ReduceRange));
+    size_t* histograms = calloc(workers*bins + 1, sizeof(size_t));
+
+    if (!ranges || !histograms) {
+        free(ranges);
+        free(histograms);
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for reduce"
+        };
+        return -1;
+    }
+
+    size_t width = (stop - start + workers - 1) / workers;
+    for (size_t i = 0; i < workers; i++) {
+        size_t lo = start + i*width, hi = lo + width;
+        ranges[i].table = table;
+        ranges[i].col = col;
+        ranges[i].lo = lo < stop ? lo : stop;
+        ranges[i].hi = hi < stop ? hi : stop;
+        ranges[i].reduction = (LazyCSV_Reduction){
+            .min = INFINITY,
+            .max = -INFINITY,
+            .finite_min = INFINITY,
+            .finite_max = -INFINITY,
+            .bins = bins,
+            .lo = reduction->lo,
+            .hi = reduction->hi,
+            .histogram = histograms + i*bins,
+        };
+    }
+
+    LazyCSV_KernelRun(LazyCSV_ReduceWorker, ranges,
+                      sizeof(LazyCSV_ReduceRange), workers);
+
+    int failed = 0;
+    reduction->count = 0;
+    reduction->nulls = 0;
+    reduction->sum = 0;
+    reduction->min = INFINITY;
+    reduction->max = -INFINITY;
+    reduction->finite_min = INFINITY;
+    reduction->finite_max = -INFINITY;
+    for (size_t b = 0; b < bins; b++)
+        reduction->histogram[b] = 0;
+
+    for (size_t i = 0; i < workers; i++) {
+        LazyCSV_Reduction* part = &ranges[i].reduction;
+        if (!failed && ranges[i].failed) {
+            *error = ranges[i].error;
+            failed = 1;
+        }
+        reduction->count += part->count;
+        reduction->nulls += part->nulls;
+        reduction->sum += part->sum;
+        reduction->min = part->min < reduction->min
+            ? part->min
+            : reduction->min;
+        reduction->max = part->max > reduction->max
+            ? part->max
+            : reduction->max;
+        reduction->finite_min = part->finite_min < reduction->finite_min
+            ? part->finite_min
+            : reduction->finite_min;
+        reduction->finite_max = part->finite_max > reduction->finite_max
+            ? part->finite_max
+            : reduction->finite_max;
+        for (size_t b = 0; b < bins; b++)
+            reduction->histogram[b] += part->histogram[b];
+    }
+
+    free(ranges);
+    free(histograms);
+    return failed ? -1 : 0;
+}
+
+
+// the bytes of each row are hashed from the start of its first field to the
+// end of its last, and its key as the unescaped value of the key column, by
+// a thread per range of rows. Either is skipped when its array is NULL.
+
+typedef struct {
+    LazyCSV_Table* table;
+    size_t key_col;
+    size_t lo;
+    size_t hi;
+    uint64_t* rows;
+    uint64_t* keys;
+    int failed;
+    LazyCSV_Error error;
+} LazyCSV_HashRange;
+
+
+static int LazyCSV_RowHash(LazyCSV_TableIter *fields, size_t row,
+                           uint64_t *hash, LazyCSV_Error *error) {
+
+    LazyCSV_Table* table = fields->table;
+    size_t start, offset, len;
+
+    LazyCSV_IterField(fields, row, 0, &start, &len);
+
+    // a row short of fields ends with its last field that was read
+    size_t col = table->cols - 1;
+    LazyCSV_IterField(fields, row, col, &offset, &len);
+    while (len == SIZE_MAX && col > 0)
+        LazyCSV_IterField(fields, row, --col, &offset, &len);
+    size_t stop = len == SIZE_MAX ? start : offset + len;
+    stop = stop > start ? stop : start;
+
+    const char* data = stop > start
+        ? LazyCSV_DataAt(table, &fields->span, start, stop - start)
+        : "";
+    if (!data) {
+        *error = fields->span.error;
+        return -1;
+    }
+
+    *hash = LazyCSV_KeyHash(data, stop - start);
+    return 0;
+}
+
+
+static void* LazyCSV_HashWorker(void *arg) {
+    LazyCSV_HashRange* range = (LazyCSV_HashRange*)arg;
+    LazyCSV_Table* table = range->table;
+
+    LazyCSV_TableIter fields = {
+        .table = table,
+        .row = SIZE_MAX,
+        .col = SIZE_MAX,
+        .step = 1,
+    };
+    LazyCSV_TableIter keys = {
+        .table = table,
+        .row = SIZE_MAX,
+        .col = range->key_col,
+        .position = range->lo,
+        .stop = range->hi,
+        .step = 1,
+    };
+    if (range->keys)
+        LazyCSV_IterColCache(&keys);
+
+    LazyCSV_Buffer scratch = {0};
+    const char* key;
+    size_t skip = !table->skip_headers, offset, len, size;
+
+    for (size_t row = range->lo; row < range->hi; row++) {
+        if (range->rows
+            && LazyCSV_RowHash(&fields, row + skip, range->rows + row,
+                               &range->error) < 0) {
+            range->failed = 1;
+            break;
+        }
+
+        if (!range->keys)
+            continue;
+
+        LazyCSV_IterCol(&keys, &offset, &len);
+        if (LazyCSV_KeyValue(table, &keys.span, offset, len, &key, &size,
+                             &scratch, &range->error) < 0) {
+            range->failed = 1;
+            break;
+        }
+        range->keys[row] = LazyCSV_KeyHash(key, size);
+    }
+
+    LazyCSV_SpanFree(table, &fields.span);
+    LazyCSV_SpanFree(table, &keys.span);
+    free(fields.commas.values);
+    free(keys.commas.values);
+    free(scratch.data);
+    return NULL;
+}
+
+
+static int LazyCSV_HashRows(LazyCSV_Table *table, size_t key_col,
+                            size_t threads, uint64_t *rows, uint64_t *keys,
+                            LazyCSV_Error *error) {
+
+    size_t n = table->rows;
+    size_t workers = LazyCSV_KernelWorkers(n, threads);
+    LazyCSV_HashRange* ranges = calloc(workers, sizeof(LazyCSV_HashRange));
+
+    if (!ranges) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for row hashes"
+        };
+        return -1;
+    }
+
+    size_t width = (n + workers - 1) / workers;
+    for (size_t i = 0; i < workers; i++) {
+        ranges[i].table = table;
+        ranges[i].key_col = key_col;
+        ranges[i].lo = i*width < n ? i*width : n;
+        ranges[i].hi = (i + 1)*width < n ? (i + 1)*width : n;
+        ranges[i].rows = rows;
+        ranges[i].keys = keys;
+    }
+
+    LazyCSV_KernelRun(LazyCSV_HashWorker, ranges, sizeof(LazyCSV_HashRange),
+                      workers);
+
+    int failed = 0;
+    for (size_t i = 0; !failed && i < workers; i++) {
+        if (ranges[i].failed) {
+            *error = ranges[i].error;
+            failed = 1;
+        }
+    }
+
+    free(ranges);
+    return failed ? -1 : 0;
+}
+
+
+// the old rows sharing a key hash are chained in order through `next`, from
+// the slot's `head`, which moves along as they are paired. An empty slot has
+// a head of SIZE_MAX, a slot whose rows were all paired one of old_rows.
+
+typedef struct {
+    uint64_t hash;
+    size_t head;
+} LazyCSV_DiffSlot;
+
+
+static int LazyCSV_DiffKeys(LazyCSV_Diff *diff, const uint64_t *old_rows,
+                            const uint64_t *old_keys, size_t nold,
+                            const uint64_t *new_rows,
+                            const uint64_t *new_keys, size_t nnew) {
+
+    size_t slots = 16;
+    while (slots < 2*nold)
+        slots *= 2;
+
+    LazyCSV_DiffSlot* table = malloc(slots*sizeof(LazyCSV_DiffSlot));
+    size_t* next = malloc((nold + 1)*sizeof(size_t));
+    char* paired = calloc(nold + 1, 1);
+
+    if (!table || !next || !paired) {
+        free(table);
+        free(next);
+        free(paired);
+        return -1;
+    }
+
+    for (size_t s = 0; s < slots; s++)
+        table[s] = (LazyCSV_DiffSlot){0, SIZE_MAX};
+
+    // inserted last to first, so that each chain runs in row order
+    for (size_t i = nold; i-- > 0;) {
+        size_t slot = old_keys[i] & (slots - 1);
+        while (table[slot].head != SIZE_MAX && table[slot].hash != old_keys[i])
+            slot = (slot + 1) & (slots - 1);
+        next[i] = table[slot].head == SIZE_MAX ? nold : table[slot].head;
+        table[slot] = (LazyCSV_DiffSlot){old_keys[i], i};
+    }
+
+    for (size_t j = 0; j < nnew; j++) {
+        size_t slot = new_keys[j] & (slots - 1);
+        while (table[slot].head != SIZE_MAX && table[slot].hash != new_keys[j])
+            slot = (slot + 1) & (slots - 1);
+
+        size_t i = table[slot].head;
+        if (i == SIZE_MAX || i == nold) {
+            diff->added[diff->nadded++] = j;
+            continue;
+        }
+
+        table[slot].head = next[i];
+        paired[i] = 1;
+        if (old_rows[i] != new_rows[j])
+            diff->changed[diff->nchanged++] = j;
+    }
+
+    for (size_t i = 0; i < nold; i++) {
+        if (!paired[i])
+            diff->removed[diff->nremoved++] = i;
+    }
+
+    free(table);
+    free(next);
+    free(paired);
+    return 0;
+}
+
+
+// diff hashes the rows of both tables, which are then paired by position, or
+// by key through a table of the old keys. Rows are compared by their hashes
+// alone.
+
+int LazyCSV_TableDiff(LazyCSV_Table *old, LazyCSV_Table *updated,
+                      size_t key_col, size_t threads, LazyCSV_Diff *diff,
+                      LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    *diff = (LazyCSV_Diff){0};
+
+    if (key_col != SIZE_MAX
+        && (key_col >= old->cols || key_col >= updated->cols)) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "provided value not in bounds of index"
+        };
+        return -1;
+    }
+
+    size_t nold = old->rows, nnew = updated->rows;
+    int keyed = key_col != SIZE_MAX;
+
+    uint64_t* old_rows = malloc((nold + 1)*sizeof(uint64_t));
+    uint64_t* new_rows = malloc((nnew + 1)*sizeof(uint64_t));
+    uint64_t* old_keys = keyed ? malloc((nold + 1)*sizeof(uint64_t)) : NULL;
+    uint64_t* new_keys = keyed ? malloc((nnew + 1)*sizeof(uint64_t)) : NULL;
+
+    diff->added = malloc((nnew + 1)*sizeof(size_t));
+    diff->removed = malloc((nold + 1)*sizeof(size_t));
+    diff->changed = malloc((nnew + 1)*sizeof(size_t));
+
+    int failed = 0;
+    if (!old_rows || !new_rows || (keyed && (!old_keys || !new_keys))
+        || !diff->added || !diff->removed || !diff->changed) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for diff"
+        };
+        failed = 1;
+    }
+
+    failed = failed
+        || LazyCSV_HashRows(old, key_col, threads, old_rows, old_keys,
+                            error) < 0
+        || LazyCSV_HashRows(updated, key_col, threads, new_rows, new_keys,
+                            error) < 0;
+
+    if (!failed && keyed
+        && LazyCSV_DiffKeys(diff, old_rows, old_keys, nold, new_rows,
+                            new_keys, nnew) < 0) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for diff"
+        };
+        failed = 1;
+    }
+
+    // without a key, rows are paired by their position
+    for (size_t j = 0; !failed && !keyed && j < nnew; j++) {
+        if (j >= nold)
+            diff->added[diff->nadded++] = j;
+        else if (old_rows[j] != new_rows[j])
+            diff->changed[diff->nchanged++] = j;
+    }
+    for (size_t i = nnew; !failed && !keyed && i < nold; i++)
+        diff->removed[diff->nremoved++] = i;
+
+    free(old_rows);
+    free(new_rows);
+    free(old_keys);
+    free(new_keys);
+
+    if (failed)
+        LazyCSV_DiffFree(diff);
+    return failed ? -1 : 0;
+}
+
+
+void LazyCSV_DiffFree(LazyCSV_Diff *diff) {
+    free(diff->added);
+    free(diff->removed);
+    free(diff->changed);
+    *diff = (LazyCSV_Diff){0};
+}
+
+
+// rows are sampled with splitmix64, which is seeded directly and draws
+// bounded numbers by rejection so that every row is equally likely.
+
+static inline uint64_t LazyCSV_Random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+static inline uint64_t LazyCSV_RandomBelow(uint64_t *state, uint64_t bound) {
+    uint64_t threshold = -bound % bound, value;
+    do {
+        value = LazyCSV_Random(state);
+    } while (value < threshold);
+    return value % bound;
+}
+
+
+static int LazyCSV_CompareRows(const void *a, const void *b) {
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// draws n of rows with Floyd's algorithm, remembering the rows drawn in an
+// open addressing set, and sorts them.
+
+static int LazyCSV_SampleUniform(size_t rows, size_t n, uint64_t *state,
+                                 size_t *sample) {
+
+    size_t slots = 16;
+    while (slots < 2*n)
+        slots *= 2;
+
+    size_t* set = calloc(slots, sizeof(size_t));
+    if (!set)
+        return -1;
+
+    for (size_t j = rows - n, i = 0; j < rows; j++, i++) {
+        size_t row = LazyCSV_RandomBelow(state, j + 1);
+        size_t slot = LazyCSV_KeyHash((char*)&row, sizeof(row)) & (slots - 1);
+        while (set[slot] && set[slot] != row + 1)
+            slot = (slot + 1) & (slots - 1);
+
+        // a row drawn before is replaced by j, which can't have been
+        if (set[slot]) {
+            row = j;
+            slot = LazyCSV_KeyHash((char*)&row, sizeof(row)) & (slots - 1);
+            while (set[slot])
+                slot = (slot + 1) & (slots - 1);
+        }
+        set[slot] = row + 1;
+        sample[i] = row;
+    }
+
+    free(set);
+    qsort(sample, n, sizeof(size_t), LazyCSV_CompareRows);
+    return 0;
+}
+
+
+// a stratum is the rows sharing a hash of their value of the stratify column,
+// which gets a share of the sample in proportion to its rows, the rows left
+// over going to the strata with the largest remainders. Rows are then selected in
+// a single pass, each with the chance that the rest of its stratum's share
+// is drawn from the rest of its rows.
+
+typedef struct {
+    size_t rows;
+    size_t share;
+    size_t remainder;
+    size_t index;
+} LazyCSV_Stratum;
+
+
+static int LazyCSV_CompareRemainders(const void *a, const void *b) {
+    const LazyCSV_Stratum* x = *(const LazyCSV_Stratum* const*)a;
+    const LazyCSV_Stratum* y = *(const LazyCSV_Stratum* const*)b;
+    if (x->remainder != y->remainder)
+        return x->remainder < y->remainder ? 1 : -1;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+
+static int LazyCSV_SampleStrata(uint64_t *keys, size_t rows, size_t n,
+                                uint64_t *state, size_t *sample,
+                                size_t *count) {
+
+    size_t slots = 1024, count_strata = 0, capacity = 0;
+    uint64_t* hashes = malloc(slots*sizeof(uint64_t));
+    size_t* table = calloc(slots, sizeof(size_t));
+    LazyCSV_Stratum* strata = NULL;
+    LazyCSV_Stratum** order = NULL;
+    int failed = !hashes || !table;
+
+    // each key hash is replaced by the index of its stratum, the table of
+    // strata doubling whenever it is half full
+    for (size_t i = 0; !failed && i < rows; i++) {
+        size_t slot = keys[i] & (slots - 1);
+        while (table[slot] && hashes[slot] != keys[i])
+            slot = (slot + 1) & (slots - 1);
+
+        if (!table[slot]) {
+            if (count_strata == capacity) {
+                capacity = capacity ? 2*capacity : 64;
+                LazyCSV_Stratum* _strata =
+                    realloc(strata, capacity*sizeof(LazyCSV_Stratum));
+                if (!_strata) {
+                    failed = 1;
+                    break;
+                }
+                strata = _strata;
+            }
+            strata[count_strata] = (LazyCSV_Stratum){.index = count_strata};
+            hashes[slot] = keys[i];
+            table[slot] = ++count_strata;
+
+            if (2*count_strata > slots) {
+                size_t _slots = 2*slots;
+                uint64_t* _hashes = malloc(_slots*sizeof(uint64_t));
+                size_t* _table = calloc(_slots, sizeof(size_t));
+                if (!_hashes || !_table) {
+                    free(_hashes);
+                    free(_table);
+                    failed = 1;
+                    break;
+                }
+                for (size_t s = 0; s < slots; s++) {
+                    if (!table[s])
+                        continue;
+                    size_t _slot = hashes[s] & (_slots - 1);
+                    while (_table[_slot])
+                        _slot = (_slot + 1) & (_slots - 1);
+                    _hashes[_slot] = hashes[s];
+                    _table[_slot] = table[s];
+                }
+                free(hashes);
+                free(table);
+                hashes = _hashes;
+                table = _table;
+                slots = _slots;
+                slot = keys[i] & (slots - 1);
+                while (hashes[slot] != keys[i] || !table[slot])
+                    slot = (slot + 1) & (slots - 1);
+            }
+        }
+
+        keys[i] = table[slot] - 1;
+        strata[keys[i]].rows += 1;
+    }
+
+    free(hashes);
+    free(table);
+
+    order = failed ? NULL : malloc((count_strata + 1)*sizeof(void*));
+    if (failed || !order) {
+        free(strata);
+        return -1;
+    }
+
+    // shares are exact unless n times the rows of a stratum overflows, in
+    // tables of billions of rows
+    size_t shared = 0;
+    for (size_t s = 0; s < count_strata; s++) {
+        LazyCSV_Stratum* stratum = strata + s;
+        if (stratum->rows <= UINT64_MAX / n) {
+            stratum->share = (uint64_t)n * stratum->rows / rows;
+            stratum->remainder = (uint64_t)n * stratum->rows % rows;
+        }
+        else {
+            long double exact = (long double)n * stratum->rows / rows;
+            stratum->share = (size_t)exact;
+            stratum->remainder = (size_t)((exact - stratum->share) * rows);
+        }
+        shared += stratum->share;
+        order[s] = stratum;
+    }
+
+    qsort(order, count_strata, sizeof(void*), LazyCSV_CompareRemainders);
+    for (size_t s = 0; shared < n && s < count_strata; s++, shared++)
+        order[s]->share += 1;
+
+    *count = 0;
+    for (size_t i = 0; i < rows && *count < n; i++) {
+        LazyCSV_Stratum* stratum = strata + keys[i];
+        if (stratum->share
+            && LazyCSV_RandomBelow(state, stratum->rows) < stratum->share) {
+            sample[(*count)++] = i;
+            stratum->share -= 1;
+        }
+        stratum->rows -= 1;
+    }
+
+    free(strata);
+    free(order);
+    return 0;
+}
+
+
+int LazyCSV_TableSample(LazyCSV_Table *table, size_t n, uint64_t seed,
+                        size_t stratify_col, size_t threads, size_t *rows,
+                        size_t *count, LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    if (stratify_col != SIZE_MAX && stratify_col >= table->cols) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "provided value not in bounds of index"
+        };
+        return -1;
+    }
+
+    // a sample of every row, or of none, is drawn without a generator
+    size_t total = table->rows;
+    if (!n || n >= total) {
+        *count = n ? total : 0;
+        for (size_t i = 0; i < *count; i++)
+            rows[i] = i;
+        return 0;
+    }
+
+    uint64_t state = seed;
+    *count = n;
+
+    if (stratify_col == SIZE_MAX) {
+        if (LazyCSV_SampleUniform(total, n, &state, rows) < 0)
+            goto memory_err;
+        return 0;
+    }
+
+    uint64_t* keys = malloc((total + 1)*sizeof(uint64_t));
+    if (!keys)
+        goto memory_err;
+
+    if (LazyCSV_HashRows(table, stratify_col, threads, NULL, keys,
+                         error) < 0) {
+        free(keys);
+        return -1;
+    }
+
+    int failed = LazyCSV_SampleStrata(keys, total, n, &state, rows, count);
+    free(keys);
+    if (failed < 0)
+        goto memory_err;
+    return 0;
+
+memory_err:
+    *error = (LazyCSV_Error){
+        LAZYCSV_ERROR_MEMORY,
+        "unable to allocate memory for sample"
+    };
+    return -1;
+}
+
+
+// rows are written through an array of iovecs, pointing into the data where
+// it is mapped, or at copies of fields read from a window of decompressed
+// data, which is only valid until the next read. Adjacent ranges are merged,
+// so that consecutive columns of a row are written as a single range.
+
+#define LAZYCSV_WRITE_IOVS 1024
+#define LAZYCSV_WRITE_COPIES (1 << 16)
+
+// runs of whole rows at least this long are copied by the kernel
+#define LAZYCSV_WRITE_RANGE (1 << 16)
+
+typedef struct {
+    int fd;
+    int source;
+    size_t count;
+    size_t copied;
+    struct iovec iovs[LAZYCSV_WRITE_IOVS];
+    char copies[LAZYCSV_WRITE_COPIES];
+} LazyCSV_Output;
+
+
+static int LazyCSV_OutputFlush(LazyCSV_Output *out) {
+    struct iovec* iovs = out->iovs;
+    size_t count = out->count;
+
+    while (count) {
+        ssize_t written = writev(out->fd, iovs, count);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            return -1;
+
+        for (; count && (size_t)written >= iovs->iov_len; iovs++, count--)
+            written -= iovs->iov_len;
+        if (count) {
+            iovs->iov_base = (char*)iovs->iov_base + written;
+            iovs->iov_len -= written;
+        }
+    }
+
+    out->count = 0;
+    out->copied = 0;
+    return 0;
+}
+
+
+static int LazyCSV_OutputAdd(LazyCSV_Output *out, const char *data,
+                             size_t len, int copy) {
+    if (!len)
+        return 0;
+
+    // flushing reuses the copies, so any flush happens before copying
+    if ((out->count == LAZYCSV_WRITE_IOVS
+         || (copy && out->copied + len > LAZYCSV_WRITE_COPIES))
+        && LazyCSV_OutputFlush(out) < 0)
+        return -1;
+
+    if (copy && len <= LAZYCSV_WRITE_COPIES) {
+        data = memcpy(out->copies + out->copied, data, len);
+        out->copied += len;
+        copy = 0;
+    }
+
+    struct iovec* last = out->count ? out->iovs + out->count - 1 : NULL;
+    if (last && (char*)last->iov_base + last->iov_len == data)
+        last->iov_len += len;
+    else
+        out->iovs[out->count++] = (struct iovec){(void*)data, len};
+
+    // fields too long to be copied are written before the window moves
+    return copy ? LazyCSV_OutputFlush(out) : 0;
+}
+
+
+// copies `len` bytes of the data at `offset` file to file, which fails
+// where the kernel can't, after which the mapped data is written instead.
+
+static int LazyCSV_OutputRange(LazyCSV_Output *out, LazyCSV_Table *table,
+                               size_t offset, size_t len) {
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    if (out->source != -1 && len >= LAZYCSV_WRITE_RANGE) {
+        if (LazyCSV_OutputFlush(out) < 0)
+            return -1;
+
+        int64_t position = offset;
+        while (len) {
+            ssize_t copied = syscall(SYS_copy_file_range, out->source,
+                                     &position, out->fd, NULL, len, 0);
+            if (copied < 0 && errno == EINTR)
+                continue;
+            if (copied <= 0)
+                break;
+            len -= copied;
+        }
+
+        if (!len)
+            return 0;
+        close(out->source);
+        out->source = -1;
+        offset = position;
+    }
+#endif
+
+    return LazyCSV_OutputAdd(out, table->data->data + offset, len, 0);
+}
+
+
+int LazyCSV_TableWrite(LazyCSV_Table *table, int fd, const size_t *rows,
+                       size_t nrows, const size_t *cols, size_t ncols,
+                       int header, LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    size_t count = rows ? nrows : table->rows;
+    size_t width = cols ? ncols : table->cols;
+
+    int bounded = 1;
+    for (size_t i = 0; rows && i < count; i++)
+        bounded &= rows[i] < table->rows;
+    for (size_t j = 0; cols && j < width; j++)
+        bounded &= cols[j] < table->cols;
+
+    struct stat st;
+    int same = !fstat(fd, &st) && st.st_dev == table->data->st.st_dev
+        && st.st_ino == table->data->st.st_ino;
+
+    if (!bounded || same) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            same
+                ? "unable to write a table over its own file"
+                : "provided value not in bounds of index"
+        };
+        return -1;
+    }
+
+    LazyCSV_Output* out = malloc(sizeof(LazyCSV_Output));
+    if (!out) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_MEMORY,
+            "unable to allocate memory for write"
+        };
+        return -1;
+    }
+    out->fd = fd;
+    out->source = -1;
+    out->count = 0;
+    out->copied = 0;
+
+    // rows are written with the line endings and delimiter of the table,
+    // which are taken from the data when it has them where expected.
+
+    const char* newline = table->newline == CARRIAGE_RETURN ? "\r"
+        : table->newline == CARRIAGE_RETURN + LINE_FEED ? "\r\n"
+        : "\n";
+    size_t newline_len = strlen(newline);
+    char delimiter[1] = {table->delimiter};
+
+    // as with python's csv module, an empty row of a single column is
+    // written as a pair of quotes, so that it isn't read as a blank line
+    char quotes[2] = {table->quotechar, table->quotechar};
+
+    // without any fields that were truncated or filled, a whole row is the
+    // range between the start of its first field and the end of its last.
+
+    int whole = !table->codec && !table->warnings && width == table->cols;
+    for (size_t j = 0; whole && cols && j < width; j++)
+        whole = cols[j] == j;
+
+#if defined(__linux__) && defined(SYS_copy_file_range)
+    if (whole && (out->source = open(table->data->name, O_RDONLY)) != -1) {
+        if (fstat(out->source, &st) < 0
+            || st.st_dev != table->data->st.st_dev
+            || st.st_ino != table->data->st.st_ino) {
+            close(out->source);
+            out->source = -1;
+        }
+    }
+#endif
+
+    LazyCSV_TableIter iter = {
+        .table = table,
+        .row = SIZE_MAX,
+        .col = SIZE_MAX,
+        .step = 1,
+    };
+
+    header = header && !table->skip_headers;
+    size_t skip = !table->skip_headers, total = header + count;
+    char* data = table->data->data;
+    size_t end = table->data->st.st_size;
+    int failed = 0;
+
+    for (size_t i = 0; !failed && i < total; i++) {
+        size_t row = header && !i
+            ? 0
+            : (rows ? rows[i - header] : i - header) + skip;
+
+        size_t offset, len;
+
+        if (whole) {
+            // extends the range over the following rows for as long as
+            // they come in order
+            size_t last = row, start, next;
+            LazyCSV_IterField(&iter, row, 0, &start, &len);
+            while (i + 1 < total) {
+                next = (rows ? rows[i + 1 - header] : i + 1 - header) + skip;
+                if (next != last + 1)
+                    break;
+                last = next;
+                i++;
+            }
+            LazyCSV_IterField(&iter, last, width - 1, &offset, &len);
+            size_t stop = offset + (len == SIZE_MAX ? 0 : len);
+
+            int ended = stop + newline_len <= end
+                && !memcmp(data + stop, newline, newline_len);
+            stop += ended ? newline_len : 0;
+
+            failed = LazyCSV_OutputRange(out, table, start, stop - start) < 0
+                || (!ended && LazyCSV_OutputAdd(out, newline, newline_len,
+                                                0) < 0);
+            continue;
+        }
+
+        for (size_t j = 0; !failed && j < width; j++) {
+            LazyCSV_IterField(&iter, row, cols ? cols[j] : j, &offset, &len);
+            len = len == SIZE_MAX ? 0 : len;
+
+            const char* field = len
+                ? LazyCSV_DataAt(table, &iter.span, offset, len)
+                : quotes;
+            if (!field) {
+                LazyCSV_SpanFree(table, &iter.span);
+                free(iter.commas.values);
+                free(out);
+                *error = iter.span.error;
+                return -1;
+            }
+
+            // the delimiter following a field in the data is written along
+            // with it, rather than from a separate buffer
+            const char* after = delimiter;
+            if (!table->codec && offset + len < end
+                && data[offset + len] == table->delimiter)
+                after = data + offset + len;
+
+            len = len || width > 1 ? len : sizeof(quotes);
+
+            failed = LazyCSV_OutputAdd(out, field, len, table->codec) < 0
+                || LazyCSV_OutputAdd(out, j + 1 < width ? after : newline,
+                                     j + 1 < width ? 1 : newline_len,
+                                     table->codec && j + 1 < width) < 0;
+        }
+    }
+
+    failed = failed || LazyCSV_OutputFlush(out) < 0;
+
+    if (out->source != -1)
+        close(out->source);
+    LazyCSV_SpanFree(table, &iter.span);
+    free(iter.commas.values);
+    free(out);
+
+    if (failed) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_RUNTIME,
+            "unable to write to output file"
+        };
+        return -1;
+    }
+    return 0;
+}
+
+
+int LazyCSV_TableCacheColumn(LazyCSV_Table *table, size_t col, int numeric,
+                             LazyCSV_Error *error) {
+
+    LazyCSV_Error ignored;
+    if (!error)
+        error = &ignored;
+
+    if (col >= table->cols) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "provided value not in bounds of index"
+        };
+        return -1;
+    }
+
+    // iterators may be reading a cache, so it is never replaced. Caches
+    // are only added by one thread at a time, but are published with
+    // release stores, as iterators and kernels without the GIL read them.
+    if (table->columns && table->columns[col])
+        return 0;
+
+    // a cache is only built from the data the index was built from
+    struct stat* st = &table->data->st, current;
+    if (stat(table->data->name, &current) < 0
+        || current.st_size != st->st_size || current.st_mtime != st->st_mtime
+        || current.st_ino != st->st_ino || current.st_dev != st->st_dev) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_VALUE,
+            "the file has changed since it was indexed"
+        };
+        return -1;
+    }
+
+    if (!table->columns) {
+        LazyCSV_File** columns = calloc(table->cols, sizeof(LazyCSV_File*));
+        if (!columns) {
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_MEMORY,
+                "unable to allocate memory for column cache"
+            };
+            return -1;
+        }
+        __atomic_store_n(&table->columns, columns, __ATOMIC_RELEASE);
+    }
+
+    // the cache is written next to the other index files. The offsets and
+    // numbers are filled in through a mapping of the start of the file, the
+    // values are written after them as they are read.
+
+    char* dir = strdup(table->commas->name);
+    char* sep = dir ? strrchr(dir, '/') : NULL;
+    if (sep)
+        *sep = '\0';
+    char* name = dir ? tempnam(sep ? dir : ".", "LzyV_") : NULL;
+    free(dir);
+
+    size_t rows = table->rows;
+    size_t size = sizeof(LazyCSV_ColumnHeader)
+        + (rows + 1 + (numeric ? rows : 0))*sizeof(uint64_t);
+
+    LazyCSV_Output* out = malloc(sizeof(LazyCSV_Output));
+    int fd = name && out ? open(name, O_RDWR|O_CREAT|O_EXCL, S_IRWXU) : -1;
+    char* data = fd != -1 && ftruncate(fd, size) == 0
+        && lseek(fd, size, SEEK_SET) == (off_t)size
+        ? mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)
+        : MAP_FAILED;
+
+    if (data == MAP_FAILED) {
+        if (fd != -1) {
+            close(fd);
+            remove(name);
+        }
+        free(name);
+        free(out);
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_RUNTIME,
+            "unable to create column cache file"
+        };
+        return -1;
+    }
+
+    *(LazyCSV_ColumnHeader*)data = (LazyCSV_ColumnHeader){
+        .col = col,
+        .rows = rows,
+        .typed = !!numeric,
+    };
+    uint64_t* offsets = (uint64_t*)(data + sizeof(LazyCSV_ColumnHeader));
+    double* numbers = (double*)(offsets + rows + 1);
+
+    *out = (LazyCSV_Output){.fd = fd, .source = -1};
+
+    // the column is read through the index, even if it is already cached
+    LazyCSV_TableIter iter = {
+        .table = table,
+        .row = SIZE_MAX,
+        .col = col,
+        .stop = rows,
+        .step = 1,
+    };
+    const char* value;
+    size_t offset, len, size_, total = 0;
+    int failed = 0;
+
+    for (size_t row = 0; !failed && row < rows; row++) {
+        LazyCSV_IterCol(&iter, &offset, &len);
+        len = len == SIZE_MAX ? 0 : len;
+
+        const char* field = len
+            ? LazyCSV_DataAt(table, &iter.span, offset, len)
+            : "";
+        if (!field) {
+            *error = iter.span.error;
+            failed = 1;
+            break;
+        }
+
+        if (numeric && (LazyCSV_TableValue(table, &iter.span, offset, len,
+                                           &value, &size_, NULL) < 0
+                        || !LazyCSV_ParseNumber(value, size_, numbers + row)))
+            numbers[row] = NAN;
+
+        offsets[row] = total;
+        total += len;
+        if (LazyCSV_OutputAdd(out, field, len, table->codec) < 0) {
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_RUNTIME,
+                "unable to write column cache file"
+            };
+            failed = 1;
+        }
+    }
+    offsets[rows] = total;
+
+    if (!failed && LazyCSV_OutputFlush(out) < 0) {
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_RUNTIME,
+            "unable to write column cache file"
+        };
+        failed = 1;
+    }
+
+    LazyCSV_SpanFree(table, &iter.span);
+    free(iter.commas.values);
+    free(out);
+    munmap(data, size);
+    close(fd);
+
+    LazyCSV_File* column = NULL;
+    if (failed || LazyCSV_FileFromName(&column, name, MAP_PRIVATE) < 0) {
+        remove(name);
+        free(name);
+        if (!failed)
+            *error = (LazyCSV_Error){
+                LAZYCSV_ERROR_RUNTIME,
+                "unable to map column cache file"
+            };
+        return -1;
+    }
+
+    if (column->st.st_size != (off_t)(size + total)) {
+        LazyCSV_FileFree(column);
+        *error = (LazyCSV_Error){
+            LAZYCSV_ERROR_RUNTIME,
+            "unable to write column cache file"
+        };
+        return -1;
+    }
+
+    madvise(column->data, column->st.st_size, MADV_SEQUENTIAL);
+    __atomic_store_n(&table->columns[col], column, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+int LazyCSV_TableIterNumbers(LazyCSV_TableIter *iter, double *numbers,
+                             size_t size, LazyCSV_Error *error) {
+
+    LazyCSV_Table* table = iter->table;
+
+    // the numbers of a typed column cache are read as they are
+    const double* cached = LazyCSV_IterColNumbers(iter);
+    if (cached) {
+        for (size_t i = 0; i < size && iter->position < iter->stop; i++) {
+            size_t index = LazyCSV_IterColRow(iter, iter->position)
+                - !table->skip_headers;
+            numbers[i] = cached[index];
+            iter->position += iter->step;
+        }
+        return 0;
+    }
+
+    const char* value;
+    size_t offset, len, length;
+
+    for (size_t i = 0; i < size; i++) {
+        offset = SIZE_MAX;
+        if (iter->col == SIZE_MAX)
+            LazyCSV_IterRow(iter, &offset, &len);
+        else
+            LazyCSV_IterCol(iter, &offset, &len);
+        if (offset == SIZE_MAX)
+            break;
+
+        if (LazyCSV_TableValue(table, &iter->span, offset, len, &value,
+                               &length, error) < 0)
+            return -1;
+        if (!LazyCSV_ParseNumber(value, length, numbers + i))
+            numbers[i] = NAN;
+    }
+    return 0;
+}
+
+
+// dates and times are parsed into their fields, which are then counted from
+// the epoch. `offset` is the seconds east of UTC of a time zone.
+
+typedef struct {
+    int64_t year;
+    int64_t month;
+    int64_t day;
+    int64_t hour;
+    int64_t minute;
+    int64_t second;
+    int64_t nanos;
+    int64_t offset;
+} LazyCSV_Time;
+
+
+static int LazyCSV_Digits(const char **data, const char *end, int min,
+                          int max, int64_t *value) {
+    int count = 0;
+    for (*value = 0; *data < end && count < max
+                     && isdigit((unsigned char)**data); count++, (*data)++)
+        *value = *value*10 + (**data - '0');
+    return count >= min;
+}
+
+
+static int LazyCSV_Char(const char **data, const char *end, char c) {
+    if (*data == end || **data != c)
+        return 0;
+    (*data)++;
+    return 1;
+}
+
+
+static int LazyCSV_Fraction(const char **data, const char *end,
+                            int64_t *nanos) {
+    int64_t scale = 1000000000;
+    const char* start = *data;
+    for (*nanos = 0; *data < end && isdigit((unsigned char)**data); (*data)++)
+        if (*data - start < 9)
+            *nanos += (**data - '0') * (scale /= 10);
+    return *data > start;
+}
+
+
+// a Z, or a +/- offset of hours, optionally followed by minutes
+static int LazyCSV_Offset(const char **data, const char *end,
+                          int64_t *offset) {
+    int64_t hours, minutes = 0;
+    if (LazyCSV_Char(data, end, 'Z')) {
+        *offset = 0;
+        return 1;
+    }
+
+    int sign = LazyCSV_Char(data, end, '-') ? -1 : 0;
+    if (!sign && !LazyCSV_Char(data, end, '+'))
+        return 0;
+    if (!LazyCSV_Digits(data, end, 2, 2, &hours))
+        return 0;
+    int colon = LazyCSV_Char(data, end, ':');
+    if ((colon || (*data < end && isdigit((unsigned char)**data)))
+        && !LazyCSV_Digits(data, end, 2, 2, &minutes))
+        return 0;
+
+    *offset = (sign ? -1 : 1) * (hours*3600 + minutes*60);
+    return hours < 24 && minutes < 60;
+}
+
+
+// YYYY-MM-DD, optionally followed by a T or a space and hh:mm, with optional
+// seconds, fraction and time zone.
+
+static int LazyCSV_ParseISO(const char *data, const char *end,
+                            LazyCSV_Time *time) {
+
+    if (!LazyCSV_Digits(&data, end, 4, 4, &time->year)
+        || !LazyCSV_Char(&data, end, '-')
+        || !LazyCSV_Digits(&data, end, 2, 2, &time->month)
+        || !LazyCSV_Char(&data, end, '-')
+        || !LazyCSV_Digits(&data, end, 2, 2, &time->day))
+        return 0;
+    if (data == end)
+        return 1;
+
+    if (!(LazyCSV_Char(&data, end, 'T') || LazyCSV_Char(&data, end, ' '))
+        || !LazyCSV_Digits(&data, end, 2, 2, &time->hour)
+        || !LazyCSV_Char(&data, end, ':')
+        || !LazyCSV_Digits(&data, end, 2, 2, &time->minute))
+        return 0;
+
+    if (LazyCSV_Char(&data, end, ':')) {
+        if (!LazyCSV_Digits(&data, end, 2, 2, &time->second))
+            return 0;
+        if ((LazyCSV_Char(&data, end, '.') || LazyCSV_Char(&data, end, ','))
+            && !LazyCSV_Fraction(&data, end, &time->nanos))
+            return 0;
+    }
+
+    return data == end || (LazyCSV_Offset(&data, end, &time->offset)
+                           && data == end);
+}
+
+
+static const char* LAZYCSV_MONTHS = "janfebmaraprmayjunjulaugsepoctnovdec";
+
+
+// a subset of strptime, %Y %m %d %H %M %S %f %z %y %b and %%, any other
+// character of the format has to match itself.
+
+static int LazyCSV_ParseFormat(const char *data, const char *end,
+                               const char *format, LazyCSV_Time *time) {
+
+    for (; *format; format++) {
+        if (*format != '%') {
+            if (!LazyCSV_Char(&data, end, *format))
+                return 0;
+            continue;
+        }
+
+        int ok = 0;
+        switch (*++format) {
+        case 'Y':
+            ok = LazyCSV_Digits(&data, end, 4, 4, &time->year);
+            break;
+        case 'y':
+            // as with strptime, 69 through 99 are in the 1900s
+            ok = LazyCSV_Digits(&data, end, 2, 2, &time->year);
+            time->year += time->year < 69 ? 2000 : 1900;
+            break;
+        case 'm':
+            ok = LazyCSV_Digits(&data, end, 1, 2, &time->month);
+            break;
+        case 'd':
+            ok = LazyCSV_Digits(&data, end, 1, 2, &time->day);
+            break;
+        case 'H':
+            ok = LazyCSV_Digits(&data, end, 1, 2, &time->hour);
+            break;
+        case 'M':
+            ok = LazyCSV_Digits(&data, end, 1, 2, &time->minute);
+            break;
+        case 'S':
+            ok = LazyCSV_Digits(&data, end, 1, 2, &time->second);
+            break;
+        case 'f':
+            ok = LazyCSV_Fraction(&data, end, &time->nanos);
+            break;
+        case 'z':
+            ok = LazyCSV_Offset(&data, end, &time->offset);
+            break;
+        case 'b':
+            for (int i = 0; !ok && end - data >= 3 && i < 12; i++) {
+                ok = tolower((unsigned char)data[0]) == LAZYCSV_MONTHS[3*i]
+                    && tolower((unsigned char)data[1]) == LAZYCSV_MONTHS[3*i+1]
+                    && tolower((unsigned char)data[2]) == LAZYCSV_MONTHS[3*i+2];
+                time->month = i + 1;
+            }
+            data += ok ? 3 : 0;
+            break;
+        case '%':
+            ok = LazyCSV_Char(&data, end, '%');
+            break;
+        }
+        if (!ok)
+            return 0;
+    }
+    return data == end;
+}
+
+
+static int LazyCSV_ParseTime(const char *data, size_t len,
+                             const char *format, int64_t per_second,
+                             int64_t *result) {
+
+    LazyCSV_Time time = {.year = 1970, .month = 1, .day = 1};
+    if (!(format
+          ? LazyCSV_ParseFormat(data, data + len, format, &time)
+          : LazyCSV_ParseISO(data, data + len, &time)))
+        return 0;
+
+    static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int64_t y = time.year, m = time.month;
+    int leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+
+    if (m < 1 || m > 12 || time.day < 1
+        || time.day > days[m - 1] + (m == 2 && leap)
+        || time.hour > 23 || time.minute > 59 || time.second > 59)
+        return 0;
+
+    // days from the epoch of a proleptic gregorian date, counting years
+    // from march so that leap days fall at the end of a year
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era*400;
+    int64_t doy = (153*(m + (m > 2 ? -3 : 9)) + 2)/5 + time.day - 1;
+    int64_t doe = yoe*365 + yoe/4 - yoe/100 + doy;
+    int64_t epoch_days = era*146097 + doe - 719468;
+
+    int64_t seconds = epoch_days*86400 + time.hour*3600 + time.minute*60
+        + time.second - time.offset;
+    *result = seconds*per_second + time.nanos / (1000000000 / per_second);
+    return 1;
+}
+
+
+int LazyCSV_TableIterTimes(LazyCSV_TableIter *iter, int64_t *times,
+                           size_t size, int64_t per_second,
+                           const char *format, LazyCSV_Error *error) {
+
+    LazyCSV_Table* table = iter->table;
+    const char* value;
+    size_t offset, len, length;
+
+    for (size_t i = 0; i < size; i++) {
+        offset = SIZE_MAX;
+        if (iter->col == SIZE_MAX)
+            LazyCSV_IterRow(iter, &offset, &len);
+        else
+            LazyCSV_IterCol(iter, &offset, &len);
+        if (offset == SIZE_MAX)
+            break;
+
+        if (LazyCSV_TableValue(table, &iter->span, offset, len, &value,
+                               &length, error) < 0)
+            return -1;
+
+        if (!length) {
+            times[i] = LAZYCSV_NAT;
+        }
+        else if (!LazyCSV_ParseTime(value, length, format, per_second,
+                                    times + i)) {
+            if (error)
+                *error = (LazyCSV_Error){
+                    LAZYCSV_ERROR_VALUE,
+                    format
+                        ? "unable to parse a value with the given format"
+                        : "unable to parse a value as an ISO 8601 date"
+                };
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static LazyCSV_TableIter* LazyCSV_TableIterNew(LazyCSV_Table *table,
+                                               size_t row, size_t col,
+                                               size_t stop) {
+
+    LazyCSV_TableIter* iter = calloc(1, sizeof(LazyCSV_TableIter));
+    if (!iter)
+        return NULL;
+
+    iter->table = table;
+    iter->row = row;
+    iter->col = col;
+    iter->position = 0;
+    iter->stop = stop;
+    iter->step = 1;
+    iter->prefetch = table->prefetch;
+    LazyCSV_IterColCache(iter);
+
+    LAZYCSV_PROBE3(iter__new, row, col, stop);
+    return iter;
+}
+
+
+LazyCSV_TableIter* LazyCSV_TableCol(LazyCSV_Table *table, size_t col) {
+    if (col >= table->cols)
+        return NULL;
+    return LazyCSV_TableIterNew(table, SIZE_MAX, col, table->rows);
+}
+
+
+LazyCSV_TableIter* LazyCSV_TableRow(LazyCSV_Table *table, size_t row) {
+    if (row >= table->rows)
+        return NULL;
+    return LazyCSV_TableIterNew(table, row, SIZE_MAX, table->cols);
+}
+
+
+int LazyCSV_TableIterNext(LazyCSV_TableIter *iter, const char **data,
+                          size_t *len, LazyCSV_Error *error) {
+
+    size_t offset = SIZE_MAX, size;
+
+    if (iter->col == SIZE_MAX)
+        LazyCSV_IterRow(iter, &offset, &size);
+    else
+        LazyCSV_IterCol(iter, &offset, &size);
+
+    if (offset == SIZE_MAX)
+        return 0;
+
+    if (LazyCSV_TableValue(iter->table, &iter->span, offset, size, data, len,
+                           error) < 0)
+        return -1;
+    return 1;
+}
+
+
+size_t LazyCSV_Unescape(char *dest, const char *data, size_t len,
+                        char quotechar) {
+
+    // copies up to and including each quote, skipping the one after it
+    size_t size = 0;
+    const char* end = data + len;
+    while (data < end) {
+        const char* quote = memchr(data, quotechar, end - data);
+        size_t run = quote ? (size_t)(quote - data) + 1 : (size_t)(end - data);
+        memmove(dest + size, data, run);
+        size += run;
+        data += run;
+        if (quote && data < end && *data == quotechar)
+            data += 1;
+    }
+    return size;
+}
+
+
+void LazyCSV_TableIterCounters(const LazyCSV_TableIter *iter, size_t *values,
+                               size_t *bytes) {
+    *values = iter->counters.values;
+    *bytes = iter->counters.bytes;
+}
+
+
+void LazyCSV_TableIterFree(LazyCSV_TableIter *iter) {
+    if (!iter)
+        return;
+    iter->table->counters.values += iter->counters.values;
+    iter->table->counters.bytes += iter->counters.bytes;
+    LazyCSV_SpanFree(iter->table, &iter->span);
+    free(iter->commas.values);
+    free(iter);
+}
@@ -0,0 +1,1106 @@
+#ifndef LAZYCSV_CORE_H
+#define LAZYCSV_CORE_H
+
+// internals of the lazycsv library shared with the Python extension. The
+// index pass lives in core.c, while field lookups and iterators are inlined
+// here, as they are called for every value read.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+
+#include "lazycsv.h"
+
+#define LINE_FEED 10
+#define CARRIAGE_RETURN 13
+
+// users can set this macro using the env variable LAZYCSV_INDEX_DTYPE if you
+// want to be more aggressive with minimizing index disk usage (i.e. define
+// INDEX_DTYPE as uint8_t) but at a cost to performance.
+
+#ifndef INDEX_DTYPE
+#define INDEX_DTYPE uint16_t
+#endif
+
+// optionally support indexing gzip and zstd compressed files in place, set
+// explicitly using env variables LAZYCSV_INCLUDE_ZLIB=1 and
+// LAZYCSV_INCLUDE_ZSTD=1, which link against zlib and libzstd respectively.
+
+#ifndef INCLUDE_ZLIB
+#define INCLUDE_ZLIB 0
+#endif
+#if INCLUDE_ZLIB
+#include <zlib.h>
+#endif
+#ifndef INCLUDE_ZSTD
+#define INCLUDE_ZSTD 0
+#endif
+#if INCLUDE_ZSTD
+#include <zstd.h>
+#endif
+
+// optionally count the values and bytes served by iterators and lookups, set
+// explicitly using env variable LAZYCSV_INCLUDE_COUNTERS=1, otherwise the
+// counters are never touched.
+
+#ifndef INCLUDE_COUNTERS
+#define INCLUDE_COUNTERS 0
+#endif
+
+#if INCLUDE_COUNTERS
+#define LAZYCSV_COUNT(counters, len) do { \
+        (counters)->values += 1; \
+        (counters)->bytes += (len) == SIZE_MAX ? 0 : (len); \
+    } while (0)
+#else
+#define LAZYCSV_COUNT(counters, len) do {} while (0)
+#endif
+
+// optionally build in USDT probes for perf and bpftrace under the lazycsv
+// provider, set explicitly using env variable LAZYCSV_INCLUDE_PROBES=1, which
+// requires sys/sdt.h (systemtap-sdt-dev). Disabled probes cost a nop.
+
+#ifndef INCLUDE_PROBES
+#define INCLUDE_PROBES 0
+#endif
+
+#if INCLUDE_PROBES
+#include <sys/sdt.h>
+#define LAZYCSV_PROBE1(name, a) DTRACE_PROBE1(lazycsv, name, a)
+#define LAZYCSV_PROBE2(name, a, b) DTRACE_PROBE2(lazycsv, name, a, b)
+#define LAZYCSV_PROBE3(name, a, b, c) DTRACE_PROBE3(lazycsv, name, a, b, c)
+#else
+#define LAZYCSV_PROBE1(name, a) do {} while (0)
+#define LAZYCSV_PROBE2(name, a, b) do {} while (0)
+#define LAZYCSV_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#define LAZYCSV_CODEC_NONE 0
+#define LAZYCSV_CODEC_GZIP 1
+#define LAZYCSV_CODEC_ZSTD 2
+
+// compressed files are indexed along with a checkpoint roughly every span of
+// uncompressed bytes from which decompression can be restarted, and fields
+// are read from a span sized window of decompressed data around them.
+
+#define LAZYCSV_SPAN 1048576 // 2**20
+#define LAZYCSV_WINDOW 32768 // 2**15
+
+
+// madvise() requires page aligned addresses, the page size is looked up once
+// when the first table is indexed.
+
+extern size_t LAZYCSV_PAGESIZE;
+
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} LazyCSV_Buffer;
+
+
+typedef struct {
+    size_t col;
+    size_t value;
+} LazyCSV_AnchorPoint;
+
+
+// the newline index is a sequence of blocks, each a LazyCSV_RowBlock holding
+// the absolute start offset and anchor index of its first row, followed by
+// a LazyCSV_RowEntry per row holding both relative to the block. A row's
+// anchors run up to the first anchor of the next row, so a sentinel entry
+// follows the last row. Rows implicitly start with an anchor at their start
+// offset, anchors are only stored when a comma offset overflows INDEX_DTYPE,
+// or when the row starts too far into its block for a 32 bit offset, in which
+// case the entry offset is UINT32_MAX and the row start is its first anchor.
+
+#define LAZYCSV_ROW_BLOCK 64
+#define LAZYCSV_ROW_SPILL UINT32_MAX
+
+typedef struct {
+    uint64_t offset;
+    uint64_t anchor;
+} LazyCSV_RowBlock;
+
+
+typedef struct {
+    uint32_t offset;
+    uint32_t anchor;
+} LazyCSV_RowEntry;
+
+
+// a row resolved from the newline index
+
+typedef struct {
+    size_t start;
+    size_t count;
+    LazyCSV_AnchorPoint* anchors;
+} LazyCSV_Row;
+
+
+// with index_mode="compressed" the comma index stores every comma as its
+// absolute offset, delta encoded from the previous comma and bit-packed
+// LAZYCSV_COMMA_BLOCK at a time at the width of the largest delta of the
+// block. A LazyCSV_CommaBlock skip header per block holds the offset
+// preceding the block, the word offset of its deltas and their bit width, so
+// a comma is found by decoding a prefix of a single block. The skip headers
+// are written to the anchor file, absolute offsets need no anchor points, and
+// no newline index is written as the first comma of a row is its start.
+
+#define LAZYCSV_COMMA_BLOCK 128
+
+typedef struct {
+    uint64_t base;
+    uint64_t packed; // word offset << 8 | bit width
+} LazyCSV_CommaBlock;
+
+
+// with index_mode="rows" only the newline index is written, along with the
+// start of every `every`th column of each row as a uint32_t offset from the
+// row start in the comma file. Fields are found when they are read by
+// scanning forward from the nearest checkpoint. Each row has exactly cols+1
+// commas, so each has cols/every checkpoints. Those of an underflowing row
+// point past the row end, and offsets which don't fit are stored as
+// LAZYCSV_CHECKPOINT_NONE, in which case an earlier checkpoint is used.
+
+#define LAZYCSV_CHECKPOINT_NONE UINT32_MAX
+
+
+// state of the comma index during the index pass for the compressed and rows
+// modes. `count` commas of the block, or of the row, have been seen so far,
+// `base` is the offset preceding the block, or the row start.
+
+typedef struct {
+    int mode;
+    size_t every;
+    size_t values[LAZYCSV_COMMA_BLOCK];
+    size_t count;
+    size_t base;
+    size_t words;
+} LazyCSV_CommaWriter;
+
+
+// the decoded prefix of a block, kept by iterators which mostly read
+// neighbouring commas
+
+typedef struct {
+    size_t block;
+    size_t count;
+    size_t* values;
+} LazyCSV_CommaCache;
+
+
+// the start of the last field read by an iterator in rows mode, from which
+// the next field of the row can be scanned. A zeroed cursor is empty.
+
+typedef struct {
+    size_t row;
+    size_t col;
+    size_t offset;
+} LazyCSV_RowCursor;
+
+
+typedef struct {
+    size_t values;
+    size_t bytes;
+} LazyCSV_Counters;
+
+
+// a key index of a column is a LazyCSV_KeyHeader followed by `slots` entries
+// of an open addressing hash table, probed linearly from the slot of a
+// value's hash. An entry holds its row plus one in the low bits and the top
+// bits of the hash in the rest, an empty slot is 0. Rows are inserted in
+// order, so the first match along a probe is the first row holding a value.
+
+#define LAZYCSV_KEY_ROW_BITS 40
+#define LAZYCSV_KEY_ROW_MASK (((uint64_t)1 << LAZYCSV_KEY_ROW_BITS) - 1)
+
+typedef struct {
+    uint64_t col;
+    uint64_t slots;
+} LazyCSV_KeyHeader;
+
+
+// a column cache holds the values of a column contiguously, as they are in
+// the data, quotes included. The header is followed by the offsets of its
+// rows + 1 value boundaries, by each value as a number when `typed`, nan
+// where a value isn't one, and then by the values. A cache belongs to the
+// index it was built alongside, and is removed with it.
+
+typedef struct {
+    uint64_t col;
+    uint64_t rows;
+    uint64_t typed;
+} LazyCSV_ColumnHeader;
+
+
+// a mapped file, removed when freed by the process which created it if the
+// file is owned.
+
+typedef struct {
+    int owned;
+    pid_t pid;
+    struct stat st;
+    char* name;
+    char* data;
+} LazyCSV_File;
+
+
+// a decompression checkpoint, `bits` is -1 for the start of a gzip member or
+// a zstd frame, which need no history, otherwise it is the number of bits of
+// the byte before `in` that belong to the deflate block starting at `out`.
+
+typedef struct {
+    size_t out;
+    size_t in;
+    int bits;
+    unsigned char window[LAZYCSV_WINDOW];
+} LazyCSV_Checkpoint;
+
+
+// a window of decompressed data, along with the decoder that produced it
+// which is left positioned at `end` so that forward reads can resume it.
+// `error` is set when filling the window fails. Offsets of an iterator over
+// a cached column are into the `cached` values instead.
+
+typedef struct {
+    char* data;
+    size_t start;
+    size_t end;
+    size_t capacity;
+    size_t in;
+    void* state;
+    int raw;
+    int live;
+    char* cached;
+    LazyCSV_Error error;
+} LazyCSV_Span;
+
+
+// state of the index pass, held across calls to LazyCSV_ScanChunk so that a
+// file can be indexed in arbitrarily sized pieces.
+
+typedef struct {
+    char quoted;
+    char cm1;
+    char row_start;
+    char delimiter;
+    char quotechar;
+    char overflow;
+    char newline_pending;
+    int newline;
+    size_t cols;
+    size_t row_index;
+    size_t col_index;
+    char* overflow_warning;
+    char* underflow_warning;
+    size_t overflow_rows;
+    size_t underflow_rows;
+    size_t escaped_quotes;
+    size_t row_count;
+    size_t anchor_count;
+    LazyCSV_RowBlock block;
+    LazyCSV_AnchorPoint apnt;
+    LazyCSV_CommaWriter* writer;
+    int comma_file;
+    int anchor_file;
+    int newline_file;
+    LazyCSV_Buffer comma_buffer;
+    LazyCSV_Buffer anchor_buffer;
+    LazyCSV_Buffer newline_buffer;
+} LazyCSV_Scanner;
+
+
+// an indexed file. `rows` excludes the header row unless headers are skipped,
+// in which case the header row is read as the first row of data.
+
+struct LazyCSV_Table {
+    size_t rows;
+    size_t cols;
+    int skip_headers;
+    int unquote;
+    char delimiter;
+    char quotechar;
+    char newline;
+    int codec;
+    int index_mode;
+    size_t checkpoint_cols;
+    size_t prefetch;
+    int warnings;
+    size_t overflow_rows;
+    size_t underflow_rows;
+    size_t escaped_quotes;
+    double scan_seconds;
+    double flush_seconds;
+    double map_seconds;
+    LazyCSV_Counters counters;
+    LazyCSV_Span span;
+    LazyCSV_File* data;
+    LazyCSV_File* commas;
+    LazyCSV_File* anchors;
+    LazyCSV_File* newlines;
+    LazyCSV_File* checkpoints;
+    LazyCSV_File** keys;
+    LazyCSV_File** columns;
+};
+
+
+// iterates over a column when `row` is SIZE_MAX, or over a row when `col` is
+// SIZE_MAX, visiting `position` through `stop` every `step` values.
+
+struct LazyCSV_TableIter {
+    LazyCSV_Table* table;
+    size_t row;
+    size_t col;
+    size_t position;
+    size_t stop;
+    size_t step;
+    size_t prefetch;
+    char* hints[3];
+    LazyCSV_Span span;
+    LazyCSV_CommaCache commas;
+    LazyCSV_RowCursor cursor;
+    LazyCSV_Counters counters;
+    const uint64_t* cached;
+    char reversed;
+};
+
+
+char* LazyCSV_SpanFill(LazyCSV_Table *table, LazyCSV_Span *span,
+                       size_t offset, size_t len);
+void LazyCSV_SpanFree(LazyCSV_Table *table, LazyCSV_Span *span);
+
+
+static inline double LazyCSV_Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static inline void LazyCSV_BufferCache(LazyCSV_Buffer *buffer, void *data,
+                                       size_t size) {
+
+    if (size == 0) return;
+
+    if (buffer->size + size >= buffer->capacity) {
+        buffer->capacity += size;
+        buffer->capacity *= 1.3;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(&buffer->data[buffer->size], data, size);
+    buffer->size += size;
+}
+
+
+static inline size_t LazyCSV_AnchorValueFromValue(size_t value,
+                                                  LazyCSV_AnchorPoint *amap,
+                                                  size_t count) {
+
+    LazyCSV_AnchorPoint *apnt = amap + count - 1;
+
+    if (value >= apnt->col) {
+        // we hit this if there is only one anchor point, or we're iterating
+        // over the last anchor point.
+        return apnt->value;
+    }
+
+    LazyCSV_AnchorPoint* apntp1;
+    size_t L = 0, R = count-1;
+
+    while (L <= R) {
+        size_t M = L + ((R - L)/2);
+        apnt = amap + M;
+        apntp1 = apnt + 1;
+        if (value > apntp1->col) {
+            L = M + 1;
+        }
+        else if (value < apnt->col) {
+            R = M - 1;
+        }
+        else if (value == apntp1->col) {
+            return apntp1->value;
+        }
+        else {
+            return apnt->value;
+        }
+    }
+    return SIZE_MAX;
+}
+
+
+static inline LazyCSV_RowEntry *LazyCSV_RowEntryAt(char *newlines,
+                                                   size_t row,
+                                                   LazyCSV_RowBlock **block) {
+
+    size_t stride = sizeof(LazyCSV_RowBlock)
+        + LAZYCSV_ROW_BLOCK*sizeof(LazyCSV_RowEntry);
+
+    *block = (LazyCSV_RowBlock*)
+        (newlines + (row / LAZYCSV_ROW_BLOCK)*stride);
+
+    return (LazyCSV_RowEntry*)(*block + 1) + row % LAZYCSV_ROW_BLOCK;
+}
+
+
+static inline void LazyCSV_RowFromIndex(LazyCSV_Table *table, size_t row,
+                                        LazyCSV_Row *result) {
+
+    char* newlines = table->newlines->data;
+    LazyCSV_RowBlock *block, *next_block;
+
+    LazyCSV_RowEntry* entry = LazyCSV_RowEntryAt(newlines, row, &block);
+    LazyCSV_RowEntry* next = LazyCSV_RowEntryAt(newlines, row+1, &next_block);
+
+    size_t anchor = block->anchor + entry->anchor;
+
+    // when the entry offset spilled, start is meaningless but never used, as
+    // the first anchor of the row is at col 0.
+    result->start = block->offset + entry->offset;
+    result->count = next_block->anchor + next->anchor - anchor;
+    result->anchors = (LazyCSV_AnchorPoint*)table->anchors->data
+        + anchor;
+}
+
+
+static inline size_t LazyCSV_ValueFromIndex(size_t value, LazyCSV_Row *row,
+                                            char *cmap) {
+
+    size_t cval = *(INDEX_DTYPE *)(cmap + (value * sizeof(INDEX_DTYPE)));
+
+    if (!row->count || value < row->anchors->col)
+        return cval + row->start;
+
+    size_t aval =
+        LazyCSV_AnchorValueFromValue(value, row->anchors, row->count);
+    return aval == SIZE_MAX ? aval : cval + aval;
+}
+
+
+static inline LazyCSV_CommaBlock *LazyCSV_CommaBlockAt(LazyCSV_Table *table,
+                                                      size_t block,
+                                                      uint64_t **words,
+                                                      size_t *width) {
+
+    LazyCSV_CommaBlock* header =
+        (LazyCSV_CommaBlock*)table->anchors->data + block;
+
+    *words = (uint64_t*)table->commas->data + (header->packed >> 8);
+    *width = header->packed & 0xff;
+    return header;
+}
+
+
+static inline size_t LazyCSV_CommaDelta(uint64_t *words, size_t width,
+                                        size_t i) {
+    if (!width)
+        return 0;
+
+    size_t bit = i*width, word = bit >> 6, shift = bit & 63;
+    uint64_t delta = words[word] >> shift;
+
+    if (shift + width > 64)
+        delta |= words[word+1] << (64 - shift);
+
+    return width == 64 ? delta : delta & (((uint64_t)1 << width) - 1);
+}
+
+
+static inline size_t LazyCSV_CommaAt(LazyCSV_Table *table, size_t index) {
+    uint64_t* words;
+    size_t width;
+    LazyCSV_CommaBlock* header =
+        LazyCSV_CommaBlockAt(table, index / LAZYCSV_COMMA_BLOCK, &words,
+                             &width);
+
+    size_t value = header->base;
+    for (size_t i = 0; i <= index % LAZYCSV_COMMA_BLOCK; i++)
+        value += LazyCSV_CommaDelta(words, width, i);
+    return value;
+}
+
+
+static inline size_t LazyCSV_CommaFromCache(LazyCSV_Table *table,
+                                            LazyCSV_CommaCache *cache,
+                                            size_t index) {
+
+    size_t block = index / LAZYCSV_COMMA_BLOCK;
+    size_t i = index % LAZYCSV_COMMA_BLOCK;
+
+    if (cache->block != block) {
+        cache->block = block;
+        cache->count = 0;
+    }
+
+    if (i >= cache->count) {
+        uint64_t* words;
+        size_t width;
+        LazyCSV_CommaBlock* header =
+            LazyCSV_CommaBlockAt(table, block, &words, &width);
+
+        size_t value = cache->count
+            ? cache->values[cache->count - 1]
+            : header->base;
+
+        for (size_t j = cache->count; j <= i; j++) {
+            value += LazyCSV_CommaDelta(words, width, j);
+            cache->values[j] = value;
+        }
+        cache->count = i + 1;
+    }
+
+    return cache->values[i];
+}
+
+
+static inline void LazyCSV_FieldFromBlocks(LazyCSV_Table *table, size_t index,
+                                           LazyCSV_CommaCache *cache,
+                                           size_t *offset, size_t *len) {
+
+    if (cache && !cache->values) {
+        // on failure the cache is simply not used
+        cache->values = malloc(LAZYCSV_COMMA_BLOCK*sizeof(size_t));
+        cache->count = 0;
+    }
+
+    size_t cs = cache && cache->values
+        ? LazyCSV_CommaFromCache(table, cache, index)
+        : LazyCSV_CommaAt(table, index);
+
+    // the end of the field is one delta on, which may be the first delta of
+    // the next block, whose base is the start of the field.
+
+    uint64_t* words;
+    size_t width, next = index + 1;
+    LazyCSV_CommaBlockAt(table, next / LAZYCSV_COMMA_BLOCK, &words, &width);
+    size_t ce = cs + LazyCSV_CommaDelta(words, width,
+                                        next % LAZYCSV_COMMA_BLOCK);
+
+    *len = ce - cs - 1;
+    *offset = cs;
+}
+
+
+// SWAR search for the chars which end a field, eight bytes at a time. A
+// byte of word ^ mask is zero where the word matches, and (x - 0x01..) & ~x
+// & 0x80.. is non-zero exactly when some byte of x is zero.
+
+#define LAZYCSV_SWAR_ONES 0x0101010101010101ULL
+#define LAZYCSV_SWAR_HIGHS 0x8080808080808080ULL
+
+static inline uint64_t LazyCSV_SwarMatch(uint64_t word, uint64_t mask) {
+    uint64_t x = word ^ mask;
+    return (x - LAZYCSV_SWAR_ONES) & ~x & LAZYCSV_SWAR_HIGHS;
+}
+
+
+// whether data is plain ASCII, checking the high bit of 32 bytes at a time.
+
+static inline int LazyCSV_IsAscii(const char *data, size_t len) {
+    size_t pos = 0;
+    for (; pos + 4*sizeof(uint64_t) <= len; pos += 4*sizeof(uint64_t)) {
+        uint64_t words[4];
+        memcpy(words, data + pos, sizeof(words));
+        if ((words[0] | words[1] | words[2] | words[3]) & LAZYCSV_SWAR_HIGHS)
+            return 0;
+    }
+    for (; pos + sizeof(uint64_t) <= len; pos += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + pos, sizeof(uint64_t));
+        if (word & LAZYCSV_SWAR_HIGHS)
+            return 0;
+    }
+    for (; pos < len; pos++) {
+        if (data[pos] & 0x80)
+            return 0;
+    }
+    return 1;
+}
+
+
+// hashes a key eight bytes at a time, finished with the murmur3 mixer so
+// that both the low bits picking a slot and the high bits kept in the entry
+// depend on every byte.
+
+static inline uint64_t LazyCSV_KeyHash(const char *data, size_t len) {
+    uint64_t hash = len * 0x9e3779b97f4a7c15ULL, word;
+    size_t pos = 0;
+    for (; pos + sizeof(uint64_t) <= len; pos += sizeof(uint64_t)) {
+        memcpy(&word, data + pos, sizeof(uint64_t));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+    if (pos < len) {
+        word = 0;
+        memcpy(&word, data + pos, len - pos);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+static inline size_t LazyCSV_NextSpecial(char *data, size_t pos, size_t end,
+                                         char delimiter, char quotechar) {
+
+    uint64_t dmask = LAZYCSV_SWAR_ONES * (unsigned char)delimiter;
+    uint64_t qmask = LAZYCSV_SWAR_ONES * (unsigned char)quotechar;
+    uint64_t rmask = LAZYCSV_SWAR_ONES * CARRIAGE_RETURN;
+    uint64_t nmask = LAZYCSV_SWAR_ONES * LINE_FEED;
+
+    while (pos + sizeof(uint64_t) <= end) {
+        uint64_t word;
+        memcpy(&word, data + pos, sizeof(uint64_t));
+        if (LazyCSV_SwarMatch(word, dmask) | LazyCSV_SwarMatch(word, qmask)
+            | LazyCSV_SwarMatch(word, rmask) | LazyCSV_SwarMatch(word, nmask))
+            break;
+        pos += sizeof(uint64_t);
+    }
+
+    for (; pos < end; pos++) {
+        char c = data[pos];
+        if (c == delimiter || c == quotechar
+            || c == CARRIAGE_RETURN || c == LINE_FEED)
+            break;
+    }
+    return pos;
+}
+
+
+static inline size_t LazyCSV_RowStart(LazyCSV_Table *table, size_t row) {
+    LazyCSV_Row ridx;
+    LazyCSV_RowFromIndex(table, row, &ridx);
+
+    // a spilled row start is kept as an anchor at col 0
+    return ridx.count && !ridx.anchors->col
+        ? ridx.anchors->value
+        : ridx.start;
+}
+
+
+// finds a field of a row index by scanning from the start of the row, the
+// nearest checkpoint before it, or the cursor if it is further along. The
+// scan follows the index pass, so a row is split exactly as in flat mode.
+
+static inline void LazyCSV_FieldFromRow(LazyCSV_Table *table,
+                                        LazyCSV_RowCursor *cursor,
+                                        size_t row, size_t col,
+                                        size_t *offset, size_t *len) {
+
+    char* data = table->data->data;
+    size_t end = table->data->st.st_size;
+    char delimiter = table->delimiter, quotechar = table->quotechar;
+
+    size_t pos, index, every = table->checkpoint_cols;
+
+    if (cursor && cursor->offset && cursor->row == row && cursor->col <= col) {
+        pos = cursor->offset;
+        index = cursor->col;
+    }
+    else {
+        pos = LazyCSV_RowStart(table, row);
+        index = 0;
+    }
+
+    if (every && col / every > index / every) {
+        size_t start = LazyCSV_RowStart(table, row);
+        uint32_t* cpnts = (uint32_t*)table->commas->data
+            + row*(table->cols / every) - 1;
+
+        for (size_t k = col / every; k > index / every; k--) {
+            if (cpnts[k] == LAZYCSV_CHECKPOINT_NONE)
+                continue;
+
+            pos = start + cpnts[k];
+            index = k*every;
+
+            // the checkpoint was filled in after the end of the row
+            if (pos > end || data[pos-1] == CARRIAGE_RETURN
+                || data[pos-1] == LINE_FEED) {
+                *offset = pos;
+                *len = SIZE_MAX;
+                return;
+            }
+            break;
+        }
+    }
+
+    size_t field = pos;
+    char quoted = 0;
+
+    // the line feed of a lone carriage return is the first char of the row
+    if (index == 0 && pos > 0 && pos < end && data[pos] == LINE_FEED
+        && data[pos-1] == CARRIAGE_RETURN)
+        pos++;
+
+    while ((pos = LazyCSV_NextSpecial(data, pos, end, delimiter,
+                                      quotechar)) < end) {
+        char c = data[pos];
+        if (c == quotechar) {
+            quoted = !quoted;
+        }
+        else if (!quoted && c == delimiter) {
+            if (index == col)
+                break;
+            index += 1;
+            field = pos + 1;
+        }
+        else if (!quoted) {
+            break;
+        }
+        pos += 1;
+    }
+
+    if (index < col) {
+        // the row underflows, the field is filled like the index pass does
+        *offset = pos + 1;
+        *len = SIZE_MAX;
+        return;
+    }
+
+    if (cursor)
+        *cursor = (LazyCSV_RowCursor){.row = row, .col = col, .offset = field};
+
+    *offset = field;
+    *len = pos - field;
+}
+
+
+static inline void LazyCSV_FieldFromIndex(LazyCSV_Table *table, size_t row,
+                                          size_t col, size_t *offset,
+                                          size_t *len) {
+
+    if (table->index_mode == LAZYCSV_INDEX_COMPRESSED) {
+        LazyCSV_FieldFromBlocks(table, (table->cols+1)*row + col, NULL, offset,
+                                len);
+        return;
+    }
+
+    if (table->index_mode == LAZYCSV_INDEX_ROWS) {
+        LazyCSV_FieldFromRow(table, NULL, row, col, offset, len);
+        return;
+    }
+
+    char* commas = table->commas->data;
+    char* cidx = commas+((table->cols+1)*row*sizeof(INDEX_DTYPE));
+
+    LazyCSV_Row ridx;
+    LazyCSV_RowFromIndex(table, row, &ridx);
+
+    size_t cs = LazyCSV_ValueFromIndex(col, &ridx, cidx);
+    size_t ce = LazyCSV_ValueFromIndex(col + 1, &ridx, cidx);
+
+    *len = ce - cs - 1;
+    *offset = cs;
+}
+
+
+static inline char* LazyCSV_DataAt(LazyCSV_Table *table, LazyCSV_Span *span,
+                                   size_t offset, size_t len) {
+
+    if (span->cached)
+        return span->cached + offset;
+
+    if (!table->codec)
+        return table->data->data + offset;
+
+    if (span->data && span->start <= offset && offset + len <= span->end)
+        return span->data + (offset - span->start);
+
+    return LazyCSV_SpanFill(table, span, offset, len);
+}
+
+
+static inline void LazyCSV_Advise(char *addr, size_t len, int advice) {
+    size_t pad = (uintptr_t)addr % LAZYCSV_PAGESIZE;
+    madvise(addr - pad, len + pad, advice);
+}
+
+
+static inline void LazyCSV_IterField(LazyCSV_TableIter *iter, size_t row,
+                                     size_t col, size_t *offset,
+                                     size_t *len) {
+
+    LazyCSV_Table *table = iter->table;
+
+    if (table->index_mode == LAZYCSV_INDEX_COMPRESSED)
+        LazyCSV_FieldFromBlocks(table, (table->cols+1)*row + col,
+                                &iter->commas, offset, len);
+    else if (table->index_mode == LAZYCSV_INDEX_ROWS)
+        LazyCSV_FieldFromRow(table, &iter->cursor, row, col, offset, len);
+    else
+        LazyCSV_FieldFromIndex(table, row, col, offset, len);
+}
+
+
+static inline size_t LazyCSV_IterColRow(LazyCSV_TableIter *iter,
+                                        size_t position) {
+    LazyCSV_Table *table = iter->table;
+
+    return iter->reversed
+        ? table->rows - 1 - position + !table->skip_headers
+        : position + !table->skip_headers;
+}
+
+
+static inline void LazyCSV_IterColPrefetch(LazyCSV_TableIter *iter) {
+
+    // index pages are hinted at twice the prefetch distance, so that by the
+    // time the data pages are hinted at the prefetch distance the index
+    // lookup required to find them doesn't fault. hints are only issued when
+    // the iterator crosses into a page which hasn't been hinted yet.
+
+    LazyCSV_Table *table = iter->table;
+    size_t distance = iter->prefetch * iter->step;
+    size_t position = iter->position + 2*distance;
+
+    if (position < iter->stop) {
+        size_t row = LazyCSV_IterColRow(iter, position);
+        char *nidx, *cidx;
+
+        if (table->index_mode == LAZYCSV_INDEX_COMPRESSED) {
+            // the skip header stands in for the row entry
+            uint64_t* words;
+            size_t width, index = (table->cols+1)*row + iter->col;
+            nidx = (char*)LazyCSV_CommaBlockAt(
+                table, index / LAZYCSV_COMMA_BLOCK, &words, &width);
+            cidx = (char*)words;
+        }
+        else if (table->index_mode == LAZYCSV_INDEX_ROWS) {
+            // the checkpoint the field is scanned from, if there is one
+            LazyCSV_RowBlock* block;
+            size_t every = table->checkpoint_cols;
+            nidx = (char*)
+                LazyCSV_RowEntryAt(table->newlines->data, row, &block);
+            cidx = every && iter->col >= every
+                ? table->commas->data
+                    + (row*(table->cols / every) + iter->col / every - 1)
+                    * sizeof(uint32_t)
+                : nidx;
+        }
+        else {
+            LazyCSV_RowBlock* block;
+            nidx = (char*)
+                LazyCSV_RowEntryAt(table->newlines->data, row, &block);
+            cidx = table->commas->data
+                + ((table->cols+1)*row + iter->col)*sizeof(INDEX_DTYPE);
+        }
+
+        char* npage = nidx - (uintptr_t)nidx % LAZYCSV_PAGESIZE;
+        char* cpage = cidx - (uintptr_t)cidx % LAZYCSV_PAGESIZE;
+
+        if (npage != iter->hints[0]) {
+            LazyCSV_Advise(nidx, 2*sizeof(LazyCSV_RowEntry), MADV_WILLNEED);
+            iter->hints[0] = npage;
+        }
+        if (cpage != iter->hints[1]) {
+            LazyCSV_Advise(cidx, 2*sizeof(INDEX_DTYPE), MADV_WILLNEED);
+            iter->hints[1] = cpage;
+        }
+    }
+
+    // the data of compressed files is only ever read through a span, so
+    // there is nothing to hint there.
+
+    position = iter->position + distance;
+
+    if (position < iter->stop && !table->codec) {
+        size_t offset, len;
+        size_t row = LazyCSV_IterColRow(iter, position);
+
+        // finding the field of a row index would read the data being
+        // hinted, so the row is hinted from its start instead.
+        if (table->index_mode == LAZYCSV_INDEX_ROWS) {
+            offset = LazyCSV_RowStart(table, row);
+            len = LazyCSV_RowStart(table, row + 1) - offset;
+        }
+        else {
+            LazyCSV_FieldFromIndex(table, row, iter->col, &offset, &len);
+        }
+
+        char* addr = table->data->data + offset;
+        char* dpage = addr - (uintptr_t)addr % LAZYCSV_PAGESIZE;
+
+        if (dpage != iter->hints[2]) {
+            LazyCSV_Advise(addr, len+1, MADV_WILLNEED);
+            iter->hints[2] = dpage;
+        }
+    }
+}
+
+
+static inline void LazyCSV_IterRowPrefetch(LazyCSV_TableIter *iter) {
+
+    // a row is contiguous in both the data file and the comma index, so the
+    // whole row is hinted once on the first iteration.
+
+    LazyCSV_Table *table = iter->table;
+    size_t row = iter->row + !table->skip_headers;
+
+    size_t start, end, len;
+    char* cidx;
+    size_t clen;
+
+    if (table->index_mode == LAZYCSV_INDEX_ROWS) {
+        // the row runs up to the start of the next, and the start of the row
+        // marks it as hinted when it has no checkpoints.
+        size_t every = table->checkpoint_cols;
+        size_t count = every ? table->cols / every : 0;
+
+        start = LazyCSV_RowStart(table, row);
+        end = LazyCSV_RowStart(table, row + 1) - 1;
+        len = 0;
+
+        cidx = count
+            ? table->commas->data + row*count*sizeof(uint32_t)
+            : table->data->data + start;
+        clen = count*sizeof(uint32_t);
+    }
+    else if (table->index_mode == LAZYCSV_INDEX_COMPRESSED) {
+        // the row spans the skip headers and packed deltas of its first
+        // through last blocks
+        uint64_t *words, *last;
+        size_t width, index = (table->cols+1)*row;
+        size_t blocks = (index + table->cols) / LAZYCSV_COMMA_BLOCK
+            - index / LAZYCSV_COMMA_BLOCK + 1;
+
+        char* first = (char*)LazyCSV_CommaBlockAt(
+            table, index / LAZYCSV_COMMA_BLOCK, &words, &width);
+        LazyCSV_CommaBlockAt(table, (index + table->cols) / LAZYCSV_COMMA_BLOCK,
+                             &last, &width);
+
+        LazyCSV_Advise(first, blocks*sizeof(LazyCSV_CommaBlock),
+                       MADV_WILLNEED);
+        LazyCSV_FieldFromIndex(table, row, 0, &start, &len);
+        LazyCSV_FieldFromIndex(table, row, table->cols - 1, &end, &len);
+
+        cidx = (char*)words;
+        clen = (char*)(last + 2*width) - cidx;
+    }
+    else {
+        LazyCSV_FieldFromIndex(table, row, 0, &start, &len);
+        LazyCSV_FieldFromIndex(table, row, table->cols - 1, &end, &len);
+
+        cidx = table->commas->data
+            + (table->cols+1)*row*sizeof(INDEX_DTYPE);
+        clen = (table->cols+1)*sizeof(INDEX_DTYPE);
+    }
+
+    LazyCSV_Advise(cidx, clen, MADV_WILLNEED);
+    iter->hints[2] = cidx;
+
+    if (!table->codec)
+        LazyCSV_Advise(table->data->data + start, end + len - start + 1,
+                       MADV_WILLNEED);
+}
+
+
+// a column iterator over a column with a cache reads its values from the
+// cache file, which is read sequentially rather than through the index.
+
+static inline void LazyCSV_IterColCache(LazyCSV_TableIter *iter) {
+    LazyCSV_Table *table = iter->table;
+
+    iter->cached = NULL;
+    iter->span.cached = NULL;
+
+    if (iter->row != SIZE_MAX || iter->col >= table->cols)
+        return;
+
+    // caches may be published by another thread, see LazyCSV_TableCacheColumn
+    LazyCSV_File** columns =
+        __atomic_load_n(&table->columns, __ATOMIC_ACQUIRE);
+    LazyCSV_File* column = columns
+        ? __atomic_load_n(&columns[iter->col], __ATOMIC_ACQUIRE)
+        : NULL;
+    if (!column)
+        return;
+
+    LazyCSV_ColumnHeader* header = (LazyCSV_ColumnHeader*)column->data;
+    iter->cached = (uint64_t*)(header + 1);
+    iter->span.cached = (char*)(iter->cached + header->rows + 1
+                                + header->typed*header->rows);
+}
+
+
+// the values of a typed column cache as numbers, by row, or NULL.
+static inline const double* LazyCSV_IterColNumbers(LazyCSV_TableIter *iter) {
+    if (!iter->cached)
+        return NULL;
+
+    LazyCSV_ColumnHeader* header = (LazyCSV_ColumnHeader*)iter->cached - 1;
+    return header->typed
+        ? (const double*)(iter->cached + header->rows + 1)
+        : NULL;
+}
+
+
+static inline void LazyCSV_IterCol(LazyCSV_TableIter *iter, size_t *offset,
+                                   size_t *len) {
+
+    if (iter->position < iter->stop && iter->cached) {
+        size_t index = LazyCSV_IterColRow(iter, iter->position)
+            - !iter->table->skip_headers;
+
+        iter->position += iter->step;
+
+        *offset = iter->cached[index];
+        *len = iter->cached[index + 1] - *offset;
+        LAZYCSV_COUNT(&iter->counters, *len);
+    }
+    else if (iter->position < iter->stop) {
+        size_t row = LazyCSV_IterColRow(iter, iter->position);
+
+        if (iter->prefetch)
+            LazyCSV_IterColPrefetch(iter);
+
+        iter->position += iter->step;
+
+        LazyCSV_IterField(iter, row, iter->col, offset, len);
+        LAZYCSV_COUNT(&iter->counters, *len);
+    }
+}
+
+
+static inline void LazyCSV_IterRow(LazyCSV_TableIter *iter, size_t *offset,
+                                   size_t *len) {
+
+    LazyCSV_Table *table = iter->table;
+
+    if (iter->position < iter->stop) {
+        size_t position =
+            iter->reversed ? table->cols - iter->position - 1 : iter->position;
+
+        if (iter->prefetch && !iter->hints[2])
+            LazyCSV_IterRowPrefetch(iter);
+
+        iter->position += iter->step;
+
+        size_t row = iter->row + !table->skip_headers;
+
+        LazyCSV_IterField(iter, row, position, offset, len);
+        LAZYCSV_COUNT(&iter->counters, *len);
+    }
+}
+
+
+static inline size_t LazyCSV_IterRemaining(LazyCSV_TableIter *iter) {
+    return iter->position < iter->stop
+        ? (iter->stop - iter->position + iter->step - 1) / iter->step
+        : 0;
+}
+
+#endif
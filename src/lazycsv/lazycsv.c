@@ -1,26 +1,7 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdint.h>
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <limits.h>
-
 #include <Python.h>
 #include "structmember.h"
 
-#define LINE_FEED 10
-#define CARRIAGE_RETURN 13
-
-// users can set this macro using the env variable LAZYCSV_INDEX_DTYPE if you
-// want to be more aggressive with minimizing index disk usage (i.e. define
-// INDEX_DTYPE as uint8_t) but at a cost to performance.
-
-#ifndef INDEX_DTYPE
-#define INDEX_DTYPE uint16_t
-#endif
+#include <pthread.h>
 
 #ifdef DEBUG
 void PyDebug() {return;}
@@ -49,49 +30,37 @@ void PyDebug() {return;}
 #include <numpy/arrayobject.h>
 #endif
 
+// the few pieces of state shared between the threads reading a LazyCSV, its
+// lookup span and counters, are guarded by a critical section on the object,
+// which takes a lock on free-threaded builds and is the GIL elsewhere.
 
-static size_t INDEX_DTYPE_MAX = ((INDEX_DTYPE) ~(INDEX_DTYPE)0);
-
-
-typedef struct {
-    char* data;
-    size_t size;
-    size_t capacity;
-} LazyCSV_Buffer;
-
-
-typedef struct {
-    PyObject* empty;
-    PyObject** items;
-} LazyCSV_Cache;
-
-
-typedef struct {
-    size_t col;
-    size_t value;
-} LazyCSV_AnchorPoint;
+#ifndef Py_BEGIN_CRITICAL_SECTION
+#define Py_BEGIN_CRITICAL_SECTION(op) {
+#define Py_END_CRITICAL_SECTION() }
+#endif
 
+// the index and field lookups are implemented by the lazycsv C library in
+// core.c, this file wraps a LazyCSV_Table in the Python objects.
 
-typedef struct {
-    size_t index;
-    size_t count;
-} LazyCSV_RowIndex;
+#include "core.h"
 
 
-typedef struct {
-    int fd;
-    struct stat st;
-    char* name;
-    char* data;
-} LazyCSV_File;
+// values are bytes, or str when decoded with an `encoding`. The empty value
+// and single byte values are cached, NULL items are decoded when read, which
+// raises for bytes that aren't valid on their own.
 
+#define LAZYCSV_DECODE_NONE 0
+#define LAZYCSV_DECODE_UTF8 1
+#define LAZYCSV_DECODE_ASCII 2
+#define LAZYCSV_DECODE_LATIN1 3
+#define LAZYCSV_DECODE_OTHER 4
 
 typedef struct {
-    PyObject* dir;
-    LazyCSV_File* commas;
-    LazyCSV_File* anchors;
-    LazyCSV_File* newlines;
-} LazyCSV_Index;
+    int decode;
+    char* encoding;
+    PyObject* empty;
+    PyObject* items[UCHAR_MAX + 1];
+} LazyCSV_Cache;
 
 
 typedef struct {
@@ -100,198 +69,170 @@ typedef struct {
     PyObject* name;
     size_t rows;
     size_t cols;
-    int _skip_headers;
-    int _unquote;
-    char _quotechar;
-    char _newline;
-    LazyCSV_Index* _index;
-    LazyCSV_File* _data;
+    PyObject* _dir;
+    LazyCSV_Table* _table;
     LazyCSV_Cache* _cache;
+    double _headers_seconds;
 } LazyCSV;
 
 
 typedef struct {
     PyObject_HEAD
     PyObject* lazy;
-    size_t row;
-    size_t col;
-    size_t position;
-    size_t stop;
-    size_t step;
-    char reversed;
+    LazyCSV_TableIter state;
 } LazyCSV_Iter;
 
 
-static inline void LazyCSV_BufferWrite(int fd, LazyCSV_Buffer *buffer,
-                                       void *data, size_t size) {
+static void LazyCSV_RaiseError(LazyCSV_Error *error) {
+    PyObject* type;
 
-    if (buffer->size + size >= buffer->capacity) {
-        write(fd, buffer->data, buffer->size);
-        buffer->size = 0;
+    switch (error->code) {
+    case LAZYCSV_ERROR_NOT_FOUND:
+        type = PyExc_FileNotFoundError;
+        break;
+    case LAZYCSV_ERROR_MEMORY:
+        type = PyExc_MemoryError;
+        break;
+    case LAZYCSV_ERROR_VALUE:
+        type = PyExc_ValueError;
+        break;
+    default:
+        type = PyExc_RuntimeError;
     }
-    memcpy(&buffer->data[buffer->size], data, size);
-    buffer->size += size;
-}
-
-
-static inline void LazyCSV_BufferCache(LazyCSV_Buffer *buffer, void *data,
-                                       size_t size) {
-
-    if (size == 0) return;
 
-    if (buffer->size + size >= buffer->capacity) {
-        buffer->capacity += size;
-        buffer->capacity *= 1.3;
-        buffer->data = realloc(buffer->data, buffer->capacity);
-    }
-    memcpy(&buffer->data[buffer->size], data, size);
-    buffer->size += size;
+    PyErr_SetString(type, error->message);
 }
 
 
-static inline void LazyCSV_BufferFlush(int comma_file, LazyCSV_Buffer *buffer) {
-    write(comma_file, buffer->data, buffer->size);
-    buffer->size = 0;
-    fsync(comma_file);
+static void LazyCSV_CacheFree(LazyCSV_Cache *cache) {
+    if (!cache)
+        return;
+    Py_XDECREF(cache->empty);
+    for (size_t i = 0; i <= UCHAR_MAX; i++)
+        Py_XDECREF(cache->items[i]);
+    free(cache->encoding);
+    free(cache);
 }
 
 
-static inline void LazyCSV_ValueToDisk(size_t value, LazyCSV_RowIndex *ridx,
-                                       LazyCSV_AnchorPoint *apnt,
-                                       size_t col_index, int cfile,
-                                       LazyCSV_Buffer *cbuf, int afile,
-                                       LazyCSV_Buffer *abuf) {
-
-    size_t target = value - apnt->value;
+static LazyCSV_Cache* LazyCSV_CacheNew(const char *encoding) {
+    LazyCSV_Cache* cache = calloc(1, sizeof(LazyCSV_Cache));
+    if (!cache)
+        return (LazyCSV_Cache*)PyErr_NoMemory();
+
+    if (encoding) {
+        PyObject* codecs = PyImport_ImportModule("codecs");
+        PyObject* info = codecs
+            ? PyObject_CallMethod(codecs, "lookup", "s", encoding)
+            : NULL;
+        PyObject* name = info ? PyObject_GetAttrString(info, "name") : NULL;
+        const char* _name = name ? PyUnicode_AsUTF8(name) : NULL;
+
+        cache->encoding = _name ? strdup(_name) : NULL;
+        Py_XDECREF(codecs);
+        Py_XDECREF(info);
+        Py_XDECREF(name);
+
+        if (!cache->encoding) {
+            free(cache);
+            if (!PyErr_Occurred())
+                PyErr_NoMemory();
+            return NULL;
+        }
 
-    if (target > INDEX_DTYPE_MAX) {
-        *apnt = (LazyCSV_AnchorPoint){.value = value, .col = col_index+1};
-        LazyCSV_BufferWrite(afile, abuf, apnt, sizeof(LazyCSV_AnchorPoint));
-        ridx->count += 1;
-        target = 0;
+        cache->decode =
+            !strcmp(cache->encoding, "utf-8") ? LAZYCSV_DECODE_UTF8
+            : !strcmp(cache->encoding, "ascii") ? LAZYCSV_DECODE_ASCII
+            : !strcmp(cache->encoding, "iso8859-1") ? LAZYCSV_DECODE_LATIN1
+            : LAZYCSV_DECODE_OTHER;
     }
 
-    INDEX_DTYPE item = target;
-
-    LazyCSV_BufferWrite(cfile, cbuf, &item, sizeof(INDEX_DTYPE));
-}
-
-
-static inline size_t LazyCSV_AnchorValueFromValue(size_t value,
-                                                  LazyCSV_AnchorPoint *amap,
-                                                  LazyCSV_RowIndex *ridx) {
-
-    LazyCSV_AnchorPoint *apnt = amap + ridx->count - 1;
-
-    if (value >= apnt->col) {
-        // we hit this if there is only one anchor point, or we're iterating
-        // over the last anchor point.
-        return apnt->value;
+    // other codecs are decoded through python, even single bytes
+    size_t cached = cache->decode == LAZYCSV_DECODE_NONE
+                    || cache->decode == LAZYCSV_DECODE_LATIN1
+        ? UCHAR_MAX + 1
+        : cache->decode == LAZYCSV_DECODE_OTHER ? 0 : 128;
+
+    cache->empty = cache->decode
+        ? PyUnicode_New(0, 0)
+        : PyBytes_FromStringAndSize(NULL, 0);
+    char failed = !cache->empty;
+
+    for (size_t i = 0; i < cached; i++) {
+        char c = (char)i;
+        cache->items[i] = cache->decode
+            ? PyUnicode_FromOrdinal((int)i)
+            : PyBytes_FromStringAndSize(&c, 1);
+        failed |= !cache->items[i];
     }
 
-    LazyCSV_AnchorPoint* apntp1;
-    size_t L = 0, R = ridx->count-1;
-
-    while (L <= R) {
-        size_t M = L + ((R - L)/2);
-        apnt = amap + M;
-        apntp1 = apnt + 1;
-        if (value > apntp1->col) {
-            L = M + 1;
-        }
-        else if (value < apnt->col) {
-            R = M - 1;
-        }
-        else if (value == apntp1->col) {
-            return apntp1->value;
-        }
-        else {
-            return apnt->value;
-        }
+    if (failed) {
+        LazyCSV_CacheFree(cache);
+        return NULL;
     }
-    return SIZE_MAX;
-}
-
-
-static inline size_t LazyCSV_ValueFromIndex(size_t value,
-                                            LazyCSV_RowIndex *ridx, char *cmap,
-                                            char *amap) {
-
-    size_t cval = *(INDEX_DTYPE *)(cmap + (value * sizeof(INDEX_DTYPE)));
-    size_t aval =
-        LazyCSV_AnchorValueFromValue(value, (LazyCSV_AnchorPoint *)amap, ridx);
-    return aval == SIZE_MAX ? aval : cval + aval;
+    return cache;
 }
 
 
-static inline void LazyCSV_IterCol(LazyCSV_Iter *iter, size_t *offset,
-                                   size_t *len) {
-
-    LazyCSV *lazy = (LazyCSV *)iter->lazy;
-
-    if (iter->position < iter->stop) {
-        size_t position =
-            iter->reversed
-                ? lazy->rows - 1 - iter->position + !lazy->_skip_headers
-                : iter->position + !lazy->_skip_headers;
-
-        iter->position += iter->step;
+static inline PyObject *LazyCSV_Decode(LazyCSV_Cache *cache, const char *addr,
+                                       size_t len) {
 
-        char* newlines = lazy->_index->newlines->data;
-        char* anchors = lazy->_index->anchors->data;
-        char* commas = lazy->_index->commas->data;
+    // values with an ASCII compatible encoding which are plain ASCII are
+    // copied straight into a compact ASCII str.
 
-        LazyCSV_RowIndex* ridx =
-            (LazyCSV_RowIndex*)
-            (newlines + position*sizeof(LazyCSV_RowIndex));
-
-        char* aidx = anchors+ridx->index;
-        char* cidx = commas+((lazy->cols+1)*position*sizeof(INDEX_DTYPE));
+    switch (cache->decode) {
+    case LAZYCSV_DECODE_NONE:
+        return PyBytes_FromStringAndSize(addr, len);
+    case LAZYCSV_DECODE_OTHER:
+        return PyUnicode_Decode(addr, len, cache->encoding, "strict");
+    }
 
-        size_t cs = LazyCSV_ValueFromIndex(iter->col, ridx, cidx, aidx);
-        size_t ce = LazyCSV_ValueFromIndex(iter->col + 1, ridx, cidx, aidx);
+    if (LazyCSV_IsAscii(addr, len)) {
+        PyObject* result = PyUnicode_New(len, 127);
+        if (result)
+            memcpy(PyUnicode_DATA(result), addr, len);
+        return result;
+    }
 
-        *len = ce - cs - 1;
-        *offset = cs;
+    switch (cache->decode) {
+    case LAZYCSV_DECODE_UTF8:
+        return PyUnicode_DecodeUTF8(addr, len, "strict");
+    case LAZYCSV_DECODE_ASCII:
+        return PyUnicode_DecodeASCII(addr, len, "strict");
+    default:
+        return PyUnicode_DecodeLatin1(addr, len, "strict");
     }
 }
 
 
-static inline void LazyCSV_IterRow(LazyCSV_Iter *iter, size_t *offset,
-                                   size_t *len) {
-
-    LazyCSV *lazy = (LazyCSV *)iter->lazy;
-
-    if (iter->position < iter->stop) {
-        size_t position =
-            iter->reversed ? lazy->cols - iter->position - 1 : iter->position;
-
-        iter->position += iter->step;
-
-        char* newlines = lazy->_index->newlines->data;
-        char* anchors = lazy->_index->anchors->data;
-        char* commas = lazy->_index->commas->data;
+static PyObject *LazyCSV_DecodeEscaped(LazyCSV_Cache *cache,
+                                       const char *addr, size_t len,
+                                       char quotechar) {
 
-        size_t row = iter->row + !lazy->_skip_headers;
+    // unescapes into a bytes object, which is the result unless it is
+    // decoded further.
 
-        LazyCSV_RowIndex* ridx =
-            (LazyCSV_RowIndex*)
-            (newlines + row*sizeof(LazyCSV_RowIndex));
-
-        char *aidx = anchors + ridx->index;
-        char *cidx = commas + ((lazy->cols + 1) * row * sizeof(INDEX_DTYPE));
+    PyObject* result = PyBytes_FromStringAndSize(NULL, len);
+    if (!result)
+        return NULL;
 
-        size_t cs = LazyCSV_ValueFromIndex(position, ridx, cidx, aidx);
-        size_t ce = LazyCSV_ValueFromIndex(position + 1, ridx, cidx, aidx);
+    char* data = PyBytes_AS_STRING(result);
+    len = LazyCSV_Unescape(data, addr, len, quotechar);
 
-        *len = ce - cs - 1;
-        *offset = cs;
+    if (cache->decode) {
+        PyObject* decoded = LazyCSV_Decode(cache, data, len);
+        Py_DECREF(result);
+        return decoded;
     }
+
+    _PyBytes_Resize(&result, len);
+    return result;
 }
 
 
-static inline PyObject *PyBytes_FromOffsetAndLen(LazyCSV *lazy, size_t offset,
-                                                 size_t len) {
+static inline PyObject *PyBytes_FromOffsetAndLen(LazyCSV *lazy,
+                                                 LazyCSV_Span *span,
+                                                 size_t offset, size_t len) {
 
     PyObject* result;
     char* addr;
@@ -304,25 +245,42 @@ static inline PyObject *PyBytes_FromOffsetAndLen(LazyCSV *lazy, size_t offset,
         Py_INCREF(result);
         break;
     case 1:
-        addr = lazy->_data->data + offset;
-        result = lazy->_cache->items[(size_t)*addr];
+        addr = LazyCSV_DataAt(lazy->_table, span, offset, len);
+        if (!addr) {
+            LazyCSV_RaiseError(&span->error);
+            return NULL;
+        }
+        result = lazy->_cache->items[(unsigned char)*addr];
+        if (!result)
+            return LazyCSV_Decode(lazy->_cache, addr, len);
         Py_INCREF(result);
         break;
     default:
-        addr = lazy->_data->data + offset;
+        addr = LazyCSV_DataAt(lazy->_table, span, offset, len);
+        if (!addr) {
+            LazyCSV_RaiseError(&span->error);
+            return NULL;
+        }
 
         char strip_quotes = (
-            lazy->_unquote
-            && addr[0] == lazy->_quotechar
-            && addr[len-1] == lazy->_quotechar
+            lazy->_table->unquote
+            && addr[0] == lazy->_table->quotechar
+            && addr[len-1] == lazy->_table->quotechar
         );
 
         if (strip_quotes) {
             addr = addr+1;
             len = len-2;
+
+            // only files in which the index pass saw an escaped quote need
+            // their quoted fields searched for one.
+            if (lazy->_table->escaped_quotes
+                && memchr(addr, lazy->_table->quotechar, len))
+                return LazyCSV_DecodeEscaped(lazy->_cache, addr, len,
+                                             lazy->_table->quotechar);
         }
 
-        result = PyBytes_FromStringAndSize(addr, len);
+        result = LazyCSV_Decode(lazy->_cache, addr, len);
     }
 
     return result;
@@ -330,8 +288,8 @@ static inline PyObject *PyBytes_FromOffsetAndLen(LazyCSV *lazy, size_t offset,
 
 
 static PyObject* LazyCSV_IterNext(PyObject* self) {
-    LazyCSV_Iter* iter = (LazyCSV_Iter*)self;
-    LazyCSV *lazy = (LazyCSV *)iter->lazy;
+    LazyCSV_TableIter* iter = &((LazyCSV_Iter*)self)->state;
+    LazyCSV *lazy = (LazyCSV *)((LazyCSV_Iter*)self)->lazy;
 
     size_t offset = SIZE_MAX, len;
 
@@ -355,23 +313,35 @@ static PyObject* LazyCSV_IterNext(PyObject* self) {
         return NULL;
     }
 
-    return PyBytes_FromOffsetAndLen(lazy, offset, len);
+    return PyBytes_FromOffsetAndLen(lazy, &iter->span, offset, len);
+}
+
+
+// the number of fields to_list finds between taking back the GIL, lists of
+// fewer than LAZYCSV_LIST_RELEASE fields are found without releasing it.
+#define LAZYCSV_LIST_CHUNK 512
+#define LAZYCSV_LIST_RELEASE 1024
+
+
+static inline void LazyCSV_IterStep(LazyCSV_TableIter *iter, size_t *offset,
+                                    size_t *len) {
+    if (iter->col == SIZE_MAX)
+        LazyCSV_IterRow(iter, offset, len);
+    else
+        LazyCSV_IterCol(iter, offset, len);
 }
 
 
 static PyObject* LazyCSV_IterAsList(PyObject* self) {
-    LazyCSV_Iter* iter = (LazyCSV_Iter*)self;
-    LazyCSV* lazy = (LazyCSV*)iter->lazy;
+    LazyCSV_TableIter* iter = &((LazyCSV_Iter*)self)->state;
+    LazyCSV* lazy = (LazyCSV*)((LazyCSV_Iter*)self)->lazy;
 
     size_t size;
     size_t iter_col = iter->col;
     size_t iter_row = iter->row;
 
-    if (iter_col == SIZE_MAX) {
-        size = lazy->cols - iter->position;
-    }
-    else if (iter_row == SIZE_MAX) {
-        size = lazy->rows - iter->position;
+    if (iter_col == SIZE_MAX || iter_row == SIZE_MAX) {
+        size = LazyCSV_IterRemaining(iter);
     }
     else {
         PyErr_SetString(
@@ -381,40 +351,198 @@ static PyObject* LazyCSV_IterAsList(PyObject* self) {
         return NULL;
     }
 
+    LAZYCSV_PROBE3(list__start, iter_row, iter_col, size);
+
     PyObject* result = PyList_New(size);
+    if (!result)
+        return NULL;
+
+    // longer lists find their fields a chunk at a time without the GIL,
+    // which is only taken back to create their objects.
+
+    size_t fields[2*LAZYCSV_LIST_CHUNK];
+    size_t chunk = size < LAZYCSV_LIST_RELEASE ? 0 : LAZYCSV_LIST_CHUNK;
     size_t offset=SIZE_MAX, len=0;
 
-    PyObject* item;
-    for (size_t i = 0; i < size; i++) {
-        switch (iter_col) {
-        case SIZE_MAX:
-            LazyCSV_IterRow(iter, &offset, &len);
-            break;
-        default:
-            LazyCSV_IterCol(iter, &offset, &len);
+    for (size_t i = 0, j = chunk; i < size; i++, j++) {
+        if (chunk && j == chunk) {
+            j = 0;
+            Py_BEGIN_ALLOW_THREADS
+            for (size_t k = 0; k < chunk && i + k < size; k++)
+                LazyCSV_IterStep(iter, fields + 2*k, fields + 2*k + 1);
+            Py_END_ALLOW_THREADS
+        }
+
+        if (chunk) {
+            offset = fields[2*j];
+            len = fields[2*j + 1];
+        }
+        else {
+            LazyCSV_IterStep(iter, &offset, &len);
+        }
+
+        PyObject* item =
+            PyBytes_FromOffsetAndLen(lazy, &iter->span, offset, len);
+        if (!item) {
+            Py_DECREF(result);
+            return NULL;
         }
-        item = PyBytes_FromOffsetAndLen(lazy, offset, len);
         PyList_SET_ITEM(result, i, item);
     }
 
+    LAZYCSV_PROBE1(list__done, size);
     return result;
 }
 
 
 #if INCLUDE_NUMPY
-static PyObject* LazyCSV_IterAsNumpy(PyObject* self) {
-    LazyCSV_Iter* iter = (LazyCSV_Iter*)self;
-    LazyCSV* lazy = (LazyCSV*)iter->lazy;
+static PyObject* LazyCSV_NumpyFromBuffer(LazyCSV_Buffer *buffer, size_t size,
+                                         size_t max_len) {
+
+    // buffer holds `size` length prefixed values, which are copied into a
+    // fixed width bytes array. The buffer is freed.
+
+    npy_intp const dimensions[1] = {size, };
+    npy_intp const strides[1] = {max_len, };
+
+    PyArrayObject *arr =
+        (PyArrayObject *)PyArray_New(&PyArray_Type, 1, dimensions, NPY_STRING,
+                                     strides, NULL, max_len, 0, NULL);
+
+    if (!arr) {
+        free(buffer->data);
+        PyErr_SetString(
+            PyExc_RuntimeError,
+            "could not allocate numpy array"
+        );
+        return NULL;
+    }
+
+    size_t len;
+    char* tempbuf = buffer->data;
+    char* arrdata = PyArray_DATA(arr);
+
+    for (size_t i = 0; i < size; i++) {
+        len = *(size_t *)tempbuf;
+        tempbuf += sizeof(size_t);
+        size_t padlen = max_len - len;
+        strncpy(arrdata, tempbuf, len);
+        tempbuf += len;
+        arrdata += len;
+        memset(arrdata, 0, padlen);
+        arrdata += padlen;
+    }
+
+    free(buffer->data);
+
+    return PyArray_Return(arr);
+}
+
+
+static PyObject* LazyCSV_IterAsNumbers(LazyCSV_TableIter *iter,
+                                       size_t size) {
+
+    // values which aren't numbers, empty ones included, are nan
+    npy_intp const dimensions[1] = {size, };
+    PyObject* arr = PyArray_SimpleNew(1, dimensions, NPY_FLOAT64);
+    if (!arr)
+        return NULL;
+
+    LazyCSV_Error error;
+    int failed;
+
+    Py_BEGIN_ALLOW_THREADS
+    failed = LazyCSV_TableIterNumbers(iter, PyArray_DATA((PyArrayObject*)arr),
+                                      size, &error);
+    Py_END_ALLOW_THREADS
+
+    if (failed < 0) {
+        Py_DECREF(arr);
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+    return arr;
+}
+
+
+static PyObject* LazyCSV_IterAsTimes(LazyCSV_TableIter *iter, size_t size,
+                                     const char *dtype, int64_t per_second,
+                                     const char *format) {
+
+    // the unit of the array is taken from the name of its dtype
+    PyArray_Descr* descr = NULL;
+    PyObject* name = PyUnicode_FromString(dtype);
+    if (!name || !PyArray_DescrConverter(name, &descr)) {
+        Py_XDECREF(name);
+        return NULL;
+    }
+    Py_DECREF(name);
+
+    npy_intp const dimensions[1] = {size, };
+    PyObject* arr = PyArray_NewFromDescr(&PyArray_Type, descr, 1, dimensions,
+                                         NULL, NULL, 0, NULL);
+    if (!arr)
+        return NULL;
+
+    LazyCSV_Error error;
+    int failed;
+
+    Py_BEGIN_ALLOW_THREADS
+    failed = LazyCSV_TableIterTimes(iter, PyArray_DATA((PyArrayObject*)arr),
+                                    size, per_second, format, &error);
+    Py_END_ALLOW_THREADS
+
+    if (failed < 0) {
+        Py_DECREF(arr);
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+    return arr;
+}
+
+
+static PyObject* LazyCSV_IterAsNumpy(PyObject* self, PyObject* args,
+                                     PyObject* kwargs) {
+    LazyCSV_TableIter* iter = &((LazyCSV_Iter*)self)->state;
+    LazyCSV* lazy = (LazyCSV*)((LazyCSV_Iter*)self)->lazy;
+    const char *dtype = NULL, *format = NULL;
+
+    static char* kwlist[] = {"dtype", "format", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|zz", kwlist, &dtype,
+                                     &format))
+        return NULL;
+
+    int64_t per_second =
+        !dtype ? 0
+        : !strcmp(dtype, "datetime64[s]") ? 1
+        : !strcmp(dtype, "datetime64[ms]") ? 1000
+        : !strcmp(dtype, "datetime64[us]") ? 1000000
+        : 0;
+
+    if (dtype && !per_second && strcmp(dtype, "float64")) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "dtype must be None, 'float64', 'datetime64[s]', "
+            "'datetime64[ms]' or 'datetime64[us]'"
+        );
+        return NULL;
+    }
+
+    if (format && !per_second) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "format is only used with a datetime64 dtype"
+        );
+        return NULL;
+    }
 
     size_t size;
     size_t iter_col = iter->col;
     size_t iter_row = iter->row;
 
-    if (iter_col != SIZE_MAX) {
-        size = lazy->rows - iter->position;
-    }
-    else if (iter_row != SIZE_MAX) {
-        size = lazy->cols - iter->position;
+    if (iter_col == SIZE_MAX || iter_row == SIZE_MAX) {
+        size = LazyCSV_IterRemaining(iter);
     }
     else {
         PyErr_SetString(
@@ -424,15 +552,23 @@ static PyObject* LazyCSV_IterAsNumpy(PyObject* self) {
         return NULL;
     }
 
+    LAZYCSV_PROBE3(numpy__start, iter_row, iter_col, size);
+
+    if (per_second)
+        return LazyCSV_IterAsTimes(iter, size, dtype, per_second, format);
+    if (dtype)
+        return LazyCSV_IterAsNumbers(iter, size);
+
     size_t buffer_capacity = 65536; // 2**16
     LazyCSV_Buffer buffer = {.data = malloc(buffer_capacity),
                              .size = 0,
                              .capacity = buffer_capacity};
 
-    size_t offset, len=0, max_len=0;
-    char* addr;
+    size_t offset=0, len=0, max_len=0;
+    char* addr = buffer.data;
 
-    for (size_t i=0; i < size; i++) {
+    Py_BEGIN_ALLOW_THREADS
+    for (size_t i=0; addr && i < size; i++) {
         switch (iter_col) {
         case SIZE_MAX:
             LazyCSV_IterRow(iter, &offset, &len);
@@ -440,45 +576,26 @@ static PyObject* LazyCSV_IterAsNumpy(PyObject* self) {
         default:
             LazyCSV_IterCol(iter, &offset, &len);
         }
-        addr = lazy->_data->data + offset;
-        LazyCSV_BufferCache(&buffer, &len, sizeof(size_t));
-        LazyCSV_BufferCache(&buffer, addr, len);
-        max_len = len > max_len ? len : max_len;
+        addr = LazyCSV_DataAt(lazy->_table, &iter->span, offset, len);
+        if (addr) {
+            LazyCSV_BufferCache(&buffer, &len, sizeof(size_t));
+            LazyCSV_BufferCache(&buffer, addr, len);
+            max_len = len > max_len ? len : max_len;
+        }
     }
+    Py_END_ALLOW_THREADS
 
-    npy_intp const dimensions[1] = {size, };
-    npy_intp const strides[1] = {max_len, };
-
-    PyArrayObject *arr =
-        (PyArrayObject *)PyArray_New(&PyArray_Type, 1, dimensions, NPY_STRING,
-                                     strides, NULL, max_len, 0, NULL);
-
-    if (!arr) {
+    if (!addr) {
+        if (buffer.data)
+            LazyCSV_RaiseError(&iter->span.error);
+        else
+            PyErr_NoMemory();
         free(buffer.data);
-        PyErr_SetString(
-            PyExc_RuntimeError,
-            "could not allocate numpy array"
-        );
         return NULL;
     }
 
-    char* tempbuf = buffer.data;
-    char* arrdata = PyArray_DATA(arr);
-
-    for (size_t i = 0; i < size; i++) {
-        len = *(size_t *)tempbuf;
-        tempbuf += sizeof(size_t);
-        size_t padlen = max_len - len;
-        strncpy(arrdata, tempbuf, len);
-        tempbuf += len;
-        arrdata += len;
-        memset(arrdata, 0, padlen);
-        arrdata += padlen;
-    }
-
-    free(buffer.data);
-
-    return PyArray_Return(arr);
+    LAZYCSV_PROBE2(numpy__done, size, max_len);
+    return LazyCSV_NumpyFromBuffer(&buffer, size, max_len);
 }
 #endif
 
@@ -489,7 +606,28 @@ static PyObject* LazyCSV_IterSelf(PyObject* self) {
 }
 
 
+#if INCLUDE_COUNTERS
+static PyObject* LazyCSV_IterStats(PyObject* self) {
+    LazyCSV_TableIter* iter = &((LazyCSV_Iter*)self)->state;
+    return Py_BuildValue(
+        "{s:n,s:n}",
+        "values_served", (Py_ssize_t)iter->counters.values,
+        "bytes_served", (Py_ssize_t)iter->counters.bytes
+    );
+}
+#endif
+
+
 static void LazyCSV_IterDestruct(LazyCSV_Iter* self) {
+    LazyCSV_Table* table = ((LazyCSV*)self->lazy)->_table;
+#if INCLUDE_COUNTERS
+    Py_BEGIN_CRITICAL_SECTION(self->lazy);
+    table->counters.values += self->state.counters.values;
+    table->counters.bytes += self->state.counters.bytes;
+    Py_END_CRITICAL_SECTION();
+#endif
+    LazyCSV_SpanFree(table, &self->state.span);
+    free(self->state.commas.values);
     Py_DECREF(self->lazy);
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
@@ -500,7 +638,7 @@ static PyMethodDef LazyCSV_IterMethods[] = {
     {
         "to_numpy",
         (PyCFunction)LazyCSV_IterAsNumpy,
-        METH_NOARGS,
+        METH_VARARGS|METH_KEYWORDS,
         "materialize iterator into a numpy array"
     },
 #endif
@@ -510,6 +648,14 @@ static PyMethodDef LazyCSV_IterMethods[] = {
         METH_NOARGS,
         "materialize iterator into a list"
     },
+#if INCLUDE_COUNTERS
+    {
+        "stats",
+        (PyCFunction)LazyCSV_IterStats,
+        METH_NOARGS,
+        "values and bytes served by the iterator"
+    },
+#endif
     {NULL, }
 };
 
@@ -527,6 +673,23 @@ static PyTypeObject LazyCSV_IterType = {
 };
 
 
+static inline int LazyCSV_AdviceFromString(char *access) {
+    if (!strcmp(access, "normal")) return MADV_NORMAL;
+    if (!strcmp(access, "sequential")) return MADV_SEQUENTIAL;
+    if (!strcmp(access, "random")) return MADV_RANDOM;
+    if (!strcmp(access, "willneed")) return MADV_WILLNEED;
+    return -1;
+}
+
+
+static inline int LazyCSV_IndexModeFromString(char *mode) {
+    if (!strcmp(mode, "flat")) return LAZYCSV_INDEX_FLAT;
+    if (!strcmp(mode, "compressed")) return LAZYCSV_INDEX_COMPRESSED;
+    if (!strcmp(mode, "rows")) return LAZYCSV_INDEX_ROWS;
+    return -1;
+}
+
+
 static inline void LazyCSV_TempDirAsString(PyObject **tempdir, char **dirname) {
     PyObject *tempfile = PyImport_ImportModule("tempfile");
     PyObject *tempdir_obj =
@@ -534,13 +697,14 @@ static inline void LazyCSV_TempDirAsString(PyObject **tempdir, char **dirname) {
 
     *tempdir = PyObject_CallObject(tempdir_obj, NULL);
     PyObject* dirname_obj = PyObject_GetAttrString(*tempdir, "name");
-    PyObject* dirstring = PyUnicode_AsUTF8String(dirname_obj);
-    *dirname = PyBytes_AsString(dirstring);
+
+    // the utf8 buffer is cached on the name, which lives as long as the
+    // TemporaryDirectory object it is an attribute of.
+    *dirname = (char*)PyUnicode_AsUTF8(dirname_obj);
 
     Py_DECREF(tempfile);
     Py_DECREF(tempdir_obj);
     Py_DECREF(dirname_obj);
-    Py_DECREF(dirstring);
 }
 
 
@@ -589,470 +753,413 @@ static inline void LazyCSV_FullNameFromName(PyObject *name,
 }
 
 
-static PyObject *LazyCSV_New(PyTypeObject *type, PyObject *args,
-                             PyObject *kwargs) {
+// constructor options, shared by every file of a LazyCSVDataset.
 
-    PyObject* name;
-    int skip_headers = 0;
-    int unquote = 1;
-    Py_ssize_t buffer_capacity = 2097152; // 2**21
-    char *dirname, *delimiter = ",", *quotechar = "\"";
+typedef struct {
+    LazyCSV_TableOptions table;
+    char* dirname;
+    PyObject* tempdir;
+    char* encoding;
+} LazyCSV_Options;
 
-    static char* kwlist[] = {
-        "", "delimiter", "quotechar", "skip_headers", "unquote", "buffer_size", "index_dir", NULL
-    };
 
-    char ok = PyArg_ParseTupleAndKeywords(
-        args, kwargs, "O|ssppns", kwlist, &name, &delimiter, &quotechar,
-        &skip_headers, &unquote, &buffer_capacity, &dirname);
+// state of a LazyCSV under construction. Construction is split into three
+// phases, LazyCSV_BuildPrepare and LazyCSV_BuildFinish hold the GIL, while
+// LazyCSV_BuildScan runs without it and only takes it back to read from a
+// stream, so that the files of a dataset can be scanned from several threads
+// at once.
+// Scan errors are recorded on the build and raised by LazyCSV_BuildRaise.
 
-    if (!ok) {
-        PyErr_SetString(
-            PyExc_ValueError,
-            "unable to parse function arguments"
-        );
-        return NULL;
-    }
+typedef struct {
+    LazyCSV_Options* options;
+    PyObject* fullname_obj;
+    char* fullname;
+    PyObject* stream;
+    PyObject* tempdir;
+    char* dirname;
+    LazyCSV_Table* table;
+    LazyCSV_Error error;
+    int failed;
+} LazyCSV_Build;
+
+
+static int LazyCSV_OptionsFromArgs(LazyCSV_Options *options, char *delimiter,
+                                   char *quotechar, Py_ssize_t buffer_capacity,
+                                   char *access, Py_ssize_t prefetch,
+                                   Py_ssize_t readahead, char *index_mode,
+                                   Py_ssize_t checkpoint_cols,
+                                   char *encoding) {
 
     if (buffer_capacity < 0) {
         PyErr_SetString(
             PyExc_ValueError,
             "buffer size cannot be less than 0"
         );
-        return NULL;
-    }
-
-    Py_INCREF(name);
-    if (PyUnicode_CheckExact(name)) {
-        PyObject* _name = PyUnicode_AsUTF8String(name);
-        Py_DECREF(name);
-        name = _name;
+        return -1;
     }
 
-    if (!PyBytes_CheckExact(name)) {
+    if (prefetch < 0) {
         PyErr_SetString(
             PyExc_ValueError,
-            "first argument must be str or bytes"
+            "prefetch cannot be less than 0"
         );
-        Py_DECREF(name);
-        return NULL;
+        return -1;
     }
 
-    PyObject* fullname_obj;
-    char* fullname;
-    LazyCSV_FullNameFromName(name, &fullname_obj, &fullname);
+    if (readahead < 0) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "readahead cannot be less than 0"
+        );
+        return -1;
+    }
 
-    Py_DECREF(name);
+    int advice = LazyCSV_AdviceFromString(access);
+    if (advice == -1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "access must be one of 'normal', 'sequential', 'random' or"
+            " 'willneed'"
+        );
+        return -1;
+    }
 
-    int ufd = open(fullname, O_RDONLY);
-    if (ufd == -1) {
+    int mode = LazyCSV_IndexModeFromString(index_mode);
+    if (mode == -1) {
         PyErr_SetString(
-            PyExc_FileNotFoundError,
-            "unable to open data file,"
-            " check to be sure that the user has read permissions"
-            " and/or ownership of the file, and that the file exists."
+            PyExc_ValueError,
+            "index_mode must be one of 'flat', 'compressed' or 'rows'"
         );
-        goto return_err;
+        return -1;
     }
 
-    struct stat ust;
-    if (fstat(ufd, &ust) < 0) {
+    if (checkpoint_cols < 0) {
         PyErr_SetString(
-            PyExc_RuntimeError,
-            "unable to stat user file"
+            PyExc_ValueError,
+            "checkpoint_cols cannot be less than 0"
         );
-        goto close_ufd;
+        return -1;
     }
 
-    size_t file_len = ust.st_size;
+    if (encoding && !PyCodec_KnownEncoding(encoding)) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "encoding must be the name of a codec known to python"
+        );
+        return -1;
+    }
 
-    int mmap_flags = PROT_READ;
-    char* file = mmap(NULL, file_len, mmap_flags, MAP_PRIVATE, ufd, 0);
+    options->table.delimiter = *delimiter;
+    options->table.quotechar = *quotechar;
+    options->table.buffer_capacity = buffer_capacity;
+    options->table.advice = advice;
+    options->table.prefetch = prefetch;
+    options->table.readahead = readahead;
+    options->table.index_mode = mode;
+    options->table.checkpoint_cols = checkpoint_cols;
+    options->tempdir = NULL;
+    options->encoding = encoding;
+
+    return 0;
+}
 
-    PyObject* tempdir = NULL;
-    if (!dirname) {
-        LazyCSV_TempDirAsString(&tempdir, &dirname);
-    }
 
-    char* comma_index = tempnam(dirname, "LzyC_");
-    char* anchor_index = tempnam(dirname, "LzyA_");
-    char* newline_index = tempnam(dirname, "LzyN_");
+static int LazyCSV_BuildPrepare(LazyCSV_Build *build, PyObject *name,
+                                LazyCSV_Options *options) {
 
-    int file_flags = O_WRONLY|O_CREAT|O_EXCL;
+    *build = (LazyCSV_Build){.options = options};
 
-    int comma_file = open(comma_index, file_flags, S_IRWXU);
-    int anchor_file = open(anchor_index, file_flags, S_IRWXU);
-    int newline_file = open(newline_index, file_flags, S_IRWXU);
+    Py_INCREF(name);
+    if (PyUnicode_CheckExact(name)) {
+        PyObject* _name = PyUnicode_AsUTF8String(name);
+        Py_DECREF(name);
+        name = _name;
+    }
 
-    char quoted = 0, c, cm1 = LINE_FEED, cm2 = 0;
-    size_t rows = 0, cols = SIZE_MAX, row_index = 0, col_index = 0;
+    if (PyBytes_CheckExact(name)) {
+        LazyCSV_FullNameFromName(name, &build->fullname_obj, &build->fullname);
+        Py_DECREF(name);
+    }
+    else if (PyObject_HasAttrString(name, "readinto")
+             || PyObject_HasAttrString(name, "read")) {
+        // non-seekable inputs are spooled into a data file next to the
+        // index files while they are being indexed.
+        build->stream = name;
+    }
+    else {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "first argument must be str, bytes or a binary file object"
+        );
+        Py_DECREF(name);
+        return -1;
+    }
 
-    int newline = -1;
+    if (options->dirname) {
+        build->dirname = options->dirname;
+        build->tempdir = options->tempdir;
+        Py_XINCREF(build->tempdir);
+    }
+    else {
+        LazyCSV_TempDirAsString(&build->tempdir, &build->dirname);
+    }
 
-    // overflow happens when a row has more columns than the header row,
-    // if this happens during the parse, the comma of the nth col will indicate
-    // the line ending. Underflow happens when a row has less columns than the
-    // header row, and missing values will be appended to the row as an empty
-    // field.
+    return 0;
+}
 
-    size_t overflow = SIZE_MAX;
-    char *overflow_warning = NULL, *underflow_warning = NULL;
 
-    LazyCSV_RowIndex ridx = {.index = 0, .count = 0};
+static ssize_t LazyCSV_StreamRead(void *context, char *data, size_t size) {
 
-    LazyCSV_AnchorPoint apnt;
+    // the LazyCSV_Reader of a python file object, called without the GIL,
+    // errors are left set on the interpreter.
 
-    LazyCSV_Buffer comma_buffer = {.data = malloc(buffer_capacity),
-                                   .size = 0,
-                                   .capacity = buffer_capacity};
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject* stream = (PyObject*)context;
+    PyObject* result = NULL;
+    Py_ssize_t read = -1;
 
-    LazyCSV_Buffer anchor_buffer = {.data = malloc(buffer_capacity),
-                                    .size = 0,
-                                    .capacity = buffer_capacity};
+    int readinto = PyObject_HasAttrString(stream, "readinto");
+    if (readinto) {
+        PyObject* view = PyMemoryView_FromMemory(data, size, PyBUF_WRITE);
+        if (view)
+            result = PyObject_CallMethod(stream, "readinto", "O", view);
+        Py_XDECREF(view);
+    }
+    else {
+        result = PyObject_CallMethod(stream, "read", "n", (Py_ssize_t)size);
+    }
 
-    LazyCSV_Buffer newline_buffer = {.data = malloc(buffer_capacity),
-                                     .size = 0,
-                                     .capacity = buffer_capacity};
+    // a non-blocking stream without data returns None, which mustn't be
+    // taken for the end of the stream
+    if (result == Py_None) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "stream must be blocking"
+        );
+    }
+    else if (result && readinto) {
+        read = PyLong_AsSsize_t(result);
+    }
+    else if (result && !PyBytes_Check(result)) {
+        PyErr_SetString(
+            PyExc_TypeError,
+            "stream must be opened in binary mode"
+        );
+    }
+    else if (result) {
+        read = PyBytes_GET_SIZE(result);
+        memcpy(data, PyBytes_AS_STRING(result), read);
+    }
 
-    for (size_t i = 0; i < file_len; i++) {
+    Py_XDECREF(result);
+    PyGILState_Release(gil);
+    return read;
+}
 
-        if (overflow != SIZE_MAX && i < overflow) {
-            continue;
-        }
 
-        c = file[i];
+static int LazyCSV_BuildScan(LazyCSV_Build *build) {
+    LazyCSV_TableOptions* options = &build->options->table;
 
-        if (col_index == 0
-            && (cm1 == LINE_FEED || cm1 == CARRIAGE_RETURN)
-            && cm2 != CARRIAGE_RETURN) {
-            size_t val = (
-                newline == (CARRIAGE_RETURN+LINE_FEED)
-            ) ? i + 1 : i;
+    build->table = build->stream
+        ? LazyCSV_TableIndexStream(LazyCSV_StreamRead, build->stream,
+                                   build->dirname, options, &build->error)
+        : LazyCSV_TableIndex(build->fullname, build->dirname, options,
+                             &build->error);
 
-            apnt = (LazyCSV_AnchorPoint){.value = val, .col = col_index};
+    if (!build->table) {
+        build->failed = 1;
+        return -1;
+    }
+    return 0;
+}
 
-            LazyCSV_BufferWrite(anchor_file, &anchor_buffer, &apnt,
-                                sizeof(LazyCSV_AnchorPoint));
 
-            ridx.index += ridx.count*sizeof(LazyCSV_AnchorPoint);
-            ridx.count = 1;
+static void LazyCSV_BuildRaise(LazyCSV_Build *build) {
+    // errors raised by a stream are left set on the interpreter
+    if (build->error.code != LAZYCSV_ERROR_READER)
+        LazyCSV_RaiseError(&build->error);
+    else if (!PyErr_Occurred())
+        PyErr_SetString(
+            PyExc_RuntimeError,
+            "unable to read data file"
+        );
+}
 
-            LazyCSV_ValueToDisk(val, &ridx, &apnt, col_index, comma_file,
-                                &comma_buffer, anchor_file, &anchor_buffer);
-        }
 
-        if (c == *quotechar) {
-            quoted = !quoted;
-        }
+static void LazyCSV_BuildCleanup(LazyCSV_Build *build) {
+    LazyCSV_TableClose(build->table);
 
-        else if (!quoted && c == *delimiter) {
-            size_t val = i + 1;
-            LazyCSV_ValueToDisk(val, &ridx, &apnt, col_index, comma_file,
-                                &comma_buffer, anchor_file, &anchor_buffer);
-            if (cols == SIZE_MAX || col_index < cols) {
-                col_index += 1;
-            }
-            else {
-                overflow_warning =
-                    "column overflow encountered while parsing CSV, "
-                    "extra values will be truncated!";
-                overflow = i;
-
-                for (;;) {
-                    if (file[overflow] == LINE_FEED ||
-                        file[overflow] == CARRIAGE_RETURN)
-                        break;
-                    else if (overflow >= file_len)
-                        break;
-                  overflow += 1;
-                }
-            }
-        }
+    Py_XDECREF(build->tempdir);
+    Py_XDECREF(build->fullname_obj);
+    Py_XDECREF(build->stream);
+}
 
-        else if (!quoted && c == LINE_FEED && cm1 == CARRIAGE_RETURN) {
-            // no-op, don't match next block for \r\n
-        }
 
-        else if (!quoted && (c == CARRIAGE_RETURN || c == LINE_FEED)) {
-            size_t val = i + 1;
+static PyObject *LazyCSV_FromTable(PyTypeObject *type, LazyCSV_Table *table,
+                                   PyObject *name, PyObject *dir,
+                                   const char *encoding) {
 
-            if (overflow == SIZE_MAX) {
-                LazyCSV_ValueToDisk(val, &ridx, &apnt, col_index, comma_file,
-                                    &comma_buffer, anchor_file, &anchor_buffer);
-            }
-            else {
-                overflow = SIZE_MAX;
-            }
+    // wraps an indexed table, taking over the table along with the references
+    // to its name and to the directory holding its index files.
 
-            if (row_index == 0) {
-                cols = col_index;
-            }
+    LazyCSV* self = (LazyCSV*)type->tp_alloc(type, 0);
+    if (!self) {
+        PyErr_SetString(
+            PyExc_MemoryError,
+            "unable to allocate LazyCSV object"
+        );
+        LazyCSV_TableClose(table);
+        Py_XDECREF(name);
+        Py_XDECREF(dir);
+        return NULL;
+    }
 
-            else if (col_index < cols) {
-                underflow_warning =
-                    "column underflow encountered while parsing CSV, "
-                    "missing values will be filled with the empty bytestring!";
-                while (col_index < cols) {
-                  LazyCSV_ValueToDisk(val, &ridx, &apnt, col_index, comma_file,
-                                      &comma_buffer, anchor_file,
-                                      &anchor_buffer);
-                  col_index += 1;
-                }
-            }
+    size_t cols = LazyCSV_TableCols(table);
 
-            if (newline == -1) {
-                newline = (c == CARRIAGE_RETURN && file[i + 1] == LINE_FEED)
-                              ? LINE_FEED + CARRIAGE_RETURN
-                              : c;
-            }
+    self->rows = LazyCSV_TableRows(table);
+    self->cols = cols;
+    self->name = name;
+    self->headers = PyTuple_New(table->skip_headers ? 0 : cols);
+    self->_dir = dir;
+    self->_table = table;
+    self->_cache = LazyCSV_CacheNew(encoding);
+
+    if (!self->headers || !self->_cache) {
+        Py_DECREF(self);
+        return NULL;
+    }
 
-            LazyCSV_BufferWrite(newline_file, &newline_buffer, &ridx,
-                                sizeof(LazyCSV_RowIndex));
+    // headers are read like any other row, the object has to exist first so
+    // that compressed headers can be read through its span.
 
-            col_index = 0;
-            row_index += 1;
-        }
+    double started = LazyCSV_Now();
 
-        cm2 = cm1;
-        cm1 = c;
+    if (!table->skip_headers) {
+        size_t offset, len;
+        for (size_t i = 0; i < cols; i++) {
+            LazyCSV_FieldFromIndex(table, 0, i, &offset, &len);
+            PyObject* header =
+                PyBytes_FromOffsetAndLen(self, &table->span, offset, len);
+            if (!header) {
+                Py_DECREF(self);
+                return NULL;
+            }
+            PyTuple_SET_ITEM(self->headers, i, header);
+        }
     }
 
-    char last_char = file[file_len - 1];
-    char overcount = last_char == CARRIAGE_RETURN || last_char == LINE_FEED;
+    self->_headers_seconds = LazyCSV_Now() - started;
 
-    if (!overcount) {
-        LazyCSV_ValueToDisk(file_len + 1, &ridx, &apnt, col_index, comma_file,
-                            &comma_buffer, anchor_file, &anchor_buffer);
+    return (PyObject*)self;
+}
 
-        LazyCSV_BufferWrite(newline_file, &newline_buffer, &ridx,
-                            sizeof(LazyCSV_RowIndex));
-    }
 
-    if (overflow_warning)
+static PyObject *LazyCSV_BuildFinish(PyTypeObject *type,
+                                     LazyCSV_Build *build) {
+
+    LazyCSV_Table* table = build->table;
+    int warnings = LazyCSV_TableWarnings(table);
+
+    if (warnings & LAZYCSV_WARN_OVERFLOW)
         PyErr_WarnEx(
             PyExc_RuntimeWarning,
-            overflow_warning,
+            "column overflow encountered while parsing CSV, "
+            "extra values will be truncated!",
             1
         );
 
-    if (underflow_warning)
+    if (warnings & LAZYCSV_WARN_UNDERFLOW)
         PyErr_WarnEx(
             PyExc_RuntimeWarning,
-            underflow_warning,
+            "column underflow encountered while parsing CSV, "
+            "missing values will be filled with the empty bytestring!",
             1
         );
 
-    rows = row_index - overcount + skip_headers;
-    cols = cols + 1;
-
-    LazyCSV_BufferFlush(comma_file, &comma_buffer);
-    LazyCSV_BufferFlush(anchor_file, &anchor_buffer);
-    LazyCSV_BufferFlush(newline_file, &newline_buffer);
-
-    close(comma_file);
-    close(anchor_file);
-    close(newline_file);
-
-    free(comma_buffer.data);
-    free(anchor_buffer.data);
-    free(newline_buffer.data);
-
-    int comma_fd = open(comma_index, O_RDWR);
-    struct stat comma_st;
-    if (fstat(comma_fd, &comma_st) < 0) {
-        PyErr_SetString(
-            PyExc_RuntimeError,
-            "unable to stat comma file"
-        );
-        goto close_comma;
+    if (build->stream) {
+        build->fullname_obj =
+            PyBytes_FromString(LazyCSV_TableDataName(table));
+        build->fullname = PyBytes_AsString(build->fullname_obj);
     }
 
-    int anchor_fd = open(anchor_index, O_RDWR);
-    struct stat anchor_st;
-    if (fstat(anchor_fd, &anchor_st) < 0) {
-        PyErr_SetString(
-            PyExc_RuntimeError,
-            "unable to stat anchor file"
-        );
-        goto close_anchor;
-    }
+    Py_XDECREF(build->stream);
 
-    int newline_fd = open(newline_index, O_RDWR);
-    struct stat newline_st;
-    if (fstat(newline_fd, &newline_st) < 0) {
-        PyErr_SetString(
-            PyExc_RuntimeError,
-            "unable to stat newline file"
-        );
-        goto close_newline;
-    }
+    return LazyCSV_FromTable(type, table, build->fullname_obj,
+                             build->tempdir, build->options->encoding);
+}
 
-    char *comma_memmap =
-        mmap(NULL, comma_st.st_size, mmap_flags, MAP_PRIVATE, comma_fd, 0);
-    char *anchor_memmap =
-        mmap(NULL, anchor_st.st_size, mmap_flags, MAP_PRIVATE, anchor_fd, 0);
-    char *newline_memmap =
-        mmap(NULL, newline_st.st_size, mmap_flags, MAP_PRIVATE, newline_fd, 0);
 
-    PyObject* headers;
+static PyObject *LazyCSV_New(PyTypeObject *type, PyObject *args,
+                             PyObject *kwargs) {
 
-    if (!skip_headers) {
-        headers = PyTuple_New(cols);
-        LazyCSV_RowIndex* ridx = (LazyCSV_RowIndex*)newline_memmap;
+    PyObject* name;
+    LazyCSV_Options options = {.dirname = NULL};
+    LazyCSV_TableOptionsInit(&options.table);
+
+    Py_ssize_t buffer_capacity = options.table.buffer_capacity;
+    Py_ssize_t prefetch = 0;
+    Py_ssize_t readahead = 0;
+    Py_ssize_t checkpoint_cols = 0;
+    char *delimiter = ",", *quotechar = "\"";
+    char *access = "normal";
+    char *index_mode = "flat";
+    char *encoding = NULL;
 
-        size_t cs, ce;
-        size_t len;
-        char *addr;
-        for (size_t i = 0; i < cols; i++) {
-            cs = LazyCSV_ValueFromIndex(i, ridx, comma_memmap, anchor_memmap);
-            ce = LazyCSV_ValueFromIndex(i + 1, ridx, comma_memmap,
-                                        anchor_memmap);
+    static char* kwlist[] = {
+        "", "delimiter", "quotechar", "skip_headers", "unquote", "buffer_size",
+        "index_dir", "access", "populate", "hugepages", "prefetch",
+        "readahead", "index_mode", "checkpoint_cols", "encoding", NULL
+    };
 
-            if (ce - cs == 1) {
-                PyTuple_SET_ITEM(headers, i, PyBytes_FromString(""));
-            }
-            else {
-                addr = file + cs;
-
-                len = ce - cs - 1;
-                if (unquote
-                        && addr[0] == *quotechar
-                        && addr[len-1] == *quotechar) {
-                    addr = addr+1;
-                    len = len-2;
-                }
-                PyTuple_SET_ITEM(
-                    headers, i, PyBytes_FromStringAndSize(addr, len)
-                );
-            }
-        }
-    }
-    else {
-        headers = PyTuple_New(0);
-    }
+    char ok = PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|ssppnssppnnsnz", kwlist, &name, &delimiter,
+        &quotechar, &options.table.skip_headers, &options.table.unquote,
+        &buffer_capacity, &options.dirname, &access, &options.table.populate,
+        &options.table.hugepages, &prefetch, &readahead, &index_mode,
+        &checkpoint_cols, &encoding);
 
-    LazyCSV* self = (LazyCSV*)type->tp_alloc(type, 0);
-    if (!self) {
+    if (!ok) {
         PyErr_SetString(
-            PyExc_MemoryError,
-            "unable to allocate LazyCSV object"
+            PyExc_ValueError,
+            "unable to parse function arguments"
         );
-        goto unmap_memmaps;
+        return NULL;
     }
 
-    LazyCSV_Cache* _cache = malloc(sizeof(LazyCSV_Cache));
-    _cache->empty = PyBytes_FromString("");
-    _cache->items = malloc(UCHAR_MAX*sizeof(PyObject*));
-
-    for (size_t i = 0; i < UCHAR_MAX; i++)
-        _cache->items[i] = PyBytes_FromFormat("%c", (int)i);
-
-    LazyCSV_File* _commas = malloc(sizeof(LazyCSV_File));
-    _commas->name = comma_index;
-    _commas->data = comma_memmap;
-    _commas->st = comma_st;
-    _commas->fd = comma_fd;
-
-    LazyCSV_File* _anchors = malloc(sizeof(LazyCSV_File));
-    _anchors->name = anchor_index;
-    _anchors->data = anchor_memmap;
-    _anchors->st = anchor_st;
-    _anchors->fd = anchor_fd;
-
-    LazyCSV_File* _newlines = malloc(sizeof(LazyCSV_File));
-    _newlines->name = newline_index;
-    _newlines->data = newline_memmap;
-    _newlines->st = newline_st;
-    _newlines->fd = newline_fd;
-
-    LazyCSV_Index* _index = malloc(sizeof(LazyCSV_Index));
-
-    _index->dir = tempdir;
-    _index->commas = _commas;
-    _index->newlines = _newlines;
-    _index->anchors = _anchors;
-
-    LazyCSV_File* _data = malloc(sizeof(LazyCSV_File));
-    _data->name = fullname;
-    _data->fd = ufd;
-    _data->data = file;
-    _data->st = ust;
-
-    self->rows = rows;
-    self->cols = cols;
-    self->name = fullname_obj;
-    self->headers = headers;
-    self->_skip_headers = skip_headers;
-    self->_unquote = unquote;
-    self->_quotechar = *quotechar;
-    self->_newline = newline;
-    self->_index = _index;
-    self->_data = _data;
-    self->_cache = _cache;
-
-    return (PyObject*)self;
-
-unmap_memmaps:
-    munmap(comma_memmap, comma_st.st_size);
-    munmap(anchor_memmap, anchor_st.st_size);
-    munmap(newline_memmap, newline_st.st_size);
-    Py_DECREF(headers);
-
-close_newline:
-    close(newline_fd);
+    if (LazyCSV_OptionsFromArgs(&options, delimiter, quotechar,
+                                buffer_capacity, access, prefetch,
+                                readahead, index_mode, checkpoint_cols,
+                                encoding) < 0)
+        return NULL;
 
-close_anchor:
-    close(anchor_fd);
+    LazyCSV_Build build;
+    if (LazyCSV_BuildPrepare(&build, name, &options) < 0)
+        return NULL;
 
-close_comma:
-    close(comma_fd);
-    munmap(file, ust.st_size);
-    Py_XDECREF(tempdir);
+    int scanned;
+    Py_BEGIN_ALLOW_THREADS
+    scanned = LazyCSV_BuildScan(&build);
+    Py_END_ALLOW_THREADS
 
-close_ufd:
-    close(ufd);
+    if (scanned < 0) {
+        LazyCSV_BuildRaise(&build);
+        LazyCSV_BuildCleanup(&build);
+        return NULL;
+    }
 
-return_err:
-    return NULL;
+    return LazyCSV_BuildFinish(type, &build);
 }
 
 
 static void LazyCSV_Destruct(LazyCSV* self) {
-    munmap(self->_data->data, self->_data->st.st_size);
-    munmap(self->_index->commas->data, self->_index->commas->st.st_size);
-    munmap(self->_index->anchors->data, self->_index->anchors->st.st_size);
-    munmap(self->_index->newlines->data, self->_index->newlines->st.st_size);
-
-    close(self->_data->fd);
-    close(self->_index->commas->fd);
-    close(self->_index->anchors->fd);
-    close(self->_index->newlines->fd);
-
-    remove(self->_index->commas->name);
-    remove(self->_index->anchors->name);
-    remove(self->_index->newlines->name);
+    // the index files are removed before the directory holding them
+    LazyCSV_TableClose(self->_table);
+    Py_XDECREF(self->_dir);
 
-    free(self->_index->commas->name);
-    free(self->_index->anchors->name);
-    free(self->_index->newlines->name);
+    LazyCSV_CacheFree(self->_cache);
 
-    free(self->_index->commas);
-    free(self->_index->anchors);
-    free(self->_index->newlines);
-
-    Py_XDECREF(self->_index->dir);
-
-    Py_DECREF(self->_cache->empty);
-    for (size_t i = 0; i < UCHAR_MAX; i++)
-        Py_DECREF(self->_cache->items[i]);
-    free(self->_cache->items);
-
-    free(self->_data);
-    free(self->_index);
-    free(self->_cache);
-
-    Py_DECREF(self->headers);
-    Py_DECREF(self->name);
+    Py_XDECREF(self->headers);
+    Py_XDECREF(self->name);
 
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
@@ -1063,12 +1170,13 @@ static PyObject *LazyCSV_Seq(PyObject *self, PyObject *args, PyObject *kwargs) {
     size_t row = SIZE_MAX;
     size_t col = SIZE_MAX;
     size_t stop;
-    char reversed;
+    char reversed = 0;
+    Py_ssize_t prefetch = -1;
 
-    static char *kwlist[] = {"row", "col", "reversed", NULL};
+    static char *kwlist[] = {"row", "col", "reversed", "prefetch", NULL};
 
     char ok = PyArg_ParseTupleAndKeywords(
-        args, kwargs, "|nnb", kwlist, &row, &col, &reversed
+        args, kwargs, "|nnbn", kwlist, &row, &col, &reversed, &prefetch
     );
 
     if (!ok) {
@@ -1120,24 +1228,34 @@ static PyObject *LazyCSV_Seq(PyObject *self, PyObject *args, PyObject *kwargs) {
         return NULL;
     }
 
-    iter->row = row;
-    iter->col = col;
-    iter->reversed = reversed;
-    iter->position = 0;
-    iter->step = 1;
-    iter->stop = stop;
+    LazyCSV_Table* table = ((LazyCSV*)self)->_table;
+
+    iter->state.table = table;
+    iter->state.row = row;
+    iter->state.col = col;
+    iter->state.reversed = reversed;
+    iter->state.position = 0;
+    iter->state.step = 1;
+    iter->state.stop = stop;
+    iter->state.prefetch =
+        prefetch < 0 ? table->prefetch : (size_t)prefetch;
     iter->lazy = self;
+    LazyCSV_IterColCache(&iter->state);
 
     Py_INCREF(self);
 
+    LAZYCSV_PROBE3(iter__new, row, col, stop);
     return (PyObject*)iter;
 }
 
 
 static PyObject* LazyCSV_GetValue(PyObject* self, PyObject* r, PyObject* c) {
 
-    Py_ssize_t _row = PyLong_AsSsize_t(r);
-    Py_ssize_t _col = PyLong_AsSsize_t(c);
+    Py_ssize_t _row = PyNumber_AsSsize_t(r, NULL);
+    Py_ssize_t _col = PyNumber_AsSsize_t(c, NULL);
+
+    if ((_row == -1 || _col == -1) && PyErr_Occurred())
+        return NULL;
 
     LazyCSV* lazy = (LazyCSV*)self;
 
@@ -1160,25 +1278,19 @@ static PyObject* LazyCSV_GetValue(PyObject* self, PyObject* r, PyObject* c) {
         return NULL;
     }
 
-    row += !lazy->_skip_headers;
+    row += !lazy->_table->skip_headers;
 
-    char* newlines = lazy->_index->newlines->data;
-    char* anchors = lazy->_index->anchors->data;
-    char* commas = lazy->_index->commas->data;
-
-    LazyCSV_RowIndex* ridx =
-        (LazyCSV_RowIndex*)
-        (newlines + row*sizeof(LazyCSV_RowIndex));
-
-    char* aidx = anchors+ridx->index;
-    char* cidx = commas+((lazy->cols+1)*row*sizeof(INDEX_DTYPE));
-
-    size_t cs = LazyCSV_ValueFromIndex((size_t)col, ridx, cidx, aidx);
-    size_t ce = LazyCSV_ValueFromIndex((size_t)col + 1, ridx, cidx, aidx);
+    size_t offset, len;
+    PyObject* result;
 
-    size_t len = ce - cs - 1;
+    Py_BEGIN_CRITICAL_SECTION(self);
+    LazyCSV_FieldFromIndex(lazy->_table, row, col, &offset, &len);
+    LAZYCSV_COUNT(&lazy->_table->counters, len);
+    result =
+        PyBytes_FromOffsetAndLen(lazy, &lazy->_table->span, offset, len);
+    Py_END_CRITICAL_SECTION();
 
-    return PyBytes_FromOffsetAndLen(lazy, cs, len);
+    return result;
 }
 
 
@@ -1201,7 +1313,8 @@ static PyObject* LazyCSV_GetItem(PyObject* self, PyObject* key) {
         return NULL;
     }
 
-    if (PyLong_Check(row_obj) && PyLong_Check(col_obj))
+    // numpy integers, such as the rows returned by argsort, index like ints
+    if (PyIndex_Check(row_obj) && PyIndex_Check(col_obj))
         return LazyCSV_GetValue(self, row_obj, col_obj);
 
     int row_is_slice = PySlice_Check(row_obj);
@@ -1254,15 +1367,19 @@ static PyObject* LazyCSV_GetItem(PyObject* self, PyObject* key) {
         LazyCSV_Iter* iter = (LazyCSV_Iter*)type->tp_alloc(type, 0);
         if (!iter) goto memory_err;
 
-        iter->row = SIZE_MAX;
-        iter->col = col;
-        iter->reversed = reversed;
-        iter->position = start;
-        iter->step = step;
-        iter->stop = stop;
+        iter->state.table = lazy->_table;
+        iter->state.row = SIZE_MAX;
+        iter->state.col = col;
+        iter->state.reversed = reversed;
+        iter->state.position = start;
+        iter->state.step = step;
+        iter->state.stop = stop;
+        iter->state.prefetch = lazy->_table->prefetch;
         iter->lazy = self;
+        LazyCSV_IterColCache(&iter->state);
         Py_INCREF(self);
 
+        LAZYCSV_PROBE3(iter__new, iter->state.row, iter->state.col, stop);
         return (PyObject*)iter;
     }
 
@@ -1311,15 +1428,18 @@ static PyObject* LazyCSV_GetItem(PyObject* self, PyObject* key) {
         LazyCSV_Iter* iter = (LazyCSV_Iter*)type->tp_alloc(type, 0);
         if (!iter) goto memory_err;
 
-        iter->row = row;
-        iter->col = SIZE_MAX;
-        iter->reversed = reversed;
-        iter->position = start;
-        iter->step = step;
-        iter->stop = stop;
+        iter->state.table = lazy->_table;
+        iter->state.row = row;
+        iter->state.col = SIZE_MAX;
+        iter->state.reversed = reversed;
+        iter->state.position = start;
+        iter->state.step = step;
+        iter->state.stop = stop;
+        iter->state.prefetch = lazy->_table->prefetch;
         iter->lazy = self;
         Py_INCREF(self);
 
+        LAZYCSV_PROBE3(iter__new, iter->state.row, iter->state.col, stop);
         return (PyObject*)iter;
     }
 
@@ -1357,105 +1477,2243 @@ static PyMemberDef LazyCSV_Members[] = {
 };
 
 
-static PyMethodDef LazyCSV_Methods[] = {
-    {
-        "sequence",
-        (PyCFunction)LazyCSV_Seq,
-        METH_VARARGS|METH_KEYWORDS,
-        "get column iterator"
-    },
-    {NULL, }
-};
+static PyObject* LazyCSV_Stats(PyObject* self) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    LazyCSV_TableStats stats;
+    LazyCSV_TableStatsGet(lazy->_table, &stats);
+
+    PyObject* result = Py_BuildValue(
+        "{s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:d,s:d,s:d,s:d}",
+        "data_bytes", (Py_ssize_t)stats.data_bytes,
+        "comma_bytes", (Py_ssize_t)stats.comma_bytes,
+        "anchor_bytes", (Py_ssize_t)stats.anchor_bytes,
+        "newline_bytes", (Py_ssize_t)stats.newline_bytes,
+        "checkpoint_bytes", (Py_ssize_t)stats.checkpoint_bytes,
+        "anchors", (Py_ssize_t)stats.anchors,
+        "max_row_anchors", (Py_ssize_t)stats.max_row_anchors,
+        "overflow_rows", (Py_ssize_t)stats.overflow_rows,
+        "underflow_rows", (Py_ssize_t)stats.underflow_rows,
+        "escaped_quotes", (Py_ssize_t)stats.escaped_quotes,
+        "scan_seconds", stats.scan_seconds,
+        "flush_seconds", stats.flush_seconds,
+        "mmap_seconds", stats.map_seconds,
+        "headers_seconds", lazy->_headers_seconds
+    );
 
-static PyMappingMethods LazyCSV_MappingMembers[] = {
-    (lenfunc)NULL,
-    (binaryfunc)LazyCSV_GetItem,
-    (objobjargproc)NULL,
-};
+#if INCLUDE_COUNTERS
+    if (result) {
+        PyObject* values = PyLong_FromSize_t(stats.values_served);
+        PyObject* bytes = PyLong_FromSize_t(stats.bytes_served);
+        if (!values || !bytes
+            || PyDict_SetItemString(result, "values_served", values) < 0
+            || PyDict_SetItemString(result, "bytes_served", bytes) < 0)
+            Py_CLEAR(result);
+        Py_XDECREF(values);
+        Py_XDECREF(bytes);
+    }
+#endif
 
-PyDoc_STRVAR(
-    LazyCSV_Docstring,
-    "lazycsv.LazyCSV(\n"
-    "    filepath,\n"
-    "    /\n"
-    "    delimiter: str=',',\n"
-    "    quotechar: str='\"',\n"
-    "    unquote: bool=True,\n"
-    "    skip_headers: bool=False,\n"
-    "    buffer_size: int=2**21,\n"
-    "    index_dir: str=None,\n"
-    ")\n"
-    "\n"
-    "LazyCSV object constructor. Takes the filepath of a CSV\n"
-    "file as the first argument, and several keyword arguments\n"
-    "as optional values. Indexes the CSV, generates headers,\n"
-    "and returns `self` to the caller."
-    "\n\n"
-    "Options\n"
-    "-------\n"
-    "delimiter: ',' -- character used to demarcate the separation\n"
-    "    of two fields. Should only be a single char.\n"
-    "quotechar: '\"' -- character used to ensure contents belong\n"
-    "    to a single field. Should only be a single char.\n"
-    "unquote: bool=True -- if True, a quoted field will be\n"
-    "    stripped of quotes on parsing. i.e. `,\"goo\\nbar\",`\n"
-    "    will return 'goo\\nbar'.\n"
-    "skip_headers: bool=False -- skips parsing out header\n"
-    "    values to the .header attribute if True.\n"
-    "buffer_size: int=2**21 -- is the buffer size that LazyCSV\n"
-    "    uses when writing index data to disk during object\n"
-    "    construction, can be set to any value greater than 0\n"
-    "    (units of bytes).\n"
-    "index_dir: str=None -- Directory where index files\n"
-    "    are saved. By default uses Python's `TemporaryDirectory()`\n"
-    "    function in the `tempfile` module.\n"
-    "\n"
-    "Returns\n"
-    "-------\n"
-    "self\n"
+    return result;
+}
 
-);
 
+static PyObject* LazyCSV_Share(PyObject* self) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    LazyCSV_TableShare share;
+    LazyCSV_TableShareGet(lazy->_table, &share);
+
+    return Py_BuildValue(
+        "(Oyyyyy(nnnnn)nnnnniiiiicccz)",
+        lazy->name,
+        share.data_name,
+        share.comma_name,
+        share.anchor_name,
+        share.newline_name,
+        share.checkpoint_name,
+        (Py_ssize_t)share.data_bytes,
+        (Py_ssize_t)share.comma_bytes,
+        (Py_ssize_t)share.anchor_bytes,
+        (Py_ssize_t)share.newline_bytes,
+        (Py_ssize_t)share.checkpoint_bytes,
+        (Py_ssize_t)share.rows,
+        (Py_ssize_t)share.cols,
+        (Py_ssize_t)share.checkpoint_cols,
+        (Py_ssize_t)share.prefetch,
+        (Py_ssize_t)share.escaped_quotes,
+        share.skip_headers,
+        share.unquote,
+        share.index_mode,
+        share.codec,
+        share.warnings,
+        share.delimiter,
+        share.quotechar,
+        share.newline,
+        lazy->_cache->encoding
+    );
+}
 
-static PyTypeObject LazyCSVType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "lazycsv.LazyCSV",
-    .tp_doc = LazyCSV_Docstring,
-    .tp_basicsize = sizeof(LazyCSV),
-    .tp_dealloc = (destructor)LazyCSV_Destruct,
-    .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
-    .tp_methods = LazyCSV_Methods,
-    .tp_members = LazyCSV_Members,
-    .tp_as_mapping = LazyCSV_MappingMembers,
-    .tp_new = LazyCSV_New,
-};
 
+static PyObject* LazyCSV_Attach(PyObject* type, PyObject* arg) {
+    PyObject *name, *checkpoint;
+    LazyCSV_TableShare share;
+    char *encoding = NULL;
+    Py_ssize_t sizes[5] = {0}, rows = 0, cols = 0, checkpoint_cols = 0;
+    Py_ssize_t prefetch = 0, escaped_quotes = 0;
+
+    char ok = PyTuple_Check(arg) && PyArg_ParseTuple(
+        arg, "OyyyyO(nnnnn)nnnnniiiiicccz", &name, &share.data_name,
+        &share.comma_name, &share.anchor_name, &share.newline_name,
+        &checkpoint, &sizes[0], &sizes[1], &sizes[2], &sizes[3],
+        &sizes[4], &rows, &cols, &checkpoint_cols, &prefetch,
+        &escaped_quotes, &share.skip_headers, &share.unquote,
+        &share.index_mode, &share.codec, &share.warnings, &share.delimiter,
+        &share.quotechar, &share.newline, &encoding);
+
+    // compressed data has a checkpoint file, otherwise it's None
+    share.checkpoint_name = NULL;
+    if (ok && checkpoint != Py_None)
+        ok = (share.checkpoint_name = PyBytes_AsString(checkpoint)) != NULL;
+
+    char negative = rows < 0 || cols < 0 || checkpoint_cols < 0
+        || prefetch < 0 || escaped_quotes < 0;
+    for (size_t i = 0; ok && i < 5; i++)
+        negative |= sizes[i] < 0;
+
+    if (!ok || negative) {
+        PyErr_Clear();
+        PyErr_SetString(
+            PyExc_ValueError,
+            "argument must be a tuple returned by LazyCSV.share()"
+        );
+        return NULL;
+    }
 
-static PyModuleDef LazyCSVModule = {
-    PyModuleDef_HEAD_INIT,
-    "lazycsv",
-    "module for custom lazycsv object",
-    -1,
-    NULL
-};
+    share.data_bytes = sizes[0];
+    share.comma_bytes = sizes[1];
+    share.anchor_bytes = sizes[2];
+    share.newline_bytes = sizes[3];
+    share.checkpoint_bytes = sizes[4];
+    share.rows = rows;
+    share.cols = cols;
+    share.checkpoint_cols = checkpoint_cols;
+    share.prefetch = prefetch;
+    share.escaped_quotes = escaped_quotes;
+
+    LazyCSV_Error error;
+    LazyCSV_Table* table = LazyCSV_TableAttach(&share, NULL, &error);
+    if (!table) {
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
 
+    // the directory holding the index files stays with the object sharing it
+    Py_INCREF(name);
+    return LazyCSV_FromTable((PyTypeObject*)type, table, name, NULL,
+                             encoding);
+}
 
-PyMODINIT_FUNC PyInit_lazycsv() {
-#if INCLUDE_NUMPY
-    import_array();
+
+static PyObject* LazyCSV_Reduce(PyObject* self) {
+    PyObject* attach =
+        PyObject_GetAttrString((PyObject*)Py_TYPE(self), "attach");
+    if (!attach)
+        return NULL;
+
+    PyObject* share = LazyCSV_Share(self);
+    if (!share) {
+        Py_DECREF(attach);
+        return NULL;
+    }
+
+    return Py_BuildValue("(N(N))", attach, share);
+}
+
+
+static PyObject* LazyCSV_BuildKeyIndex(PyObject* self, PyObject* arg) {
+    LazyCSV* lazy = (LazyCSV*)self;
+
+    Py_ssize_t _col = PyLong_AsSsize_t(arg);
+    if (_col == -1 && PyErr_Occurred())
+        return NULL;
+    size_t col = _col < 0 ? lazy->cols + _col : (size_t)_col;
+
+    LazyCSV_Error error;
+    int result;
+
+    // adds to the table's key indexes, so the GIL is kept
+    Py_BEGIN_CRITICAL_SECTION(self);
+    result = LazyCSV_TableKeyIndex(lazy->_table, col, &error);
+    Py_END_CRITICAL_SECTION();
+
+    if (result < 0) {
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static int LazyCSV_IndicesFromObject(PyObject *obj, size_t len,
+                                     size_t **indices, size_t *count);
+
+
+static PyObject* LazyCSV_CacheColumns(PyObject* self, PyObject* args,
+                                      PyObject* kwargs) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    PyObject* cols_obj = Py_None;
+    int numeric = 0;
+
+    static char* kwlist[] = {"cols", "numeric", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Op", kwlist, &cols_obj,
+                                     &numeric))
+        return NULL;
+
+    size_t *cols, count;
+    if (LazyCSV_IndicesFromObject(cols_obj, lazy->cols, &cols, &count) < 0)
+        return NULL;
+    count = cols ? count : lazy->cols;
+
+    LazyCSV_Error error;
+    int result = 0;
+
+    // adds to the table's caches, so the GIL is kept
+    Py_BEGIN_CRITICAL_SECTION(self);
+    for (size_t i = 0; result == 0 && i < count; i++)
+        result = LazyCSV_TableCacheColumn(lazy->_table, cols ? cols[i] : i,
+                                          numeric, &error);
+    Py_END_CRITICAL_SECTION();
+
+    free(cols);
+
+    if (result < 0) {
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject* LazyCSV_Lookup(PyObject* self, PyObject* args) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    Py_ssize_t _col;
+    PyObject *key, *encoded = NULL;
+
+    if (!PyArg_ParseTuple(args, "nO", &_col, &key))
+        return NULL;
+    size_t col = _col < 0 ? lazy->cols + _col : (size_t)_col;
+
+    // str keys are encoded as values are decoded, utf-8 by default
+    if (PyUnicode_Check(key)) {
+        const char* encoding = lazy->_cache->encoding;
+        encoded = PyUnicode_AsEncodedString(
+            key, encoding ? encoding : "utf-8", "strict");
+        if (!encoded)
+            return NULL;
+    }
+    else if (!PyBytes_Check(key)) {
+        PyErr_SetString(
+            PyExc_TypeError,
+            "key must be bytes or str"
+        );
+        return NULL;
+    }
+
+    PyObject* bytes = encoded ? encoded : key;
+    LazyCSV_Error error;
+    size_t row;
+    int found;
+
+    Py_BEGIN_CRITICAL_SECTION(self);
+    found = LazyCSV_TableLookup(lazy->_table, col, PyBytes_AS_STRING(bytes),
+                                PyBytes_GET_SIZE(bytes), &row, &error);
+    Py_END_CRITICAL_SECTION();
+
+    Py_XDECREF(encoded);
+
+    if (found < 0) {
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+    if (!found) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return PyLong_FromSize_t(row);
+}
+
+
+static PyObject* LazyCSV_Argsort(PyObject* self, PyObject* args,
+                                 PyObject* kwargs) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    Py_ssize_t _col, threads = 1;
+    int numeric = 0;
+
+    static char* kwlist[] = {"", "numeric", "threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|pn", kwlist, &_col,
+                                     &numeric, &threads))
+        return NULL;
+
+    if (threads < 1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "threads cannot be less than 1"
+        );
+        return NULL;
+    }
+
+    size_t col = _col < 0 ? lazy->cols + _col : (size_t)_col;
+    size_t rows = LazyCSV_TableRows(lazy->_table);
+
+    // row numbers are written straight into the result, which is an intp
+    // array when built with numpy and a list otherwise.
+
+#if INCLUDE_NUMPY
+    npy_intp const dimensions[1] = {rows, };
+    PyObject* result = PyArray_SimpleNew(1, dimensions, NPY_INTP);
+    size_t* order = result ? PyArray_DATA((PyArrayObject*)result) : NULL;
+#else
+    PyObject* result = PyList_New(rows);
+    size_t* order = result ? malloc((rows ? rows : 1)*sizeof(size_t)) : NULL;
+#endif
+
+    if (!result)
+        return NULL;
+    if (!order) {
+        Py_DECREF(result);
+        return PyErr_NoMemory();
+    }
+
+    LazyCSV_Error error;
+    int failed;
+
+    Py_BEGIN_ALLOW_THREADS
+    failed = LazyCSV_TableArgsort(lazy->_table, col, numeric, threads, order,
+                                  &error);
+    Py_END_ALLOW_THREADS
+
+#if !INCLUDE_NUMPY
+    for (size_t i = 0; !failed && i < rows; i++) {
+        PyObject* row = PyLong_FromSize_t(order[i]);
+        if (!row) {
+            Py_CLEAR(result);
+            break;
+        }
+        PyList_SET_ITEM(result, i, row);
+    }
+    free(order);
+#endif
+
+    if (failed) {
+        Py_XDECREF(result);
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+    return result;
+}
+
+
+// group keys are an object array when built with numpy and a list otherwise,
+// each key converted as values are, and aggregates are int64 or float64
+// arrays or lists.
+// `order` is the order of the groups, or NULL for their order of appearance.
+
+static PyObject* LazyCSV_GroupKeys(LazyCSV *lazy, LazyCSV_Groups *groups,
+                                   size_t *order) {
+
+    // keys are already unescaped, and are otherwise converted as values are,
+    // into an object array which starts out filled with NULL.
+#if INCLUDE_NUMPY
+    npy_intp const dimensions[1] = {groups->count, };
+    PyObject* result = PyArray_SimpleNew(1, dimensions, NPY_OBJECT);
+    PyObject** data = result ? PyArray_DATA((PyArrayObject*)result) : NULL;
+#else
+    PyObject* result = PyList_New(groups->count);
+#endif
+
+    LazyCSV_Cache* cache = lazy->_cache;
+    for (size_t i = 0; result && i < groups->count; i++) {
+        LazyCSV_Group* group = groups->groups + (order ? order[i] : i);
+        PyObject* key = !group->len ? cache->empty
+            : group->len == 1 ? cache->items[(unsigned char)*group->key]
+            : NULL;
+        if (key)
+            Py_INCREF(key);
+        else
+            key = LazyCSV_Decode(cache, group->key, group->len);
+        if (!key) {
+            Py_CLEAR(result);
+            break;
+        }
+#if INCLUDE_NUMPY
+        data[i] = key;
+#else
+        PyList_SET_ITEM(result, i, key);
+#endif
+    }
+    return result;
+}
+
+
+#define LAZYCSV_AGG_ROWS 0
+#define LAZYCSV_AGG_COUNT 1
+#define LAZYCSV_AGG_SUM 2
+#define LAZYCSV_AGG_MEAN 3
+#define LAZYCSV_AGG_MIN 4
+#define LAZYCSV_AGG_MAX 5
+
+static const char* LAZYCSV_AGG_NAMES[] = {
+    "rows", "count", "sum", "mean", "min", "max", NULL
+};
+
+
+static PyObject* LazyCSV_GroupAgg(LazyCSV_Groups *groups, size_t *order,
+                                  int agg) {
+
+    int integral = agg == LAZYCSV_AGG_ROWS || agg == LAZYCSV_AGG_COUNT;
+
+#if INCLUDE_NUMPY
+    npy_intp const dimensions[1] = {groups->count, };
+    PyObject* result = PyArray_SimpleNew(
+        1, dimensions, integral ? NPY_INT64 : NPY_FLOAT64);
+    if (!result)
+        return NULL;
+    int64_t* integers = PyArray_DATA((PyArrayObject*)result);
+    double* floats = PyArray_DATA((PyArrayObject*)result);
+#else
+    PyObject* result = PyList_New(groups->count);
+    if (!result)
+        return NULL;
+#endif
+
+    // groups without numbers have a nan mean, min and max
+    for (size_t i = 0; i < groups->count; i++) {
+        LazyCSV_Group* group = groups->groups + (order ? order[i] : i);
+        size_t integer = agg == LAZYCSV_AGG_ROWS ? group->rows : group->count;
+        double value =
+            agg == LAZYCSV_AGG_SUM ? group->sum
+            : !group->count ? NAN
+            : agg == LAZYCSV_AGG_MEAN ? group->sum / group->count
+            : agg == LAZYCSV_AGG_MIN ? group->min
+            : group->max;
+
+#if INCLUDE_NUMPY
+        if (integral)
+            integers[i] = integer;
+        else
+            floats[i] = value;
+#else
+        PyObject* item = integral
+            ? PyLong_FromSize_t(integer)
+            : PyFloat_FromDouble(value);
+        if (!item) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyList_SET_ITEM(result, i, item);
+#endif
+    }
+    return result;
+}
+
+
+static int LazyCSV_GroupBy(LazyCSV *lazy, Py_ssize_t _key_col,
+                           Py_ssize_t _value_col, Py_ssize_t threads,
+                           LazyCSV_Groups *groups) {
+
+    if (threads < 1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "threads cannot be less than 1"
+        );
+        return -1;
+    }
+
+    size_t key_col = _key_col < 0
+        ? lazy->cols + _key_col
+        : (size_t)_key_col;
+    size_t value_col = _value_col == PY_SSIZE_T_MAX ? SIZE_MAX
+        : _value_col < 0 ? lazy->cols + _value_col
+        : (size_t)_value_col;
+
+    LazyCSV_Error error;
+    int result;
+
+    Py_BEGIN_ALLOW_THREADS
+    result = LazyCSV_TableGroupBy(lazy->_table, key_col, value_col, threads,
+                                  groups, &error);
+    Py_END_ALLOW_THREADS
+
+    if (result < 0)
+        LazyCSV_RaiseError(&error);
+    return result;
+}
+
+
+typedef struct {
+    size_t rows;
+    size_t index;
+} LazyCSV_CountOrder;
+
+
+static int LazyCSV_CompareCounts(const void *a, const void *b) {
+    const LazyCSV_CountOrder* x = a;
+    const LazyCSV_CountOrder* y = b;
+    if (x->rows != y->rows)
+        return x->rows < y->rows ? 1 : -1;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+
+static PyObject* LazyCSV_ValueCounts(PyObject* self, PyObject* args,
+                                     PyObject* kwargs) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    Py_ssize_t col, threads = 1;
+
+    static char* kwlist[] = {"", "threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|n", kwlist, &col,
+                                     &threads))
+        return NULL;
+
+    LazyCSV_Groups groups;
+    if (LazyCSV_GroupBy(lazy, col, PY_SSIZE_T_MAX, threads, &groups) < 0)
+        return NULL;
+
+    // most common first, ties in order of appearance
+    LazyCSV_CountOrder* counts =
+        malloc((groups.count + 1)*sizeof(LazyCSV_CountOrder));
+    size_t* order = malloc((groups.count + 1)*sizeof(size_t));
+    PyObject* result = NULL;
+
+    if (!counts || !order) {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < groups.count; i++)
+        counts[i] = (LazyCSV_CountOrder){groups.groups[i].rows, i};
+    qsort(counts, groups.count, sizeof(LazyCSV_CountOrder),
+          LazyCSV_CompareCounts);
+    for (size_t i = 0; i < groups.count; i++)
+        order[i] = counts[i].index;
+
+    PyObject* keys = LazyCSV_GroupKeys(lazy, &groups, order);
+    PyObject* rows = keys
+        ? LazyCSV_GroupAgg(&groups, order, LAZYCSV_AGG_ROWS)
+        : NULL;
+    if (rows)
+        result = PyTuple_Pack(2, keys, rows);
+    Py_XDECREF(keys);
+    Py_XDECREF(rows);
+
+cleanup:
+    free(counts);
+    free(order);
+    LazyCSV_GroupsFree(&groups);
+    return result;
+}
+
+
+static PyObject* LazyCSV_GroupByAgg(PyObject* self, PyObject* args,
+                                    PyObject* kwargs) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    Py_ssize_t key_col, value_col, threads = 1;
+    PyObject* ops = NULL;
+
+    static char* kwlist[] = {"", "", "ops", "threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "nn|On", kwlist, &key_col,
+                                     &value_col, &ops, &threads))
+        return NULL;
+
+    PyObject* names = ops
+        ? PySequence_Fast(ops, "ops must be a sequence of str")
+        : Py_BuildValue("(sssss)", "count", "sum", "mean", "min", "max");
+    if (!names)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(names);
+    int* aggs = malloc((count + 1)*sizeof(int));
+    if (!aggs) {
+        Py_DECREF(names);
+        return PyErr_NoMemory();
+    }
+
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject* name = PySequence_Fast_GET_ITEM(names, i);
+        const char* _name = PyUnicode_Check(name)
+            ? PyUnicode_AsUTF8(name)
+            : NULL;
+        aggs[i] = -1;
+        for (int j = 0; _name && LAZYCSV_AGG_NAMES[j]; j++) {
+            if (!strcmp(_name, LAZYCSV_AGG_NAMES[j]))
+                aggs[i] = j;
+        }
+        if (aggs[i] < 0) {
+            PyErr_Clear();
+            PyErr_SetString(
+                PyExc_ValueError,
+                "ops must be 'rows', 'count', 'sum', 'mean', 'min' or 'max'"
+            );
+            Py_DECREF(names);
+            free(aggs);
+            return NULL;
+        }
+    }
+
+    LazyCSV_Groups groups;
+    if (LazyCSV_GroupBy(lazy, key_col, value_col, threads, &groups) < 0) {
+        Py_DECREF(names);
+        free(aggs);
+        return NULL;
+    }
+
+    PyObject* keys = LazyCSV_GroupKeys(lazy, &groups, NULL);
+    PyObject* values = PyDict_New();
+    PyObject* result = NULL;
+
+    for (Py_ssize_t i = 0; keys && values && i < count; i++) {
+        PyObject* agg = LazyCSV_GroupAgg(&groups, NULL, aggs[i]);
+        PyObject* name = PySequence_Fast_GET_ITEM(names, i);
+        if (!agg || PyDict_SetItem(values, name, agg) < 0)
+            Py_CLEAR(values);
+        Py_XDECREF(agg);
+    }
+
+    if (keys && values)
+        result = PyTuple_Pack(2, keys, values);
+
+    Py_XDECREF(keys);
+    Py_XDECREF(values);
+    Py_DECREF(names);
+    free(aggs);
+    LazyCSV_GroupsFree(&groups);
+    return result;
+}
+
+
+static PyObject* LazyCSV_Histogram(LazyCSV_Reduction *reduction) {
+
+    // counts and bin edges, as returned by numpy.histogram
+    size_t bins = reduction->bins;
+    double width = (reduction->hi - reduction->lo) / bins;
+
+#if INCLUDE_NUMPY
+    npy_intp const counts_dimensions[1] = {bins, };
+    npy_intp const edges_dimensions[1] = {bins + 1, };
+    PyObject* counts = PyArray_SimpleNew(1, counts_dimensions, NPY_INT64);
+    PyObject* edges = PyArray_SimpleNew(1, edges_dimensions, NPY_FLOAT64);
+    if (!counts || !edges) {
+        Py_XDECREF(counts);
+        Py_XDECREF(edges);
+        return NULL;
+    }
+
+    int64_t* _counts = PyArray_DATA((PyArrayObject*)counts);
+    double* _edges = PyArray_DATA((PyArrayObject*)edges);
+    for (size_t i = 0; i < bins; i++)
+        _counts[i] = reduction->histogram[i];
+    for (size_t i = 0; i < bins; i++)
+        _edges[i] = reduction->lo + i*width;
+    _edges[bins] = reduction->hi;
+#else
+    PyObject* counts = PyList_New(bins);
+    PyObject* edges = PyList_New(bins + 1);
+    for (size_t i = 0; counts && edges && i <= bins; i++) {
+        PyObject* count = i < bins
+            ? PyLong_FromSize_t(reduction->histogram[i])
+            : NULL;
+        PyObject* edge = PyFloat_FromDouble(
+            i < bins ? reduction->lo + i*width : reduction->hi);
+        if ((i < bins && !count) || !edge) {
+            Py_XDECREF(count);
+            Py_XDECREF(edge);
+            Py_CLEAR(counts);
+            break;
+        }
+        if (i < bins)
+            PyList_SET_ITEM(counts, i, count);
+        PyList_SET_ITEM(edges, i, edge);
+    }
+    if (!counts || !edges) {
+        Py_XDECREF(counts);
+        Py_XDECREF(edges);
+        return NULL;
+    }
+#endif
+
+    return Py_BuildValue("(NN)", counts, edges);
+}
+
+
+static const char* LAZYCSV_REDUCE_NAMES[] = {
+    "count", "nulls", "sum", "mean", "min", "max", "histogram", NULL
+};
+
+
+static PyObject* LazyCSV_ReduceCol(PyObject* self, PyObject* args,
+                                   PyObject* kwargs) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    Py_ssize_t _col, _start = 0, _stop = PY_SSIZE_T_MAX, threads = 1;
+    Py_ssize_t bins = 10;
+    PyObject *ops = NULL, *range = Py_None;
+
+    static char* kwlist[] = {
+        "", "ops", "start", "stop", "threads", "bins", "range", NULL
+    };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|OnnnnO", kwlist, &_col,
+                                     &ops, &_start, &_stop, &threads, &bins,
+                                     &range))
+        return NULL;
+
+    if (threads < 1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "threads cannot be less than 1"
+        );
+        return NULL;
+    }
+
+    PyObject* names = ops
+        ? PySequence_Fast(ops, "ops must be a sequence of str")
+        : Py_BuildValue("(ssssss)", "count", "nulls", "sum", "mean", "min",
+                        "max");
+    if (!names)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(names);
+    int histogram = 0;
+    for (Py_ssize_t i = 0; i < count; i++) {
+        PyObject* name = PySequence_Fast_GET_ITEM(names, i);
+        const char* _name = PyUnicode_Check(name)
+            ? PyUnicode_AsUTF8(name)
+            : NULL;
+        int found = 0;
+        for (int j = 0; _name && LAZYCSV_REDUCE_NAMES[j]; j++)
+            found |= !strcmp(_name, LAZYCSV_REDUCE_NAMES[j]);
+        if (!found) {
+            PyErr_Clear();
+            PyErr_SetString(
+                PyExc_ValueError,
+                "ops must be 'count', 'nulls', 'sum', 'mean', 'min', 'max' "
+                "or 'histogram'"
+            );
+            Py_DECREF(names);
+            return NULL;
+        }
+        histogram |= !strcmp(_name, "histogram");
+    }
+
+    LazyCSV_Reduction reduction = {0};
+    if (histogram) {
+        char ok = bins > 0;
+        if (ok && range != Py_None) {
+            ok = PyArg_ParseTuple(range, "dd", &reduction.lo, &reduction.hi)
+                && isfinite(reduction.hi - reduction.lo)
+                && reduction.lo <= reduction.hi;
+
+            // as with numpy, an empty range is widened by a half either way
+            if (ok && reduction.lo == reduction.hi) {
+                reduction.lo -= 0.5;
+                reduction.hi += 0.5;
+            }
+        }
+        if (!ok) {
+            PyErr_Clear();
+            PyErr_SetString(
+                PyExc_ValueError,
+                "bins must be greater than 0 and range a finite (lo, hi)"
+            );
+            Py_DECREF(names);
+            return NULL;
+        }
+        reduction.bins = bins;
+        reduction.histogram = calloc(bins, sizeof(size_t));
+        if (!reduction.histogram) {
+            Py_DECREF(names);
+            return PyErr_NoMemory();
+        }
+    }
+
+    size_t col = _col < 0 ? lazy->cols + _col : (size_t)_col;
+    size_t start = _start < 0 ? lazy->rows + _start : (size_t)_start;
+    size_t stop = _stop < 0 ? lazy->rows + _stop : (size_t)_stop;
+    start = _start < 0 && (size_t)-_start > lazy->rows ? 0 : start;
+    stop = _stop < 0 && (size_t)-_stop > lazy->rows ? 0 : stop;
+
+    // without a range, the histogram spans the finite values found by a
+    // first pass, widened by a half either way when they are all the same
+    LazyCSV_Error error;
+    int failed;
+    size_t* buckets = reduction.histogram;
+
+    Py_BEGIN_ALLOW_THREADS
+    reduction.histogram = range == Py_None ? NULL : buckets;
+    failed = LazyCSV_TableReduce(lazy->_table, col, start, stop, threads,
+                                 &reduction, &error);
+    if (!failed && histogram && range == Py_None) {
+        int finite = reduction.finite_min <= reduction.finite_max;
+        reduction.lo = finite ? reduction.finite_min : 0;
+        reduction.hi = finite ? reduction.finite_max : 1;
+        if (reduction.lo == reduction.hi) {
+            reduction.lo -= 0.5;
+            reduction.hi += 0.5;
+        }
+        if (!isfinite(reduction.hi - reduction.lo)) {
+            error = (LazyCSV_Error){
+                LAZYCSV_ERROR_VALUE,
+                "autodetected range of the histogram is not finite"
+            };
+            failed = -1;
+        }
+    }
+    if (!failed && histogram && range == Py_None) {
+        reduction.histogram = buckets;
+        failed = LazyCSV_TableReduce(lazy->_table, col, start, stop, threads,
+                                     &reduction, &error);
+    }
+    Py_END_ALLOW_THREADS
+
+    if (failed) {
+        free(buckets);
+        Py_DECREF(names);
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+
+    // mean, min and max are nan when there are no numbers
+    double nan = NAN, empty = !reduction.count;
+    PyObject* result = PyDict_New();
+
+    for (Py_ssize_t i = 0; result && i < count; i++) {
+        PyObject* name = PySequence_Fast_GET_ITEM(names, i);
+        const char* _name = PyUnicode_AsUTF8(name);
+        PyObject* value =
+            !strcmp(_name, "count") ? PyLong_FromSize_t(reduction.count)
+            : !strcmp(_name, "nulls") ? PyLong_FromSize_t(reduction.nulls)
+            : !strcmp(_name, "sum") ? PyFloat_FromDouble(reduction.sum)
+            : !strcmp(_name, "mean") ? PyFloat_FromDouble(
+                empty ? nan : reduction.sum / reduction.count)
+            : !strcmp(_name, "min") ? PyFloat_FromDouble(
+                empty ? nan : reduction.min)
+            : !strcmp(_name, "max") ? PyFloat_FromDouble(
+                empty ? nan : reduction.max)
+            : LazyCSV_Histogram(&reduction);
+        if (!value || PyDict_SetItem(result, name, value) < 0)
+            Py_CLEAR(result);
+        Py_XDECREF(value);
+    }
+
+    free(buckets);
+    Py_DECREF(names);
+    return result;
+}
+
+
+// rows or cols given as a slice or a sequence of ints, such as an array
+// returned by argsort, as an array of indices below `len`. None is left as
+// NULL, for all of them.
+
+static int LazyCSV_IndicesFromObject(PyObject *obj, size_t len,
+                                     size_t **indices, size_t *count) {
+    *indices = NULL;
+    *count = 0;
+    if (obj == Py_None)
+        return 0;
+
+    if (PySlice_Check(obj)) {
+        Py_ssize_t start, stop, step;
+        if (PySlice_Unpack(obj, &start, &stop, &step) < 0)
+            return -1;
+        *count = PySlice_AdjustIndices(len, &start, &stop, step);
+        *indices = malloc(*count * sizeof(size_t) + 1);
+        if (!*indices) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        for (size_t i = 0; i < *count; i++)
+            (*indices)[i] = start + i*step;
+        return 0;
+    }
+
+    PyObject* seq = PySequence_Fast(obj, "rows and cols must be a slice or "
+                                         "a sequence of ints");
+    if (!seq)
+        return -1;
+
+    *count = PySequence_Fast_GET_SIZE(seq);
+    *indices = malloc(*count * sizeof(size_t) + 1);
+    if (!*indices) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (size_t i = 0; i < *count; i++) {
+        Py_ssize_t index =
+            PyNumber_AsSsize_t(PySequence_Fast_GET_ITEM(seq, i), NULL);
+        if (index == -1 && PyErr_Occurred())
+            break;
+        size_t _index = index < 0 ? len + index : (size_t)index;
+        if (_index >= len) {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "provided value not in bounds of index"
+            );
+            break;
+        }
+        (*indices)[i] = _index;
+    }
+
+    Py_DECREF(seq);
+    if (PyErr_Occurred()) {
+        free(*indices);
+        *indices = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+static PyObject* LazyCSV_WriteCSV(PyObject* self, PyObject* args,
+                                  PyObject* kwargs) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    PyObject *path, *rows_obj = Py_None, *cols_obj = Py_None;
+    int header = 1;
+
+    static char* kwlist[] = {"", "rows", "cols", "header", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|OOp", kwlist,
+                                     PyUnicode_FSConverter, &path, &rows_obj,
+                                     &cols_obj, &header))
+        return NULL;
+
+    size_t *rows, *cols, nrows, ncols;
+    if (LazyCSV_IndicesFromObject(rows_obj, lazy->rows, &rows, &nrows) < 0) {
+        Py_DECREF(path);
+        return NULL;
+    }
+    if (LazyCSV_IndicesFromObject(cols_obj, lazy->cols, &cols, &ncols) < 0) {
+        free(rows);
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    // the file is only truncated once written, so that writing a table
+    // over its own file fails before the data is lost
+    LazyCSV_Error error = {
+        LAZYCSV_ERROR_RUNTIME,
+        "unable to write to output file"
+    };
+    int failed = 0, fd;
+    struct stat st;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = open(PyBytes_AS_STRING(path), O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    if (fd != -1) {
+        failed = LazyCSV_TableWrite(lazy->_table, fd, rows, nrows, cols,
+                                    ncols, header, &error) < 0;
+        if (!failed && !fstat(fd, &st) && S_ISREG(st.st_mode))
+            failed = ftruncate(fd, lseek(fd, 0, SEEK_CUR)) < 0;
+        failed = close(fd) < 0 || failed;
+    }
+    Py_END_ALLOW_THREADS
+
+    free(rows);
+    free(cols);
+
+    if (fd == -1) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return NULL;
+    }
+    Py_DECREF(path);
+
+    if (failed) {
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+// row numbers as an intp array when built with numpy and a list otherwise.
+
+static PyObject* LazyCSV_RowsAsObject(const size_t *rows, size_t count) {
+#if INCLUDE_NUMPY
+    npy_intp const dimensions[1] = {count, };
+    PyObject* result = PyArray_SimpleNew(1, dimensions, NPY_INTP);
+    if (result && count)
+        memcpy(PyArray_DATA((PyArrayObject*)result), rows,
+               count*sizeof(size_t));
+#else
+    PyObject* result = PyList_New(count);
+    for (size_t i = 0; result && i < count; i++) {
+        PyObject* row = PyLong_FromSize_t(rows[i]);
+        if (!row) {
+            Py_CLEAR(result);
+            break;
+        }
+        PyList_SET_ITEM(result, i, row);
+    }
+#endif
+    return result;
+}
+
+
+static PyObject* LazyCSV_Sample(PyObject* self, PyObject* args,
+                                PyObject* kwargs) {
+    LazyCSV* lazy = (LazyCSV*)self;
+    Py_ssize_t n, threads = 1;
+    PyObject *seed_obj = Py_None, *cols_obj = Py_None;
+    PyObject *stratify_obj = Py_None;
+
+    static char* kwlist[] = {
+        "", "seed", "cols", "stratify_col", "threads", NULL
+    };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|OOOn", kwlist, &n,
+                                     &seed_obj, &cols_obj, &stratify_obj,
+                                     &threads))
+        return NULL;
+
+    if (n < 0 || threads < 1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            n < 0
+                ? "n cannot be negative"
+                : "threads cannot be less than 1"
+        );
+        return NULL;
+    }
+
+    size_t stratify_col = SIZE_MAX;
+    if (stratify_obj != Py_None) {
+        Py_ssize_t col = PyNumber_AsSsize_t(stratify_obj, PyExc_IndexError);
+        if (col == -1 && PyErr_Occurred())
+            return NULL;
+        stratify_col = col < 0 ? lazy->cols + col : (size_t)col;
+    }
+
+    // without a seed, one is drawn from the random module, so that
+    // random.seed() also makes samples repeatable
+    PyObject* seed = seed_obj;
+    if (seed == Py_None) {
+        PyObject* random = PyImport_ImportModule("random");
+        seed = random
+            ? PyObject_CallMethod(random, "getrandbits", "i", 64)
+            : NULL;
+        Py_XDECREF(random);
+        if (!seed)
+            return NULL;
+    }
+    else if (!PyLong_Check(seed)) {
+        PyErr_SetString(
+            PyExc_TypeError,
+            "seed must be an int or None"
+        );
+        return NULL;
+    }
+    else {
+        Py_INCREF(seed);
+    }
+
+    uint64_t _seed = PyLong_AsUnsignedLongLongMask(seed);
+    Py_DECREF(seed);
+    if (_seed == (uint64_t)-1 && PyErr_Occurred())
+        return NULL;
+
+    size_t *cols, width;
+    if (LazyCSV_IndicesFromObject(cols_obj, lazy->cols, &cols, &width) < 0)
+        return NULL;
+    width = cols ? width : lazy->cols;
+
+    size_t total = LazyCSV_TableRows(lazy->_table);
+    size_t* rows = malloc(((size_t)n < total ? (size_t)n : total)
+                          * sizeof(size_t) + 1);
+    if (!rows) {
+        free(cols);
+        return PyErr_NoMemory();
+    }
+
+    LazyCSV_Error error;
+    size_t count;
+    int failed;
+
+    Py_BEGIN_ALLOW_THREADS
+    failed = LazyCSV_TableSample(lazy->_table, n, _seed, stratify_col,
+                                 threads, rows, &count, &error);
+    Py_END_ALLOW_THREADS
+
+    if (failed) {
+        free(cols);
+        free(rows);
+        LazyCSV_RaiseError(&error);
+        return NULL;
+    }
+
+    // the cells of the sample are read in a single pass over its rows,
+    // which are in order
+    LazyCSV_TableIter iter = {
+        .table = lazy->_table,
+        .row = SIZE_MAX,
+        .col = SIZE_MAX,
+        .step = 1,
+    };
+    size_t skip = !lazy->_table->skip_headers, offset, len;
+
+    PyObject* values = PyList_New(count);
+    for (size_t i = 0; values && i < count; i++) {
+        PyObject* row = PyList_New(width);
+        if (row)
+            PyList_SET_ITEM(values, i, row);
+        else
+            Py_CLEAR(values);
+
+        for (size_t j = 0; values && j < width; j++) {
+            LazyCSV_IterField(&iter, rows[i] + skip, cols ? cols[j] : j,
+                              &offset, &len);
+            PyObject* value =
+                PyBytes_FromOffsetAndLen(lazy, &iter.span, offset, len);
+            if (value)
+                PyList_SET_ITEM(row, j, value);
+            else
+                Py_CLEAR(values);
+        }
+    }
+
+    PyObject* sampled = values ? LazyCSV_RowsAsObject(rows, count) : NULL;
+    PyObject* result = sampled ? PyTuple_Pack(2, sampled, values) : NULL;
+
+    Py_XDECREF(sampled);
+    Py_XDECREF(values);
+    LazyCSV_SpanFree(lazy->_table, &iter.span);
+    free(iter.commas.values);
+    free(cols);
+    free(rows);
+    return result;
+}
+
+
+static PyMethodDef LazyCSV_Methods[] = {
+    {
+        "sequence",
+        (PyCFunction)LazyCSV_Seq,
+        METH_VARARGS|METH_KEYWORDS,
+        "get column iterator"
+    },
+    {
+        "stats",
+        (PyCFunction)LazyCSV_Stats,
+        METH_NOARGS,
+        "index file sizes, index timings and counters"
+    },
+    {
+        "build_key_index",
+        (PyCFunction)LazyCSV_BuildKeyIndex,
+        METH_O,
+        "index the values of a column for lookup()"
+    },
+    {
+        "argsort",
+        (PyCFunction)LazyCSV_Argsort,
+        METH_VARARGS|METH_KEYWORDS,
+        "rows in the order of the values of a column"
+    },
+    {
+        "value_counts",
+        (PyCFunction)LazyCSV_ValueCounts,
+        METH_VARARGS|METH_KEYWORDS,
+        "distinct values of a column and their counts"
+    },
+    {
+        "groupby_agg",
+        (PyCFunction)LazyCSV_GroupByAgg,
+        METH_VARARGS|METH_KEYWORDS,
+        "aggregates of the numbers of a column grouped by another"
+    },
+    {
+        "reduce",
+        (PyCFunction)LazyCSV_ReduceCol,
+        METH_VARARGS|METH_KEYWORDS,
+        "aggregates of the numbers of a column, without materializing it"
+    },
+    {
+        "write_csv",
+        (PyCFunction)LazyCSV_WriteCSV,
+        METH_VARARGS|METH_KEYWORDS,
+        "writes a subset of rows and columns to a new csv file"
+    },
+    {
+        "sample",
+        (PyCFunction)LazyCSV_Sample,
+        METH_VARARGS|METH_KEYWORDS,
+        "a random sample of rows and the values of their columns"
+    },
+    {
+        "cache_columns",
+        (PyCFunction)LazyCSV_CacheColumns,
+        METH_VARARGS|METH_KEYWORDS,
+        "copies columns to cache files which they are then read from"
+    },
+    {
+        "lookup",
+        (PyCFunction)LazyCSV_Lookup,
+        METH_VARARGS,
+        "first row holding a value in a column with a key index"
+    },
+    {
+        "share",
+        (PyCFunction)LazyCSV_Share,
+        METH_NOARGS,
+        "picklable handle to the index, for LazyCSV.attach"
+    },
+    {
+        "attach",
+        (PyCFunction)LazyCSV_Attach,
+        METH_O|METH_CLASS,
+        "map the index of a LazyCSV.share() handle without reindexing"
+    },
+    {
+        "__reduce__",
+        (PyCFunction)LazyCSV_Reduce,
+        METH_NOARGS,
+        "pickle as a handle to the shared index"
+    },
+    {NULL, }
+};
+
+static PyMappingMethods LazyCSV_MappingMembers[] = {
+    (lenfunc)NULL,
+    (binaryfunc)LazyCSV_GetItem,
+    (objobjargproc)NULL,
+};
+
+PyDoc_STRVAR(
+    LazyCSV_Docstring,
+    "lazycsv.LazyCSV(\n"
+    "    filepath,\n"
+    "    /\n"
+    "    delimiter: str=',',\n"
+    "    quotechar: str='\"',\n"
+    "    unquote: bool=True,\n"
+    "    skip_headers: bool=False,\n"
+    "    buffer_size: int=2**21,\n"
+    "    index_dir: str=None,\n"
+    "    access: str='normal',\n"
+    "    populate: bool=False,\n"
+    "    hugepages: bool=False,\n"
+    "    prefetch: int=0,\n"
+    "    readahead: int=0,\n"
+    "    index_mode: str='flat',\n"
+    "    checkpoint_cols: int=0,\n"
+    "    encoding: str=None,\n"
+    ")\n"
+    "\n"
+    "LazyCSV object constructor. Takes the filepath of a CSV\n"
+    "file as the first argument, and several keyword arguments\n"
+    "as optional values. Indexes the CSV, generates headers,\n"
+    "and returns `self` to the caller.\n"
+    "\n"
+    "A binary file object (anything with a `readinto` or `read`\n"
+    "method, such as a pipe or sys.stdin.buffer) can be passed\n"
+    "in place of a filepath, in which case the stream is indexed\n"
+    "while it is copied into a data file in `index_dir`.\n"
+    "\n"
+    "Gzip and zstd compressed files are detected and indexed\n"
+    "in place when LazyCSV is built with LAZYCSV_INCLUDE_ZLIB=1\n"
+    "or LAZYCSV_INCLUDE_ZSTD=1, fields are then decompressed\n"
+    "on access."
+    "\n\n"
+    "Options\n"
+    "-------\n"
+    "delimiter: ',' -- character used to demarcate the separation\n"
+    "    of two fields. Should only be a single char.\n"
+    "quotechar: '\"' -- character used to ensure contents belong\n"
+    "    to a single field. Should only be a single char.\n"
+    "unquote: bool=True -- if True, a quoted field will be\n"
+    "    stripped of quotes on parsing. i.e. `,\"goo\\nbar\",`\n"
+    "    will return 'goo\\nbar'.\n"
+    "skip_headers: bool=False -- skips parsing out header\n"
+    "    values to the .header attribute if True.\n"
+    "buffer_size: int=2**21 -- is the buffer size that LazyCSV\n"
+    "    uses when writing index data to disk during object\n"
+    "    construction, can be set to any value greater than 0\n"
+    "    (units of bytes).\n"
+    "index_dir: str=None -- Directory where index files\n"
+    "    are saved. By default uses Python's `TemporaryDirectory()`\n"
+    "    function in the `tempfile` module.\n"
+    "access: str='normal' -- access pattern hint passed to madvise\n"
+    "    for the data file and the index files once indexing is\n"
+    "    complete. One of 'normal', 'sequential', 'random' or\n"
+    "    'willneed'. Indexing itself always reads sequentially.\n"
+    "populate: bool=False -- if True, prefault the index files\n"
+    "    into memory when they are mapped (MAP_POPULATE).\n"
+    "hugepages: bool=False -- if True, ask the kernel to back the\n"
+    "    index maps with transparent hugepages where supported.\n"
+    "prefetch: int=0 -- default number of rows iterators hint the\n"
+    "    kernel to read ahead of the current position, 0 disables\n"
+    "    prefetching. Can be overridden per iterator in sequence().\n"
+    "readahead: int=0 -- if greater than 0, the file is indexed\n"
+    "    from blocks of this many bytes read by a background thread\n"
+    "    instead of through the memory map, overlapping disk reads\n"
+    "    with the index pass on cold files (units of bytes).\n"
+    "    Ignored for compressed files.\n"
+    "index_mode: str='flat' -- layout of the comma index. 'flat'\n"
+    "    stores a fixed width offset per field, 'compressed'\n"
+    "    bit-packs the deltas between fields in blocks, for a\n"
+    "    several times smaller index at some cost to lookups.\n"
+    "    'rows' stores only the start of each row, and fields\n"
+    "    are found by scanning the row when they are read. Not\n"
+    "    supported for compressed files.\n"
+    "checkpoint_cols: int=0 -- with index_mode='rows', if\n"
+    "    greater than 0, the start of every nth column is also\n"
+    "    stored, so that fields are scanned for from the nearest\n"
+    "    one.\n"
+    "encoding: str=None -- if given, values and headers are\n"
+    "    decoded with this codec and returned as str instead of\n"
+    "    bytes. to_numpy() still returns bytes.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+    "self\n"
+
+);
+
+
+static PyTypeObject LazyCSVType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "lazycsv.lazycsv.LazyCSV",
+    .tp_doc = LazyCSV_Docstring,
+    .tp_basicsize = sizeof(LazyCSV),
+    .tp_dealloc = (destructor)LazyCSV_Destruct,
+    .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+    .tp_methods = LazyCSV_Methods,
+    .tp_members = LazyCSV_Members,
+    .tp_as_mapping = LazyCSV_MappingMembers,
+    .tp_new = LazyCSV_New,
+};
+
+
+typedef struct {
+    PyObject_HEAD
+    PyObject* headers;
+    PyObject* shards;
+    size_t rows;
+    size_t cols;
+    size_t* _offsets;
+} LazyCSV_Dataset;
+
+
+// a column iterator over a dataset walks the shards in order, running an
+// embedded LazyCSV_TableIter over the slice of each shard it passes through.
+// `position` and `stop` are in the dataset's row space, `position` is only
+// current in between shards, and `base` is the dataset position of the
+// first row of the current shard in iteration order.
+
+typedef struct {
+    PyObject_HEAD
+    PyObject* dataset;
+    size_t col;
+    size_t position;
+    size_t stop;
+    size_t step;
+    size_t prefetch;
+    size_t shard;
+    size_t base;
+    LazyCSV* lazy;
+    LazyCSV_TableIter iter;
+    char reversed;
+} LazyCSV_DatasetIter;
+
+
+typedef struct {
+    LazyCSV_Build* builds;
+    size_t count;
+    size_t next;
+    pthread_mutex_t lock;
+} LazyCSV_BuildQueue;
+
+
+static void* LazyCSV_BuildWorker(void *arg) {
+    LazyCSV_BuildQueue* queue = (LazyCSV_BuildQueue*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (i >= queue->count)
+            break;
+
+        LazyCSV_BuildScan(queue->builds + i);
+    }
+    return NULL;
+}
+
+
+static inline size_t LazyCSV_DatasetShard(LazyCSV_Dataset *dataset,
+                                          size_t row) {
+
+    // offsets hold the first row of each shard followed by the row count, so
+    // the shard of a row is the last one starting at or before it.
+
+    size_t L = 0, R = PyTuple_GET_SIZE(dataset->shards);
+
+    while (R - L > 1) {
+        size_t M = L + ((R - L)/2);
+        if (dataset->_offsets[M] <= row)
+            L = M;
+        else
+            R = M;
+    }
+    return L;
+}
+
+
+static int LazyCSV_DatasetIterEnter(LazyCSV_DatasetIter *diter) {
+    LazyCSV_Dataset* dataset = (LazyCSV_Dataset*)diter->dataset;
+    size_t shards = PyTuple_GET_SIZE(dataset->shards);
+    size_t* offsets = dataset->_offsets;
+
+    while (diter->shard < shards && diter->position < diter->stop) {
+        size_t k = diter->reversed
+            ? shards - 1 - diter->shard
+            : diter->shard;
+
+        // a reversed dataset iterates its shards back to front, and each
+        // shard back to front, so that a shard spans [a, b) in both cases.
+
+        size_t a = diter->reversed
+            ? dataset->rows - offsets[k+1]
+            : offsets[k];
+        size_t b = diter->reversed
+            ? dataset->rows - offsets[k]
+            : offsets[k+1];
+
+        diter->shard++;
+
+        if (diter->position >= b)
+            continue;
+
+        LazyCSV_TableIter* iter = &diter->iter;
+        diter->lazy = (LazyCSV*)PyTuple_GET_ITEM(dataset->shards, k);
+        iter->table = diter->lazy->_table;
+        iter->row = SIZE_MAX;
+        iter->col = diter->col;
+        iter->position = diter->position - a;
+        iter->stop = (diter->stop < b ? diter->stop : b) - a;
+        iter->step = diter->step;
+        iter->prefetch = diter->prefetch;
+        iter->reversed = diter->reversed;
+        iter->commas.count = 0;
+        iter->cursor.offset = 0;
+        memset(iter->hints, 0, sizeof(iter->hints));
+        LazyCSV_IterColCache(iter);
+
+        diter->base = a;
+        return 1;
+    }
+    return 0;
+}
+
+
+static inline LazyCSV *LazyCSV_DatasetIterCol(LazyCSV_DatasetIter *diter,
+                                              size_t *offset, size_t *len) {
+
+    // returns the shard the field at offset belongs to, or NULL once the
+    // iterator is exhausted.
+
+    LazyCSV_TableIter* iter = &diter->iter;
+
+    for (;;) {
+        if (iter->table) {
+            if (iter->position < iter->stop) {
+                LazyCSV_IterCol(iter, offset, len);
+                return diter->lazy;
+            }
+
+            diter->position = diter->base + iter->position;
+            LazyCSV_SpanFree(iter->table, &iter->span);
+            iter->table = NULL;
+        }
+        if (!LazyCSV_DatasetIterEnter(diter))
+            return NULL;
+    }
+}
+
+
+static inline size_t LazyCSV_DatasetIterRemaining(LazyCSV_DatasetIter *diter) {
+    size_t position = diter->iter.table
+        ? diter->base + diter->iter.position
+        : diter->position;
+
+    return position < diter->stop
+        ? (diter->stop - position + diter->step - 1) / diter->step
+        : 0;
+}
+
+
+static PyObject* LazyCSV_DatasetIterNext(PyObject* self) {
+    LazyCSV_DatasetIter* diter = (LazyCSV_DatasetIter*)self;
+
+    size_t offset, len;
+    LazyCSV* lazy = LazyCSV_DatasetIterCol(diter, &offset, &len);
+
+    if (!lazy) {
+        PyErr_SetNone(PyExc_StopIteration);
+        return NULL;
+    }
+
+    return PyBytes_FromOffsetAndLen(lazy, &diter->iter.span, offset, len);
+}
+
+
+static PyObject* LazyCSV_DatasetIterAsList(PyObject* self) {
+    LazyCSV_DatasetIter* diter = (LazyCSV_DatasetIter*)self;
+
+    size_t size = LazyCSV_DatasetIterRemaining(diter);
+    PyObject* result = PyList_New(size);
+
+    size_t offset=SIZE_MAX, len=0;
+    for (size_t i = 0; i < size; i++) {
+        LazyCSV* lazy = LazyCSV_DatasetIterCol(diter, &offset, &len);
+        PyObject* item =
+            PyBytes_FromOffsetAndLen(lazy, &diter->iter.span, offset, len);
+        if (!item) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyList_SET_ITEM(result, i, item);
+    }
+
+    return result;
+}
+
+
+#if INCLUDE_NUMPY
+static PyObject* LazyCSV_DatasetIterAsNumpy(PyObject* self) {
+    LazyCSV_DatasetIter* diter = (LazyCSV_DatasetIter*)self;
+
+    size_t size = LazyCSV_DatasetIterRemaining(diter);
+
+    size_t buffer_capacity = 65536; // 2**16
+    LazyCSV_Buffer buffer = {.data = malloc(buffer_capacity),
+                             .size = 0,
+                             .capacity = buffer_capacity};
+
+    size_t offset=0, len=0, max_len=0;
+    char* addr = buffer.data;
+
+    // shards are only read through the tuple the dataset holds on to, so
+    // the fields can be gathered without the GIL.
+
+    Py_BEGIN_ALLOW_THREADS
+    for (size_t i = 0; addr && i < size; i++) {
+        LazyCSV* lazy = LazyCSV_DatasetIterCol(diter, &offset, &len);
+        addr = LazyCSV_DataAt(lazy->_table, &diter->iter.span, offset, len);
+        if (addr) {
+            LazyCSV_BufferCache(&buffer, &len, sizeof(size_t));
+            LazyCSV_BufferCache(&buffer, addr, len);
+            max_len = len > max_len ? len : max_len;
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!addr) {
+        if (buffer.data)
+            LazyCSV_RaiseError(&diter->iter.span.error);
+        else
+            PyErr_NoMemory();
+        free(buffer.data);
+        return NULL;
+    }
+
+    return LazyCSV_NumpyFromBuffer(&buffer, size, max_len);
+}
 #endif
-    if (PyType_Ready(&LazyCSVType) < 0)
+
+
+static void LazyCSV_DatasetIterDestruct(LazyCSV_DatasetIter* self) {
+    if (self->iter.table)
+        LazyCSV_SpanFree(self->iter.table, &self->iter.span);
+    free(self->iter.commas.values);
+    Py_DECREF(self->dataset);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+static PyMethodDef LazyCSV_DatasetIterMethods[] = {
+#if INCLUDE_NUMPY
+    {
+        "to_numpy",
+        (PyCFunction)LazyCSV_DatasetIterAsNumpy,
+        METH_NOARGS,
+        "materialize iterator into a numpy array"
+    },
+#endif
+    {
+        "to_list",
+        (PyCFunction)LazyCSV_DatasetIterAsList,
+        METH_NOARGS,
+        "materialize iterator into a list"
+    },
+    {NULL, }
+};
+
+
+static PyTypeObject LazyCSV_DatasetIterType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "lazycsv_dataset_iterator",
+    .tp_basicsize = sizeof(LazyCSV_DatasetIter),
+    .tp_dealloc = (destructor)LazyCSV_DatasetIterDestruct,
+    .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+    .tp_doc = "LazyCSVDataset iterable",
+    .tp_methods = LazyCSV_DatasetIterMethods,
+    .tp_iter = LazyCSV_IterSelf,
+    .tp_iternext = LazyCSV_DatasetIterNext,
+};
+
+
+static PyObject* LazyCSV_DatasetIterNew(PyObject *self, size_t col,
+                                        size_t position, size_t stop,
+                                        size_t step, char reversed,
+                                        size_t prefetch) {
+
+    PyTypeObject* type = &LazyCSV_DatasetIterType;
+    LazyCSV_DatasetIter* diter = (LazyCSV_DatasetIter*)type->tp_alloc(type, 0);
+
+    if (!diter) {
+        PyErr_SetString(
+            PyExc_MemoryError,
+            "unable to allocate memory for iterable"
+        );
+        return NULL;
+    }
+
+    diter->dataset = self;
+    diter->col = col;
+    diter->position = position;
+    diter->stop = stop;
+    diter->step = step;
+    diter->reversed = reversed;
+    diter->prefetch = prefetch;
+    diter->shard = 0;
+    diter->iter.table = NULL;
+
+    Py_INCREF(self);
+
+    return (PyObject*)diter;
+}
+
+
+static PyObject *LazyCSV_DatasetNew(PyTypeObject *type, PyObject *args,
+                                    PyObject *kwargs) {
+
+    PyObject* paths;
+    LazyCSV_Options options = {.dirname = NULL};
+    LazyCSV_TableOptionsInit(&options.table);
+
+    Py_ssize_t buffer_capacity = options.table.buffer_capacity;
+    Py_ssize_t prefetch = 0;
+    Py_ssize_t readahead = 0;
+    Py_ssize_t checkpoint_cols = 0;
+    Py_ssize_t threads = 1;
+    char *delimiter = ",", *quotechar = "\"";
+    char *access = "normal";
+    char *index_mode = "flat";
+    char *encoding = NULL;
+
+    static char* kwlist[] = {
+        "", "delimiter", "quotechar", "skip_headers", "unquote", "buffer_size",
+        "index_dir", "access", "populate", "hugepages", "prefetch",
+        "readahead", "index_mode", "checkpoint_cols", "threads", "encoding",
+        NULL
+    };
+
+    char ok = PyArg_ParseTupleAndKeywords(
+        args, kwargs, "O|ssppnssppnnsnnz", kwlist, &paths, &delimiter,
+        &quotechar, &options.table.skip_headers, &options.table.unquote,
+        &buffer_capacity, &options.dirname, &access, &options.table.populate,
+        &options.table.hugepages, &prefetch, &readahead, &index_mode,
+        &checkpoint_cols, &threads, &encoding);
+
+    if (!ok) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "unable to parse function arguments"
+        );
         return NULL;
+    }
 
-    if (PyType_Ready(&LazyCSV_IterType) < 0)
+    if (threads < 1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "threads cannot be less than 1"
+        );
+        return NULL;
+    }
+
+    if (LazyCSV_OptionsFromArgs(&options, delimiter, quotechar,
+                                buffer_capacity, access, prefetch,
+                                readahead, index_mode, checkpoint_cols,
+                                encoding) < 0)
+        return NULL;
+
+    PyObject* seq = PySequence_Fast(paths, "paths must be a sequence");
+    if (!seq)
+        return NULL;
+
+    size_t count = PySequence_Fast_GET_SIZE(seq);
+    if (!count) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "at least one path is required"
+        );
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        PyObject* path = PySequence_Fast_GET_ITEM(seq, i);
+        if (!PyUnicode_CheckExact(path) && !PyBytes_CheckExact(path)) {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "paths must be str or bytes"
+            );
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+
+    // every shard shares a single index directory
+    if (!options.dirname)
+        LazyCSV_TempDirAsString(&options.tempdir, &options.dirname);
+
+    LazyCSV_Build* builds = calloc(count, sizeof(LazyCSV_Build));
+    PyObject* shards = PyTuple_New(count);
+    LazyCSV_Dataset* self = NULL;
+
+    size_t prepared = 0;
+    for (; prepared < count; prepared++) {
+        PyObject* path = PySequence_Fast_GET_ITEM(seq, prepared);
+        if (LazyCSV_BuildPrepare(builds + prepared, path, &options) < 0)
+            goto cleanup_builds;
+    }
+
+    LazyCSV_BuildQueue queue = {.builds = builds, .count = count, .next = 0};
+    pthread_mutex_init(&queue.lock, NULL);
+
+    size_t workers = (size_t)threads < count ? (size_t)threads : count;
+    pthread_t* pool = malloc(workers*sizeof(pthread_t));
+    size_t started = 0;
+
+    // the calling thread works through the queue along with the pool
+    Py_BEGIN_ALLOW_THREADS
+    for (; started + 1 < workers; started++) {
+        if (pthread_create(pool + started, NULL, LazyCSV_BuildWorker, &queue))
+            break;
+    }
+    LazyCSV_BuildWorker(&queue);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+    Py_END_ALLOW_THREADS
+
+    free(pool);
+    pthread_mutex_destroy(&queue.lock);
+
+    for (size_t i = 0; i < count; i++) {
+        if (builds[i].failed) {
+            LazyCSV_BuildRaise(builds + i);
+            goto cleanup_builds;
+        }
+    }
+
+    // each build is consumed by finishing it, whether or not it succeeds
+    size_t finished = 0;
+    for (; finished < count; finished++) {
+        PyObject* shard = LazyCSV_BuildFinish(&LazyCSVType, builds + finished);
+        if (!shard) {
+            finished++;
+            goto cleanup_shards;
+        }
+        PyTuple_SET_ITEM(shards, finished, shard);
+    }
+
+    LazyCSV* first = (LazyCSV*)PyTuple_GET_ITEM(shards, 0);
+    size_t* offsets = malloc((count + 1)*sizeof(size_t));
+
+    offsets[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        LazyCSV* shard = (LazyCSV*)PyTuple_GET_ITEM(shards, i);
+        int match = shard->cols == first->cols
+            && PyObject_RichCompareBool(shard->headers, first->headers, Py_EQ);
+        if (!match) {
+            PyErr_Format(
+                PyExc_ValueError,
+                "headers of shard %zu do not match the headers of shard 0",
+                i
+            );
+            free(offsets);
+            goto cleanup_shards;
+        }
+        offsets[i+1] = offsets[i] + shard->rows;
+    }
+
+    self = (LazyCSV_Dataset*)type->tp_alloc(type, 0);
+    if (!self) {
+        PyErr_SetString(
+            PyExc_MemoryError,
+            "unable to allocate LazyCSVDataset object"
+        );
+        free(offsets);
+        goto cleanup_shards;
+    }
+
+    self->headers = first->headers;
+    Py_INCREF(self->headers);
+    self->shards = shards;
+    self->rows = offsets[count];
+    self->cols = first->cols;
+    self->_offsets = offsets;
+
+    free(builds);
+    Py_XDECREF(options.tempdir);
+    Py_DECREF(seq);
+
+    return (PyObject*)self;
+
+cleanup_shards:
+    for (size_t i = finished; i < count; i++)
+        LazyCSV_BuildCleanup(builds + i);
+    Py_DECREF(shards);
+    free(builds);
+    Py_XDECREF(options.tempdir);
+    Py_DECREF(seq);
+    return NULL;
+
+cleanup_builds:
+    for (size_t i = 0; i < prepared; i++)
+        LazyCSV_BuildCleanup(builds + i);
+    Py_DECREF(shards);
+    free(builds);
+    Py_XDECREF(options.tempdir);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+
+static void LazyCSV_DatasetDestruct(LazyCSV_Dataset* self) {
+    free(self->_offsets);
+    Py_DECREF(self->shards);
+    Py_DECREF(self->headers);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+
+static PyObject* LazyCSV_DatasetSeq(PyObject *self, PyObject *args,
+                                    PyObject *kwargs) {
+
+    LazyCSV_Dataset* dataset = (LazyCSV_Dataset*)self;
+
+    size_t row = SIZE_MAX;
+    size_t col = SIZE_MAX;
+    char reversed = 0;
+    Py_ssize_t prefetch = -1;
+
+    static char *kwlist[] = {"row", "col", "reversed", "prefetch", NULL};
+
+    char ok = PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|nnbn", kwlist, &row, &col, &reversed, &prefetch
+    );
+
+    if (!ok) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "unable to parse dataset.sequence() arguments"
+        );
+        return NULL;
+    }
+
+    if (row == SIZE_MAX && col == SIZE_MAX) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "a row or a col value is required"
+        );
+        return NULL;
+    }
+
+    if (row != SIZE_MAX && col != SIZE_MAX) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "cannot specify both row and col"
+        );
+        return NULL;
+    }
+
+    if (row != SIZE_MAX) {
+        // rows never span shards, defer to the shard holding the row
+        if (row >= dataset->rows) {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "provided value not in bounds of index"
+            );
+            return NULL;
+        }
+
+        size_t k = LazyCSV_DatasetShard(dataset, row);
+        PyObject* shard = PyTuple_GET_ITEM(dataset->shards, k);
+
+        PyObject* shard_args = Py_BuildValue("()");
+        PyObject* shard_kwargs = Py_BuildValue(
+            "{s:n,s:b,s:n}",
+            "row", (Py_ssize_t)(row - dataset->_offsets[k]),
+            "reversed", reversed,
+            "prefetch", prefetch
+        );
+        PyObject* result = LazyCSV_Seq(shard, shard_args, shard_kwargs);
+
+        Py_DECREF(shard_args);
+        Py_DECREF(shard_kwargs);
+        return result;
+    }
+
+    LazyCSV* first = (LazyCSV*)PyTuple_GET_ITEM(dataset->shards, 0);
+
+    return LazyCSV_DatasetIterNew(
+        self, col, 0, dataset->rows, 1, reversed,
+        prefetch < 0 ? first->_table->prefetch : (size_t)prefetch
+    );
+}
+
+
+static PyObject* LazyCSV_DatasetGetItem(PyObject* self, PyObject* key) {
+    LazyCSV_Dataset* dataset = (LazyCSV_Dataset*)self;
+
+    if (!PyTuple_Check(key)) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "index must contain both a row and column value"
+        );
+        return NULL;
+    }
+
+    PyObject *row_obj, *col_obj;
+
+    if (!PyArg_ParseTuple(key, "OO", &row_obj, &col_obj)) {
+        PyErr_SetString(
+            PyExc_RuntimeError,
+            "unable to parse index key"
+        );
+        return NULL;
+    }
+
+    if (PyLong_Check(row_obj)) {
+        // a single row is delegated to its shard, with the row renumbered
+        Py_ssize_t _row = PyLong_AsSsize_t(row_obj);
+        size_t row = _row < 0 ? dataset->rows + _row : (size_t)_row;
+
+        if (row >= dataset->rows) {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "provided value not in bounds of index"
+            );
+            return NULL;
+        }
+
+        size_t k = LazyCSV_DatasetShard(dataset, row);
+        PyObject* shard = PyTuple_GET_ITEM(dataset->shards, k);
+
+        PyObject* shard_key =
+            Py_BuildValue("(nO)", (Py_ssize_t)(row - dataset->_offsets[k]),
+                          col_obj);
+        PyObject* result = LazyCSV_GetItem(shard, shard_key);
+
+        Py_DECREF(shard_key);
+        return result;
+    }
+
+    if (!PySlice_Check(row_obj) || !PyLong_Check(col_obj)) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "given indexing schema is not supported"
+        );
+        return NULL;
+    }
+
+    PySliceObject* row_slice = (PySliceObject*)row_obj;
+
+    Py_ssize_t _col = PyLong_AsSsize_t(col_obj);
+    size_t col = _col < 0 ? dataset->cols + _col : (size_t)_col;
+
+    if (col >= dataset->cols) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "provided value not in bounds of index"
+        );
+        return NULL;
+    }
+
+    size_t rows = dataset->rows;
+
+    Py_ssize_t _start = row_slice->start == Py_None
+                            ? (Py_ssize_t)0
+                            : PyLong_AsSsize_t(row_slice->start);
+    Py_ssize_t _stop = row_slice->stop == Py_None
+                           ? (Py_ssize_t)rows
+                           : PyLong_AsSsize_t(row_slice->stop);
+    Py_ssize_t _step =
+        row_slice->step == Py_None ? 1 : PyLong_AsSsize_t(row_slice->step);
+
+    size_t start = _start < 0 ? rows + _start : (size_t)_start;
+    size_t stop = _stop < 0 ? rows + _stop : (size_t)_stop;
+
+    size_t step;
+    char reversed = 0;
+
+    if (_step < 0) {
+        reversed = 1;
+        step = (size_t)(-1 * _step);
+        if (row_slice->start != Py_None) {
+            start = rows - start - 1;
+        }
+        if (row_slice->stop != Py_None) {
+            stop = rows - stop - 1;
+        }
+    }
+    else {
+        step = (size_t)_step;
+    }
+
+    LazyCSV* first = (LazyCSV*)PyTuple_GET_ITEM(dataset->shards, 0);
+
+    return LazyCSV_DatasetIterNew(
+        self, col, start, stop, step, reversed, first->_table->prefetch
+    );
+}
+
+
+static PyMemberDef LazyCSV_DatasetMembers[] = {
+    {
+        "headers",
+        T_OBJECT,
+        offsetof(LazyCSV_Dataset, headers),
+        READONLY,
+        "header tuple"
+    },
+    {"rows", T_LONG, offsetof(LazyCSV_Dataset, rows), READONLY, "row length"},
+    {"cols", T_LONG, offsetof(LazyCSV_Dataset, cols), READONLY, "col length"},
+    {
+        "shards",
+        T_OBJECT,
+        offsetof(LazyCSV_Dataset, shards),
+        READONLY,
+        "tuple of LazyCSV objects, one per path"
+    },
+    {NULL, }
+};
+
+
+static PyMethodDef LazyCSV_DatasetMethods[] = {
+    {
+        "sequence",
+        (PyCFunction)LazyCSV_DatasetSeq,
+        METH_VARARGS|METH_KEYWORDS,
+        "get column iterator"
+    },
+    {NULL, }
+};
+
+
+static PyMappingMethods LazyCSV_DatasetMappingMembers = {
+    .mp_subscript = (binaryfunc)LazyCSV_DatasetGetItem,
+};
+
+
+PyDoc_STRVAR(
+    LazyCSV_DatasetDocstring,
+    "lazycsv.LazyCSVDataset(\n"
+    "    filepaths,\n"
+    "    /\n"
+    "    threads: int=1,\n"
+    "    **kwargs,\n"
+    ")\n"
+    "\n"
+    "A dataset of CSV files sharing the same headers, i.e. the\n"
+    "shards of an export. Each file is indexed as a LazyCSV,\n"
+    "using up to `threads` threads, after which the dataset can\n"
+    "be indexed and iterated over like a single LazyCSV whose\n"
+    "rows are the rows of each file in order."
+    "\n\n"
+    "Options\n"
+    "-------\n"
+    "threads: int=1 -- number of files indexed at once.\n"
+    "kwargs -- any other keyword argument of lazycsv.LazyCSV,\n"
+    "    applied to every file. The index files of every shard\n"
+    "    are kept in a single `index_dir`.\n"
+    "\n"
+    "Returns\n"
+    "-------\n"
+    "self\n"
+
+);
+
+
+static PyTypeObject LazyCSV_DatasetType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "lazycsv.lazycsv.LazyCSVDataset",
+    .tp_doc = LazyCSV_DatasetDocstring,
+    .tp_basicsize = sizeof(LazyCSV_Dataset),
+    .tp_dealloc = (destructor)LazyCSV_DatasetDestruct,
+    .tp_flags = Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE,
+    .tp_methods = LazyCSV_DatasetMethods,
+    .tp_members = LazyCSV_DatasetMembers,
+    .tp_as_mapping = &LazyCSV_DatasetMappingMembers,
+    .tp_new = LazyCSV_DatasetNew,
+};
+
+
+static PyObject* LazyCSV_DiffTables(PyObject* module, PyObject* args,
+                                    PyObject* kwargs) {
+    (void)module;
+    LazyCSV *old, *updated;
+    PyObject* _key_col = Py_None;
+    Py_ssize_t threads = 1;
+
+    static char* kwlist[] = {"", "", "key_col", "threads", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!|On", kwlist,
+                                     &LazyCSVType, &old, &LazyCSVType,
+                                     &updated, &_key_col, &threads))
+        return NULL;
+
+    if (threads < 1) {
+        PyErr_SetString(
+            PyExc_ValueError,
+            "threads cannot be less than 1"
+        );
         return NULL;
+    }
+
+    // a negative key_col counts back from the last column of each table,
+    // which must then have the same number of columns
+    size_t key_col = SIZE_MAX;
+    if (_key_col != Py_None) {
+        Py_ssize_t col = PyNumber_AsSsize_t(_key_col, PyExc_IndexError);
+        if (col == -1 && PyErr_Occurred())
+            return NULL;
+        if (col < 0 && old->cols != updated->cols) {
+            PyErr_SetString(
+                PyExc_ValueError,
+                "key_col cannot be negative for tables of different widths"
+            );
+            return NULL;
+        }
+        key_col = col < 0 ? old->cols + col : (size_t)col;
+    }
+
+    LazyCSV_Diff diff;
+    LazyCSV_Error error;
+    int failed;
 
-    PyObject* module = PyModule_Create(&LazyCSVModule);
-    if (!module)
+    Py_BEGIN_ALLOW_THREADS
+    failed = LazyCSV_TableDiff(old->_table, updated->_table, key_col, threads,
+                               &diff, &error);
+    Py_END_ALLOW_THREADS
+
+    if (failed) {
+        LazyCSV_RaiseError(&error);
         return NULL;
+    }
+
+    PyObject* added = LazyCSV_RowsAsObject(diff.added, diff.nadded);
+    PyObject* removed = added
+        ? LazyCSV_RowsAsObject(diff.removed, diff.nremoved)
+        : NULL;
+    PyObject* changed = removed
+        ? LazyCSV_RowsAsObject(diff.changed, diff.nchanged)
+        : NULL;
+    PyObject* result = changed
+        ? PyTuple_Pack(3, added, removed, changed)
+        : NULL;
+
+    Py_XDECREF(added);
+    Py_XDECREF(removed);
+    Py_XDECREF(changed);
+    LazyCSV_DiffFree(&diff);
+    return result;
+}
+
+
+static PyMethodDef LazyCSV_ModuleMethods[] = {
+    {
+        "diff",
+        (PyCFunction)LazyCSV_DiffTables,
+        METH_VARARGS|METH_KEYWORDS,
+        "rows added, removed and changed between two versions of a file"
+    },
+    {NULL, }
+};
+
+
+static int LazyCSV_ModuleExec(PyObject* module) {
+    if (PyType_Ready(&LazyCSVType) < 0)
+        return -1;
+
+    if (PyType_Ready(&LazyCSV_IterType) < 0)
+        return -1;
+
+    if (PyType_Ready(&LazyCSV_DatasetType) < 0)
+        return -1;
+
+    if (PyType_Ready(&LazyCSV_DatasetIterType) < 0)
+        return -1;
 
     Py_INCREF(&LazyCSVType);
-    PyModule_AddObject(module, "LazyCSV", (PyObject*)&LazyCSVType);
-    return module;
+    if (PyModule_AddObject(module, "LazyCSV", (PyObject*)&LazyCSVType) < 0) {
+        Py_DECREF(&LazyCSVType);
+        return -1;
+    }
+
+    Py_INCREF(&LazyCSV_DatasetType);
+    if (PyModule_AddObject(module, "LazyCSVDataset",
+                           (PyObject*)&LazyCSV_DatasetType) < 0) {
+        Py_DECREF(&LazyCSV_DatasetType);
+        return -1;
+    }
+
+    return 0;
 }
 
+
+// the module keeps no state of its own and its types are static and
+// immutable. Static types keep it to interpreters sharing the main
+// interpreter's GIL, the default. It doesn't declare Py_mod_gil, since not
+// every read of a table's caches and key indexes is synchronized with their
+// writers, so free-threaded builds enable the GIL when it is imported.
+
+static PyModuleDef_Slot LazyCSV_ModuleSlots[] = {
+    {Py_mod_exec, LazyCSV_ModuleExec},
+    {0, NULL}
+};
+
+
+static PyModuleDef LazyCSVModule = {
+    PyModuleDef_HEAD_INIT,
+    "lazycsv",
+    "module for custom lazycsv object",
+    0,
+    LazyCSV_ModuleMethods,
+    LazyCSV_ModuleSlots,
+};
+
+
+PyMODINIT_FUNC PyInit_lazycsv() {
+#if INCLUDE_NUMPY
+    import_array();
+#endif
+    return PyModuleDef_Init(&LazyCSVModule);
+}
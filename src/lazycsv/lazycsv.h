@@ -0,0 +1,350 @@
+#ifndef LAZYCSV_H
+#define LAZYCSV_H
+
+// the lazycsv C library. A table indexes a CSV file once into a set of index
+// files, after which any field can be read straight from the memory mapped
+// file, by row and column or through iterators over a column or a row. The
+// Python extension is a thin wrapper over this interface.
+//
+// Fields are returned as pointers into the file, or for compressed files into
+// a window of decompressed data, which stay valid until the next read from
+// the same table or iterator. Reads of one table may run concurrently from
+// different iterators, but not through LazyCSV_TableField.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LAZYCSV_INDEX_FLAT 0
+#define LAZYCSV_INDEX_COMPRESSED 1
+#define LAZYCSV_INDEX_ROWS 2
+
+#define LAZYCSV_OK 0
+#define LAZYCSV_ERROR_VALUE 1 // the file or options are invalid
+#define LAZYCSV_ERROR_NOT_FOUND 2 // the file couldn't be opened
+#define LAZYCSV_ERROR_RUNTIME 3 // a system call failed
+#define LAZYCSV_ERROR_MEMORY 4
+#define LAZYCSV_ERROR_READER 5 // the reader of a stream failed
+
+// the time of an empty value, as with numpy's NaT
+#define LAZYCSV_NAT INT64_MIN
+
+#define LAZYCSV_WARN_OVERFLOW 1 // rows with more fields were truncated
+#define LAZYCSV_WARN_UNDERFLOW 2 // rows with less fields were filled
+
+
+typedef struct LazyCSV_Table LazyCSV_Table;
+typedef struct LazyCSV_TableIter LazyCSV_TableIter;
+
+
+typedef struct {
+    int code;
+    const char* message;
+} LazyCSV_Error;
+
+
+typedef struct {
+    char delimiter;
+    char quotechar;
+    int skip_headers;
+    int unquote;
+    int index_mode;
+    size_t checkpoint_cols;
+    size_t buffer_capacity;
+    size_t readahead;
+    size_t prefetch;
+    int advice;
+    int populate;
+    int hugepages;
+} LazyCSV_TableOptions;
+
+
+// sizes of the index files and what was found while building them. Anchors
+// and the index timings are 0 where they don't apply, values and bytes served
+// are only counted when built with INCLUDE_COUNTERS=1, and include direct
+// lookups and iterators which have been freed.
+
+typedef struct {
+    size_t data_bytes;
+    size_t comma_bytes;
+    size_t anchor_bytes;
+    size_t newline_bytes;
+    size_t checkpoint_bytes;
+    size_t anchors;
+    size_t max_row_anchors;
+    size_t overflow_rows;
+    size_t underflow_rows;
+    size_t escaped_quotes;
+    double scan_seconds;
+    double flush_seconds;
+    double map_seconds;
+    size_t values_served;
+    size_t bytes_served;
+} LazyCSV_TableStats;
+
+
+// what another process needs to map an existing index without scanning the
+// data again, filled by LazyCSV_TableShareGet. Names point into the table
+// they were taken from, and the sizes guard against files which have since
+// been replaced. The remaining fields mirror the table.
+
+typedef struct {
+    const char* data_name;
+    const char* comma_name;
+    const char* anchor_name;
+    const char* newline_name;
+    const char* checkpoint_name; // NULL unless the data is compressed
+    size_t data_bytes;
+    size_t comma_bytes;
+    size_t anchor_bytes;
+    size_t newline_bytes;
+    size_t checkpoint_bytes;
+    size_t rows;
+    size_t cols;
+    size_t checkpoint_cols;
+    size_t prefetch;
+    size_t escaped_quotes;
+    int skip_headers;
+    int unquote;
+    int index_mode;
+    int codec;
+    int warnings;
+    char delimiter;
+    char quotechar;
+    char newline;
+} LazyCSV_TableShare;
+
+
+// the rows sharing a value of a key column, and the aggregates of the values
+// of another column in those rows which are numbers. `key` points into the
+// LazyCSV_Groups it belongs to. Without any numbers min and max are inf and
+// -inf.
+
+typedef struct {
+    const char* key;
+    size_t len;
+    size_t rows;
+    size_t count;
+    double sum;
+    double min;
+    double max;
+} LazyCSV_Group;
+
+
+typedef struct {
+    LazyCSV_Group* groups;
+    size_t count;
+    char* keys;
+} LazyCSV_Groups;
+
+
+// running aggregates of the values of a column which are numbers, `nulls`
+// counts those which aren't, and `finite_min` and `finite_max` bound those
+// which are finite. Finite values in [lo, hi] are also counted into `bins`
+// equal width buckets of `histogram`, unless it is NULL.
+
+typedef struct {
+    size_t count;
+    size_t nulls;
+    double sum;
+    double min;
+    double max;
+    double finite_min;
+    double finite_max;
+    size_t bins;
+    double lo;
+    double hi;
+    size_t* histogram;
+} LazyCSV_Reduction;
+
+
+// the rows added to and changed in an updated version of a table, as row
+// numbers of the updated table, and the rows removed from the old one, as
+// row numbers of the old table, each in ascending order.
+
+typedef struct {
+    size_t* added;
+    size_t nadded;
+    size_t* removed;
+    size_t nremoved;
+    size_t* changed;
+    size_t nchanged;
+} LazyCSV_Diff;
+
+
+// reads up to `size` bytes of a stream into `data`, returning the number of
+// bytes read, 0 at the end of the stream or -1 on failure.
+
+typedef ssize_t (*LazyCSV_Reader)(void *context, char *data, size_t size);
+
+
+void LazyCSV_TableOptionsInit(LazyCSV_TableOptions *options);
+
+LazyCSV_Table* LazyCSV_TableIndex(const char *path, const char *index_dir,
+                                  const LazyCSV_TableOptions *options,
+                                  LazyCSV_Error *error);
+
+LazyCSV_Table* LazyCSV_TableIndexStream(LazyCSV_Reader reader,
+                                        void *context,
+                                        const char *index_dir,
+                                        const LazyCSV_TableOptions *options,
+                                        LazyCSV_Error *error);
+
+
+// maps the files of a shared index read-only. Only the table which built an
+// index removes its files, so the builder has to outlive the tables attached
+// to it until they are mapped. `options` may be NULL, only its advice,
+// populate and hugepages fields are used.
+
+LazyCSV_Table* LazyCSV_TableAttach(const LazyCSV_TableShare *share,
+                                   const LazyCSV_TableOptions *options,
+                                   LazyCSV_Error *error);
+
+void LazyCSV_TableClose(LazyCSV_Table *table);
+
+size_t LazyCSV_TableRows(const LazyCSV_Table *table);
+size_t LazyCSV_TableCols(const LazyCSV_Table *table);
+int LazyCSV_TableWarnings(const LazyCSV_Table *table);
+const char* LazyCSV_TableDataName(const LazyCSV_Table *table);
+void LazyCSV_TableStatsGet(LazyCSV_Table *table, LazyCSV_TableStats *stats);
+void LazyCSV_TableShareGet(const LazyCSV_Table *table,
+                           LazyCSV_TableShare *share);
+
+int LazyCSV_TableHeader(LazyCSV_Table *table, size_t col, const char **data,
+                        size_t *len, LazyCSV_Error *error);
+
+int LazyCSV_TableField(LazyCSV_Table *table, size_t row, size_t col,
+                       const char **data, size_t *len, LazyCSV_Error *error);
+
+// builds a hash index of the values of `col`, written alongside the other
+// index files, after which LazyCSV_TableLookup finds the first row holding a
+// value with a few page reads. Building it again does nothing. The column is
+// read through an iterator of its own, but neither may run concurrently with
+// another build or lookup on the same table.
+
+int LazyCSV_TableKeyIndex(LazyCSV_Table *table, size_t col,
+                          LazyCSV_Error *error);
+
+// returns 1 and the first row of `col` holding `key`, compared unquoted and
+// unescaped, 0 if no row holds it, or -1.
+int LazyCSV_TableLookup(LazyCSV_Table *table, size_t col, const char *key,
+                        size_t len, size_t *row, LazyCSV_Error *error);
+
+// writes the rows of the table to `order`, which holds one per row, sorted
+// by their values in `col`. Values are compared as bytes, or with `numeric`
+// as numbers, after every number and in their original order if they aren't
+// one. Rows with equal values keep their order. Keys are read and sorted by
+// up to `threads` threads.
+
+int LazyCSV_TableArgsort(LazyCSV_Table *table, size_t col, int numeric,
+                         size_t threads, size_t *order, LazyCSV_Error *error);
+
+// groups the rows of the table by their value in `key_col`, compared
+// unquoted and unescaped, in order of the first row of each group. Values of
+// `value_col` are aggregated unless it is SIZE_MAX. Rows are read by up to
+// `threads` threads, each grouping a range of rows into a table of its own.
+
+int LazyCSV_TableGroupBy(LazyCSV_Table *table, size_t key_col,
+                         size_t value_col, size_t threads,
+                         LazyCSV_Groups *groups, LazyCSV_Error *error);
+
+void LazyCSV_GroupsFree(LazyCSV_Groups *groups);
+
+// reduces the values of `col` in rows `start` up to `stop` in constant
+// memory, split into ranges between up to `threads` threads. `bins`, `lo`,
+// `hi` and `histogram` are read from `reduction`, the rest is written.
+
+int LazyCSV_TableReduce(LazyCSV_Table *table, size_t col, size_t start,
+                        size_t stop, size_t threads,
+                        LazyCSV_Reduction *reduction, LazyCSV_Error *error);
+
+// compares the rows of `old` with those of `updated`, paired by the value of
+// `key_col` in each, or by their position when it is SIZE_MAX. Rows sharing a
+// key are paired in order. A row has changed when the bytes between the start
+// of its first field and the end of its last differ, which is decided by a
+// 64-bit hash of each, computed by up to `threads` threads per table.
+
+int LazyCSV_TableDiff(LazyCSV_Table *old, LazyCSV_Table *updated,
+                      size_t key_col, size_t threads, LazyCSV_Diff *diff,
+                      LazyCSV_Error *error);
+
+void LazyCSV_DiffFree(LazyCSV_Diff *diff);
+
+// writes up to `n` rows of the table to `rows`, drawn without replacement by
+// a generator seeded with `seed`, in ascending order, and their number to
+// `count`. Unless `stratify_col` is SIZE_MAX, the distinct values of that
+// column each get a share of the rows in proportion to the rows holding
+// them, which are read by up to `threads` threads.
+
+int LazyCSV_TableSample(LazyCSV_Table *table, size_t n, uint64_t seed,
+                        size_t stratify_col, size_t threads, size_t *rows,
+                        size_t *count, LazyCSV_Error *error);
+
+// writes `rows` of the table, or every row when NULL, to `fd` as CSV, with
+// only `cols`, or every column when NULL, preceded by the header row unless
+// `header` is 0 or headers are skipped. Fields are written as they are in
+// the data, quotes included, and runs of whole rows in order are copied
+// from file to file where the kernel supports it.
+
+int LazyCSV_TableWrite(LazyCSV_Table *table, int fd, const size_t *rows,
+                       size_t nrows, const size_t *cols, size_t ncols,
+                       int header, LazyCSV_Error *error);
+
+// writes the values of `col` to a column cache file, alongside the other
+// index files, from which iterators over the column then read them
+// sequentially rather than through the index. With `numeric` each value is
+// also stored as a number, for LazyCSV_TableIterNumbers. The data must not
+// have changed since the table was indexed, and the cache belongs to the
+// index, removed along with it. Caching a column again does nothing. May not
+// run concurrently with another cache being built, but iterators may, and
+// read a new cache from the next time they start.
+
+int LazyCSV_TableCacheColumn(LazyCSV_Table *table, size_t col, int numeric,
+                             LazyCSV_Error *error);
+
+LazyCSV_TableIter* LazyCSV_TableCol(LazyCSV_Table *table, size_t col);
+LazyCSV_TableIter* LazyCSV_TableRow(LazyCSV_Table *table, size_t row);
+
+// returns 1 and the next field, 0 once the iterator is exhausted, or -1
+int LazyCSV_TableIterNext(LazyCSV_TableIter *iter, const char **data,
+                          size_t *len, LazyCSV_Error *error);
+
+// quoted fields are returned without their outer quotes, but with any quotes
+// they contain still escaped as a pair of quotechars. Tables with none have
+// escaped_quotes of 0 in their stats. Copies the `len` bytes of `data` into
+// `dest` with each pair replaced by a single quotechar, and returns the
+// unescaped length. `dest` may be `data`.
+
+size_t LazyCSV_Unescape(char *dest, const char *data, size_t len,
+                        char quotechar);
+
+// reads up to the next `size` values of an iterator as numbers into
+// `numbers`, nan where a value isn't one, returning 0 or -1.
+int LazyCSV_TableIterNumbers(LazyCSV_TableIter *iter, double *numbers,
+                             size_t size, LazyCSV_Error *error);
+
+// reads up to the next `size` values of an iterator as times since the
+// epoch in UTC, in units of 1/`per_second` seconds, which divides 10**9.
+// Values are ISO 8601 dates, optionally with a time and a time zone, or
+// follow `format`, a subset of strptime: %Y %m %d %H %M %S %f %z %y %b and
+// %%. Empty values are LAZYCSV_NAT, any other which can't be parsed fails.
+
+int LazyCSV_TableIterTimes(LazyCSV_TableIter *iter, int64_t *times,
+                           size_t size, int64_t per_second,
+                           const char *format, LazyCSV_Error *error);
+
+// the values and bytes served so far, 0 unless built with INCLUDE_COUNTERS=1
+void LazyCSV_TableIterCounters(const LazyCSV_TableIter *iter, size_t *values,
+                               size_t *bytes);
+
+void LazyCSV_TableIterFree(LazyCSV_TableIter *iter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
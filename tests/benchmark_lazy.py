@@ -206,7 +206,8 @@ def main():
         print(f"writing rows: {i}/{rows}")
         tempf.flush()
         name = tempf.name
-        if input("copy to benchmarks? [Y/n]: ") in {"Y", ""}:
+        # kept for the next run when the benchmarks fixture directory exists
+        if os.path.isdir(os.path.dirname(filepath)):
             __import__("shutil").copyfile(tempf.name, filepath)
     path = os.path.abspath(name)
     print(f"filesize: {get_size(name, 'gb')}gb")
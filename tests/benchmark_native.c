@@ -0,0 +1,89 @@
+// benchmarks the lazycsv C library on its own, without the Python wrapper.
+//
+//     make bench && ./build/native/benchmark_native data.csv [flat|compressed|rows]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lazycsv.h"
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static int index_mode(const char *mode) {
+    if (!strcmp(mode, "flat")) return LAZYCSV_INDEX_FLAT;
+    if (!strcmp(mode, "compressed")) return LAZYCSV_INDEX_COMPRESSED;
+    if (!strcmp(mode, "rows")) return LAZYCSV_INDEX_ROWS;
+    return -1;
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s FILE [flat|compressed|rows]\n", argv[0]);
+        return 2;
+    }
+
+    LazyCSV_TableOptions options;
+    LazyCSV_TableOptionsInit(&options);
+
+    if (argc > 2 && (options.index_mode = index_mode(argv[2])) < 0) {
+        fprintf(stderr, "unknown index mode %s\n", argv[2]);
+        return 2;
+    }
+
+    LazyCSV_Error error;
+    const char *data;
+    size_t len, total = 0;
+
+    double ti = now();
+    LazyCSV_Table *table = LazyCSV_TableIndex(argv[1], NULL, &options,
+                                              &error);
+    if (!table) {
+        fprintf(stderr, "error: %s\n", error.message);
+        return 1;
+    }
+    double te = now();
+
+    size_t rows = LazyCSV_TableRows(table), cols = LazyCSV_TableCols(table);
+    printf("indexed %zu rows x %zu cols in %.3fs\n", rows, cols, te - ti);
+
+    for (size_t c = 0; c < cols; c++) {
+        LazyCSV_TableIter *iter = LazyCSV_TableCol(table, c);
+        while (LazyCSV_TableIterNext(iter, &data, &len, &error) > 0)
+            total += len;
+        LazyCSV_TableIterFree(iter);
+    }
+    double tc = now();
+    printf("read every column in %.3fs\n", tc - te);
+
+    for (size_t r = 0; r < rows; r++) {
+        LazyCSV_TableIter *iter = LazyCSV_TableRow(table, r);
+        while (LazyCSV_TableIterNext(iter, &data, &len, &error) > 0)
+            total += len;
+        LazyCSV_TableIterFree(iter);
+    }
+    double tr = now();
+    printf("read every row in %.3fs\n", tr - tc);
+
+    size_t lookups = 1000000;
+    srand(0);
+    for (size_t i = 0; i < lookups; i++) {
+        size_t r = (size_t)rand() % rows, c = (size_t)rand() % cols;
+        if (LazyCSV_TableField(table, r, c, &data, &len, &error) == 0)
+            total += len;
+    }
+    double tl = now();
+    printf("%zu random lookups in %.3fs\n", lookups, tl - tr);
+    printf("%zu bytes read\n", total);
+
+    LazyCSV_TableClose(table);
+    return 0;
+}
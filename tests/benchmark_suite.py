@@ -0,0 +1,244 @@
+"""
+Non-interactive benchmarks of lazycsv over a fixed set of generated shapes.
+
+Each shape is generated from a fixed seed and benchmarked in its own process
+so that peak RSS is measured per shape. Results are written as JSON, to stdout
+or to the file given by --output, so that runs can be compared across
+releases.
+
+    python tests/benchmark_suite.py --output results.json
+    python tests/benchmark_suite.py --shapes tall_narrow crlf --scale 0.1
+"""
+
+import argparse
+import glob
+import json
+import os
+import platform
+import random
+import resource
+import subprocess
+import sys
+import tempfile
+
+from time import perf_counter
+
+
+SEED = 0
+
+# rows and cols at scale 1.0, along with the options the file is indexed with
+SHAPES = {
+    "wide_sparse": {"rows": 20000, "cols": 2000},
+    "tall_narrow": {"rows": 2000000, "cols": 4},
+    "quoted_text": {"rows": 200000, "cols": 3},
+    "crlf": {"rows": 1000000, "cols": 8},
+    "custom_delimiter": {
+        "rows": 1000000,
+        "cols": 8,
+        "options": {"delimiter": "|", "quotechar": "'"},
+    },
+}
+
+# the number of columns and rows read to measure per-value read latency
+SAMPLE_COLS = 8
+SAMPLE_ROWS = 2000
+
+
+def write_wide_sparse(f, rng, rows, cols):
+    f.write(",".join(f"col_{j}" for j in range(cols)) + "\n")
+    for i in range(rows):
+        f.write(
+            ",".join(
+                f"{i}x{j}" if rng.random() > 0.95 else "" for j in range(cols)
+            )
+            + "\n"
+        )
+
+
+def write_tall_narrow(f, rng, rows, cols):
+    f.write(",".join(f"col_{j}" for j in range(cols)) + "\n")
+    for i in range(rows):
+        values = (str(rng.randrange(1000)) for _ in range(cols - 1))
+        f.write(f"{i}," + ",".join(values) + "\n")
+
+
+def write_quoted_text(f, rng, rows, cols):
+    words = ["lorem", "ipsum", "dolor", "sit", "amet", '""quoted""', "a,b"]
+    f.write("id,title,body\n")
+    for i in range(rows):
+        lines = (
+            " ".join(rng.choice(words) for _ in range(rng.randrange(5, 30)))
+            for _ in range(rng.randrange(1, 4))
+        )
+        body = "\n".join(lines)
+        f.write(f'{i},"title {i}","{body}"\n')
+
+
+def write_crlf(f, rng, rows, cols):
+    f.write(",".join(f"col_{j}" for j in range(cols)) + "\r\n")
+    for i in range(rows):
+        f.write(",".join(f"{rng.random():.6f}" for _ in range(cols)) + "\r\n")
+
+
+def write_custom_delimiter(f, rng, rows, cols):
+    f.write("|".join(f"col_{j}" for j in range(cols)) + "\n")
+    for i in range(rows):
+        f.write(
+            "|".join(
+                f"'{i}|{j}'" if rng.random() > 0.9 else str(rng.randrange(10**6))
+                for j in range(cols)
+            )
+            + "\n"
+        )
+
+
+WRITERS = {
+    "wide_sparse": write_wide_sparse,
+    "tall_narrow": write_tall_narrow,
+    "quoted_text": write_quoted_text,
+    "crlf": write_crlf,
+    "custom_delimiter": write_custom_delimiter,
+}
+
+
+def generate(shape, scale, data_dir):
+    spec = SHAPES[shape]
+    rows = max(1, int(spec["rows"] * scale))
+    cols = spec["cols"]
+    path = os.path.join(data_dir, f"{shape}_{rows}r_{cols}c_{SEED}.csv")
+    if not os.path.isfile(path):
+        rng = random.Random(f"{SEED}:{shape}")
+        with open(path + ".tmp", "w", newline="") as f:
+            WRITERS[shape](f, rng, rows, cols)
+        os.replace(path + ".tmp", path)
+    return path
+
+
+def read_latency(lazy, axis, indices):
+    values = 0
+    ti = perf_counter()
+    for i in indices:
+        for _ in lazy.sequence(**{axis: i}):
+            values += 1
+    te = perf_counter()
+    return (te - ti) / max(values, 1) * 1e9
+
+
+def materialize(lazy, cols, method):
+    values = 0
+    ti = perf_counter()
+    for c in cols:
+        values += len(getattr(lazy.sequence(col=c), method)())
+    te = perf_counter()
+    return values / (te - ti)
+
+
+def run_shape(shape, path, index_dir):
+    from lazycsv import lazycsv
+
+    options = SHAPES[shape].get("options", {})
+    file_bytes = os.path.getsize(path)
+
+    ti = perf_counter()
+    lazy = lazycsv.LazyCSV(path, index_dir=index_dir, **options)
+    te = perf_counter()
+
+    index_bytes = sum(
+        os.path.getsize(name) for name in glob.glob(os.path.join(index_dir, "Lzy*"))
+    )
+
+    rng = random.Random(SEED)
+    cols = sorted(rng.sample(range(lazy.cols), min(SAMPLE_COLS, lazy.cols)))
+    rows = sorted(rng.sample(range(lazy.rows), min(SAMPLE_ROWS, lazy.rows)))
+
+    result = {
+        "shape": shape,
+        "rows": lazy.rows,
+        "cols": lazy.cols,
+        "file_bytes": file_bytes,
+        "index_seconds": te - ti,
+        "index_gb_per_s": file_bytes / (te - ti) / 1e9,
+        "index_bytes": index_bytes,
+        "index_bytes_per_row": index_bytes / lazy.rows,
+        "col_read_ns_per_value": read_latency(lazy, "col", cols),
+        "row_read_ns_per_value": read_latency(lazy, "row", rows),
+        "to_list_values_per_s": materialize(lazy, cols, "to_list"),
+        "to_numpy_values_per_s": None,
+    }
+
+    if hasattr(lazy.sequence(col=0), "to_numpy"):
+        result["to_numpy_values_per_s"] = materialize(lazy, cols, "to_numpy")
+
+    del lazy
+
+    # ru_maxrss is in kilobytes on linux
+    result["peak_rss_bytes"] = (
+        resource.getrusage(resource.RUSAGE_SELF).ru_maxrss * 1024
+    )
+    return result
+
+
+def run_worker(shape, path):
+    with tempfile.TemporaryDirectory() as index_dir:
+        result = run_shape(shape, path, index_dir)
+    json.dump(result, sys.stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument(
+        "--shapes", nargs="+", choices=sorted(SHAPES), default=list(SHAPES)
+    )
+    parser.add_argument(
+        "--scale", type=float, default=1.0, help="multiplier of each shape's rows"
+    )
+    parser.add_argument(
+        "--data-dir", help="where generated files are kept between runs"
+    )
+    parser.add_argument("--output", help="JSON results file, default stdout")
+    parser.add_argument("--worker", nargs=2, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.worker:
+        return run_worker(*args.worker)
+
+    tempdir = None
+    data_dir = args.data_dir
+    if not data_dir:
+        tempdir = tempfile.TemporaryDirectory()
+        data_dir = tempdir.name
+    os.makedirs(data_dir, exist_ok=True)
+
+    results = []
+    for shape in args.shapes:
+        print(f"benchmarking {shape}...", file=sys.stderr)
+        path = generate(shape, args.scale, data_dir)
+        out = subprocess.run(
+            [sys.executable, __file__, "--worker", shape, path],
+            check=True,
+            stdout=subprocess.PIPE,
+        )
+        results.append(json.loads(out.stdout))
+
+    report = {
+        "seed": SEED,
+        "scale": args.scale,
+        "python": platform.python_version(),
+        "platform": platform.platform(),
+        "machine": platform.machine(),
+        "results": results,
+    }
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    if tempdir:
+        tempdir.cleanup()
+
+
+if __name__ == "__main__":
+    main()
@@ -1,9 +1,21 @@
+import collections
+import concurrent.futures
 import contextlib
 import csv
+import datetime
+import gc
+import gzip
+import io
+import math
+import multiprocessing
 import os
 import os.path
+import pickle
+import random
+import subprocess
 import tempfile
 import textwrap
+import threading
 
 from lazycsv import lazycsv
 
@@ -43,6 +55,11 @@ def file_1000r_1000c():
     tempf.close()
 
 
+def read_shared_col(args):
+    lazy, col = args
+    return lazy.sequence(col=col).to_list()
+
+
 @contextlib.contextmanager
 def prepped_file(actual):
     tempf = tempfile.NamedTemporaryFile()
@@ -70,7 +87,7 @@ class TestLazyCSV:
         with pytest.raises(ValueError) as err:
             _ = lazycsv.LazyCSV(1)
         (_str,) = err.value.args
-        assert _str == "first argument must be str or bytes"
+        assert _str == "first argument must be str, bytes or a binary file object"
 
     def test_more_headers(self):
         actual = b"INDEX,,AA,B,CC,D,EE\n0,1,2,3,4,5,6\n"
@@ -116,6 +133,7 @@ class TestLazyCSV:
                 expected = list(range(10))[_slice]
                 actual = list(map(int, lazy[_slice, 0]))
                 assert actual == expected
+                assert list(map(int, lazy[_slice, 0].to_list())) == expected
 
     def test_get_actual_col(self):
         actual = b"INDEX,ATTR\n0,a\n1,b\n2,c\n3,d\n"
@@ -167,6 +185,7 @@ class TestLazyCSV:
                 expected = list(range(10))[_slice]
                 actual = list(map(int, lazy[0, _slice]))
                 assert actual == expected
+                assert list(map(int, lazy[0, _slice].to_list())) == expected
 
     def test_get_row_slice_skipped_headers(self):
         actual = b"A,B,C,D,E,F,G,H,I,J\n0,1,2,3,4,5,6,7,8,9\n"
@@ -340,6 +359,29 @@ class TestLazyCSVOptions:
         actual = [list(lazy.sequence(col=i)) for i in range(lazy.cols)]
         assert actual == [[b"0"], [b'"Goo,Bar\n"'], [b'"Bizz,Bazz"']]
 
+    @pytest.mark.parametrize("index_mode", ["flat", "compressed", "rows"])
+    def test_escaped_quotes(self, index_mode):
+        data = b'a,"b ""x"""\n"""",1\n"say ""hi"", ok",""\nplain,"""a,b"""\n'
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode=index_mode)
+            expected = list(csv.reader(io.StringIO(data.decode())))
+            assert lazy.headers == tuple(v.encode() for v in expected[0])
+            actual = [lazy.sequence(row=i).to_list() for i in range(lazy.rows)]
+            assert actual == [[v.encode() for v in r] for r in expected[1:]]
+            assert lazy.stats()["escaped_quotes"] == 7
+            assert lazy[1, 0] == b'say "hi", ok'
+
+            lazy = lazycsv.LazyCSV(tempf.name, encoding="utf-8")
+            assert lazy[2, 1] == '"a,b"'
+            lazy = lazycsv.LazyCSV(tempf.name, unquote=False)
+            assert lazy[2, 1] == b'"""a,b"""'
+
+    def test_escaped_quotes_shared(self):
+        with prepped_file(b'a,b\n"x""y",1\n') as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            shared = lazycsv.LazyCSV.attach(lazy.share())
+            assert shared[0, 0] == b'x"y'
+
     def test_buffer_size(self):
         lazy = lazycsv.LazyCSV(FPATH, buffer_size=1024)
         actual = list(lazy.sequence(col=0))
@@ -356,6 +398,1321 @@ class TestLazyCSVOptions:
         assert len(os.listdir(tempdir.name)) == 3
 
 
+class TestAccessHints:
+    @pytest.mark.parametrize("access", ["normal", "sequential", "random", "willneed"])
+    def test_access(self, access):
+        lazy = lazycsv.LazyCSV(FPATH, access=access)
+        assert list(lazy.sequence(col=1)) == [b"a0", b"a1"]
+
+    def test_bad_access(self):
+        with pytest.raises(ValueError) as err:
+            lazycsv.LazyCSV(FPATH, access="sometimes")
+        assert err.value.args == (
+            "access must be one of 'normal', 'sequential', 'random' or 'willneed'",
+        )
+
+    def test_populate_hugepages(self, file_1000r_1000c):
+        lazy = lazycsv.LazyCSV(file_1000r_1000c.name, populate=True, hugepages=True)
+        assert list(lazy.sequence(col=999)) == [b"999"] * 1000
+
+    def test_negative_prefetch(self):
+        with pytest.raises(ValueError):
+            lazycsv.LazyCSV(FPATH, prefetch=-1)
+
+    def test_prefetch(self, file_1000r_1000c):
+        lazy = lazycsv.LazyCSV(file_1000r_1000c.name, prefetch=16)
+        assert list(lazy.sequence(col=500)) == [b"500"] * 1000
+        assert list(lazy.sequence(col=1, reversed=True)) == [b"1"] * 1000
+        assert list(lazy[::7, 3]) == [b"3"] * len(range(0, 1000, 7))
+        assert list(lazy[::-3, 3]) == [b"3"] * len(range(0, 1000, 3))
+        assert lazy.sequence(row=999).to_list() == [str(i).encode() for i in range(1000)]
+
+    def test_sequence_prefetch(self, file_1000r_1000c):
+        lazy = lazycsv.LazyCSV(file_1000r_1000c.name)
+        assert lazy.sequence(col=10, prefetch=1).to_list() == [b"10"] * 1000
+        assert lazy.sequence(col=10, prefetch=5000).to_list() == [b"10"] * 1000
+        assert list(lazy.sequence(row=0, prefetch=8, reversed=True))[0] == b"999"
+
+
+class TestReadahead:
+    FIXTURES = [
+        "file.csv",
+        "file_crlf.csv",
+        "file_crlf2.csv",
+        "file_empty.csv",
+        "file_newline.csv",
+    ]
+
+    @staticmethod
+    def materialize(lazy):
+        return (
+            lazy.headers,
+            [list(lazy.sequence(col=i)) for i in range(lazy.cols)],
+        )
+
+    @pytest.mark.parametrize("fixture", FIXTURES)
+    @pytest.mark.parametrize("readahead", [1, 2, 3, 7, 2**20])
+    def test_fixtures(self, fixture, readahead):
+        fpath = os.path.join(HERE, "fixtures", fixture)
+        expected = self.materialize(lazycsv.LazyCSV(fpath, unquote=False))
+        actual = self.materialize(
+            lazycsv.LazyCSV(fpath, unquote=False, readahead=readahead)
+        )
+        assert actual == expected
+
+    @pytest.mark.parametrize("readahead", [1, 5, 64])
+    def test_overflow_and_underflow(self, readahead):
+        data = b"x,y,z\r\n1,2\r\n3,1,3,4,5\r\n6,7,8"
+        with prepped_file(data) as tempf, pytest.warns(RuntimeWarning):
+            lazy = lazycsv.LazyCSV(tempf.name, readahead=readahead)
+            actual = self.materialize(lazy)
+        assert actual == (
+            (b"x", b"y", b"z"),
+            [[b"1", b"3", b"6"], [b"2", b"1", b"7"], [b"", b"3", b"8"]],
+        )
+
+    def test_big_file(self, file_1000r_1000c):
+        lazy = lazycsv.LazyCSV(file_1000r_1000c.name, readahead=4096)
+        assert lazy.sequence(col=999).to_list() == [b"999"] * 1000
+        assert lazy.headers[-1] == b"col_999"
+
+    def test_negative_readahead(self):
+        with pytest.raises(ValueError):
+            lazycsv.LazyCSV(FPATH, readahead=-1)
+
+
+class TestStreams:
+    def test_bytesio(self):
+        with open(FPATH, "rb") as f:
+            stream = io.BytesIO(f.read())
+        lazy = lazycsv.LazyCSV(stream)
+        assert lazy.headers == (b"", b"ALPHA", b"BETA")
+        assert list(lazy.sequence(col=1)) == [b"a0", b"a1"]
+        assert lazy[-1, -1] == b"b1"
+
+    def test_pipe(self, file_1000r_1000c):
+        proc = subprocess.Popen(["cat", file_1000r_1000c.name], stdout=subprocess.PIPE)
+        lazy = lazycsv.LazyCSV(proc.stdout, readahead=4099)
+        proc.wait()
+        expected = lazycsv.LazyCSV(file_1000r_1000c.name)
+        assert lazy.headers == expected.headers
+        assert lazy.sequence(col=999).to_list() == expected.sequence(col=999).to_list()
+        assert lazy.sequence(row=500).to_list() == expected.sequence(row=500).to_list()
+
+    def test_read_only_stream(self):
+        class Reader:
+            def __init__(self, data):
+                self.stream = io.BytesIO(data)
+
+            def read(self, size):
+                return self.stream.read(min(size, 3))
+
+        lazy = lazycsv.LazyCSV(Reader(b"INDEX,ATTR\r\n0,a\r\n1,b"))
+        assert lazy.headers == (b"INDEX", b"ATTR")
+        assert list(lazy.sequence(col=1)) == [b"a", b"b"]
+
+    def test_non_blocking_stream(self):
+        r, w = os.pipe()
+        os.write(w, b"a,b\n1,2\n")
+        os.set_blocking(r, False)
+        with open(r, "rb", buffering=0) as reader:
+            with pytest.raises(ValueError) as err:
+                lazycsv.LazyCSV(reader)
+        os.close(w)
+        assert err.value.args == ("stream must be blocking",)
+
+    def test_text_stream(self):
+        with pytest.raises(TypeError):
+            lazycsv.LazyCSV(io.StringIO("a,b\n1,2\n"))
+
+    def test_empty_stream(self):
+        with pytest.raises(ValueError) as err:
+            lazycsv.LazyCSV(io.BytesIO(b""))
+        assert err.value.args == ("unable to index an empty file",)
+
+    def test_spooled_data_file(self):
+        tempdir = tempfile.TemporaryDirectory()
+        lazy = lazycsv.LazyCSV(io.BytesIO(b"a,b\n1,2\n"), index_dir=tempdir.name)
+        assert len(os.listdir(tempdir.name)) == 4
+        with open(lazy.name, "rb") as f:
+            assert f.read() == b"a,b\n1,2\n"
+        del lazy
+        gc.collect()
+        assert os.listdir(tempdir.name) == []
+
+
+class TestCompression:
+    FIXTURES = TestReadahead.FIXTURES
+
+    @staticmethod
+    def lazy_or_skip(path, **kwargs):
+        try:
+            return lazycsv.LazyCSV(path, **kwargs)
+        except ValueError as err:
+            if "LAZYCSV_INCLUDE_" in str(err):
+                pytest.skip(str(err))
+            raise
+
+    @pytest.mark.parametrize("fixture", FIXTURES)
+    def test_gzip_fixtures(self, fixture):
+        fpath = os.path.join(HERE, "fixtures", fixture)
+        expected = TestReadahead.materialize(lazycsv.LazyCSV(fpath, unquote=False))
+        with open(fpath, "rb") as f, prepped_file(gzip.compress(f.read())) as tempf:
+            lazy = self.lazy_or_skip(tempf.name, unquote=False)
+            assert TestReadahead.materialize(lazy) == expected
+
+    def test_gzip_members(self, file_1000r_1000c):
+        with open(file_1000r_1000c.name, "rb") as f:
+            data = f.read()
+        members = b"".join(
+            gzip.compress(data[i : i + 999999]) for i in range(0, len(data), 999999)
+        )
+        with prepped_file(members) as tempf:
+            lazy = self.lazy_or_skip(tempf.name)
+            assert lazy.headers[-1] == b"col_999"
+            assert lazy.sequence(col=999).to_list() == [b"999"] * 1000
+            assert lazy[-1, :].to_list() == [b"%d" % i for i in range(1000)]
+
+    def test_gzip_random_access(self, file_1000r_1000c):
+        with open(file_1000r_1000c.name, "rb") as f:
+            data = f.read()
+        expected = lazycsv.LazyCSV(file_1000r_1000c.name)
+        with prepped_file(gzip.compress(data)) as tempf:
+            lazy = self.lazy_or_skip(tempf.name)
+            for row in (999, 0, 500, 250, 998):
+                assert lazy[row, row] == expected[row, row]
+            assert lazy[::-3, 7].to_list() == expected[::-3, 7].to_list()
+            assert lazy[700, ::-1].to_list() == expected[700, ::-1].to_list()
+            np.testing.assert_array_equal(
+                lazy.sequence(col=3).to_numpy(), expected.sequence(col=3).to_numpy()
+            )
+
+    def test_gzip_index_files(self):
+        tempdir = tempfile.TemporaryDirectory()
+        with prepped_file(gzip.compress(b"a,b\n1,2\n")) as tempf:
+            lazy = self.lazy_or_skip(tempf.name, index_dir=tempdir.name)
+            assert len(os.listdir(tempdir.name)) == 4
+            assert lazy[0, 1] == b"2"
+            del lazy
+            gc.collect()
+        assert os.listdir(tempdir.name) == []
+
+    def test_gzip_corrupt(self):
+        data = gzip.compress(b"a,b\n1,2\n" * 1000)
+        with prepped_file(data[: len(data) // 2]) as tempf, pytest.raises(ValueError):
+            self.lazy_or_skip(tempf.name)
+
+    def test_zstd_frames(self, file_1000r_1000c):
+        zstandard = pytest.importorskip("zstandard")
+        with open(file_1000r_1000c.name, "rb") as f:
+            data = f.read()
+        frames = b"".join(
+            zstandard.ZstdCompressor().compress(data[i : i + 999999])
+            for i in range(0, len(data), 999999)
+        )
+        expected = lazycsv.LazyCSV(file_1000r_1000c.name)
+        with prepped_file(frames) as tempf:
+            lazy = self.lazy_or_skip(tempf.name)
+            assert lazy.headers == expected.headers
+            assert lazy[::-1, 999].to_list() == expected[::-1, 999].to_list()
+            assert lazy[123, 456] == expected[123, 456]
+
+
+class TestDataset:
+    @pytest.fixture
+    def shards(self):
+        tempdir = tempfile.TemporaryDirectory()
+        rows, paths = [], []
+        for shard, count in enumerate([3, 0, 1, 250, 7]):
+            shard_rows = [[b"%d_%d_%d" % (shard, i, j) for j in range(3)] for i in range(count)]
+            path = os.path.join(tempdir.name, "shard_%d.csv" % shard)
+            with open(path, "wb") as f:
+                f.write(b"x,y,z\n" + b"".join(b",".join(r) + b"\n" for r in shard_rows))
+            rows.extend(shard_rows)
+            paths.append(path)
+        yield paths, rows
+        tempdir.cleanup()
+
+    @pytest.mark.parametrize("threads", [1, 2, 8])
+    def test_sequence(self, shards, threads):
+        paths, rows = shards
+        dataset = lazycsv.LazyCSVDataset(paths, threads=threads)
+        assert dataset.headers == (b"x", b"y", b"z")
+        assert (dataset.rows, dataset.cols) == (len(rows), 3)
+        assert len(dataset.shards) == len(paths)
+        for col in range(3):
+            expected = [r[col] for r in rows]
+            assert list(dataset.sequence(col=col)) == expected
+            assert dataset.sequence(col=col, reversed=True).to_list() == expected[::-1]
+            if hasattr(dataset.sequence(col=col), "to_numpy"):
+                np.testing.assert_array_equal(
+                    dataset.sequence(col=col).to_numpy(), np.array(expected)
+                )
+
+    @pytest.mark.parametrize(
+        "key", [slice(None, None, 7), slice(2, 200, 3), slice(None, None, -4), slice(-9, None)]
+    )
+    def test_slices(self, shards, key):
+        paths, rows = shards
+        dataset = lazycsv.LazyCSVDataset(paths)
+        assert dataset[key, 1].to_list() == [r[1] for r in rows][key]
+        assert list(dataset[key, -1]) == [r[-1] for r in rows][key]
+
+    def test_getitem(self, shards):
+        paths, rows = shards
+        dataset = lazycsv.LazyCSVDataset(paths)
+        for row in (0, 2, 3, 4, 253, -1, -8):
+            assert dataset[row, 2] == rows[row][2]
+            assert dataset[row, :].to_list() == rows[row]
+            assert dataset.sequence(row=row % len(rows)).to_list() == rows[row]
+        with pytest.raises(ValueError):
+            dataset[len(rows), 0]
+
+    def test_mismatched_headers(self, shards):
+        paths, _ = shards
+        with prepped_file(b"x,y\n1,2\n") as tempf, pytest.raises(ValueError):
+            lazycsv.LazyCSVDataset([*paths, tempf.name])
+
+    def test_index_files(self, shards):
+        paths, _ = shards
+        tempdir = tempfile.TemporaryDirectory()
+        dataset = lazycsv.LazyCSVDataset(paths, index_dir=tempdir.name, threads=3)
+        assert len(os.listdir(tempdir.name)) == 3 * len(paths)
+        del dataset
+        gc.collect()
+        assert os.listdir(tempdir.name) == []
+
+    def test_failed_shard(self, shards):
+        paths, _ = shards
+        tempdir = tempfile.TemporaryDirectory()
+        with pytest.raises(FileNotFoundError):
+            lazycsv.LazyCSVDataset(
+                [*paths, "does_not_exist.csv"], index_dir=tempdir.name, threads=2
+            )
+        gc.collect()
+        assert os.listdir(tempdir.name) == []
+
+    def test_bad_args(self):
+        with pytest.raises(ValueError):
+            lazycsv.LazyCSVDataset([])
+        with pytest.raises(ValueError):
+            lazycsv.LazyCSVDataset([FPATH], threads=0)
+        with pytest.raises(ValueError):
+            lazycsv.LazyCSVDataset([io.BytesIO(b"a\n1\n")])
+
+
+class TestRowIndex:
+    def test_tall_file(self):
+        rows = [f"{i},{'x' * (i % 300)}" for i in range(1000)]
+        data = ("a,b\n" + "\n".join(rows) + "\n").encode()
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            assert lazy.rows == 1000
+            expected = [r.split(",")[1].encode() for r in rows]
+            assert list(lazy.sequence(col=1)) == expected
+            assert list(lazy[::-1, 1]) == expected[::-1]
+            for i in (0, 63, 64, 65, 127, 128, 500, 999, -1, -64, -65):
+                assert lazy[i, 0] == rows[i].split(",")[0].encode()
+                assert list(lazy[i, :]) == [x.encode() for x in rows[i].split(",")]
+
+    def test_long_fields(self):
+        fields = [b"y" * n for n in (0, 255, 256, 1000, 70000, 3)]
+        data = b"a,b,c\n" + b"\n".join(b",".join((f, f, f)) for f in fields)
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            for c in range(3):
+                assert list(lazy.sequence(col=c)) == fields
+
+    def test_quoted_line_endings(self):
+        for sep in ("\n", "\r", "\r\n"):
+            data = f'a,b{sep}"x{sep}y",1{sep}z,"2{sep}"{sep}'.encode()
+            with prepped_file(data) as tempf:
+                lazy = lazycsv.LazyCSV(tempf.name)
+                assert lazy.rows == 2
+                actual = [list(lazy[i, :]) for i in range(lazy.rows)]
+            assert actual == [
+                [f"x{sep}y".encode(), b"1"],
+                [b"z", f"2{sep}".encode()],
+            ]
+
+    def test_mixed_line_endings(self):
+        data = b"a,b\r\n1,2\r3,4\r\n5,6"
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            actual = [list(lazy[i, :]) for i in range(lazy.rows)]
+        assert actual == [[b"1", b"2"], [b"3", b"4"], [b"5", b"6"]]
+
+
+class TestCompressedIndex:
+    def as_lists(self, lazy):
+        cols = [list(lazy.sequence(col=i)) for i in range(lazy.cols)]
+        rows = [lazy.sequence(row=i).to_list() for i in range(lazy.rows)]
+        return lazy.headers, cols, rows
+
+    def test_matches_flat(self, file_1000r_1000c):
+        for path in (FPATH, file_1000r_1000c.name):
+            flat = lazycsv.LazyCSV(path)
+            compressed = lazycsv.LazyCSV(path, index_mode="compressed")
+            assert self.as_lists(compressed) == self.as_lists(flat)
+
+    def test_mixed_widths(self):
+        fields = [b"", b"x" * 3, b"y" * 300, b"z" * 70000, b"", b"1"]
+        rows = [[fields[(i + j) % len(fields)] for j in range(5)] for i in range(60)]
+        data = b"a,b,c,d,e\n" + b"\n".join(b",".join(r) for r in rows)
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode="compressed")
+            assert [lazy.sequence(row=i).to_list() for i in range(60)] == rows
+            assert list(lazy[::-1, 3]) == [r[3] for r in rows][::-1]
+            assert list(lazy[59, ::-1]) == rows[59][::-1]
+            assert lazy[-1, -1] == rows[-1][-1]
+
+    def test_sparse(self):
+        data = b"a,b,c\n" + b",,\n" * 1000 + b"1,,2"
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode="compressed")
+            assert list(lazy.sequence(col=0)) == [b""] * 1000 + [b"1"]
+            assert list(lazy.sequence(col=2)) == [b""] * 1000 + [b"2"]
+
+    def test_dataset(self):
+        data = b"a,b\n0,1\n2,3\n"
+        with prepped_file(data) as f0, prepped_file(data) as f1:
+            dataset = lazycsv.LazyCSVDataset(
+                [f0.name, f1.name], index_mode="compressed"
+            )
+            assert dataset.sequence(col=1).to_list() == [b"1", b"3"] * 2
+
+    def test_bad_index_mode(self):
+        with pytest.raises(ValueError) as err:
+            lazycsv.LazyCSV(FPATH, index_mode="sparse")
+        assert err.value.args == (
+            "index_mode must be one of 'flat', 'compressed' or 'rows'",
+        )
+
+
+class TestRowsIndex:
+    def as_lists(self, lazy):
+        cols = [list(lazy.sequence(col=i)) for i in range(lazy.cols)]
+        rows = [lazy.sequence(row=i).to_list() for i in range(lazy.rows)]
+        return lazy.headers, cols, rows
+
+    @pytest.mark.parametrize("checkpoint_cols", [0, 1, 7])
+    def test_matches_flat(self, file_1000r_1000c, checkpoint_cols):
+        for path in (FPATH, file_1000r_1000c.name):
+            flat = lazycsv.LazyCSV(path)
+            rows = lazycsv.LazyCSV(
+                path, index_mode="rows", checkpoint_cols=checkpoint_cols
+            )
+            assert self.as_lists(rows) == self.as_lists(flat)
+
+    def test_quoted_fields(self):
+        data = b'a,b,c\n"x,\ny",2,"z""z"\n3,"4\r",5\n'
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(
+                tempf.name, index_mode="rows", checkpoint_cols=1, unquote=False
+            )
+            assert lazy.sequence(row=0).to_list() == [b'"x,\ny"', b"2", b'"z""z"']
+            assert lazy.sequence(row=1).to_list() == [b"3", b'"4\r"', b"5"]
+            assert list(lazy[::-1, 2]) == [b"5", b'"z""z"']
+
+    def test_underflow_checkpoints(self):
+        data = b"a,b,c,d\n1,2\n3,4,5,6\n7"
+        with prepped_file(data) as tempf, pytest.warns(RuntimeWarning):
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode="rows", checkpoint_cols=2)
+            assert lazy[0, 3] == lazy[2, 2] == b""
+            assert lazy.sequence(row=0).to_list() == [b"1", b"2", b"", b""]
+            assert lazy.sequence(row=2).to_list() == [b"7", b"", b"", b""]
+            assert lazy[1, 3] == b"6"
+
+    def test_dataset(self):
+        data = b"a,b\n0,1\n2,3\n"
+        with prepped_file(data) as f0, prepped_file(data) as f1:
+            dataset = lazycsv.LazyCSVDataset([f0.name, f1.name], index_mode="rows")
+            assert dataset.sequence(col=1).to_list() == [b"1", b"3"] * 2
+
+    def test_bad_checkpoint_cols(self):
+        with pytest.raises(ValueError) as err:
+            lazycsv.LazyCSV(FPATH, index_mode="rows", checkpoint_cols=-1)
+        assert err.value.args == ("checkpoint_cols cannot be less than 0",)
+
+
+class TestStats:
+    KEYS = {
+        "data_bytes",
+        "comma_bytes",
+        "anchor_bytes",
+        "newline_bytes",
+        "checkpoint_bytes",
+        "anchors",
+        "max_row_anchors",
+        "overflow_rows",
+        "underflow_rows",
+        "escaped_quotes",
+        "scan_seconds",
+        "flush_seconds",
+        "mmap_seconds",
+        "headers_seconds",
+    }
+
+    def test_index_sizes(self):
+        with tempfile.TemporaryDirectory() as index_dir:
+            lazy = lazycsv.LazyCSV(FPATH, index_dir=index_dir)
+            stats = lazy.stats()
+            assert self.KEYS <= set(stats)
+            sizes = {
+                name[:4]: os.path.getsize(os.path.join(index_dir, name))
+                for name in os.listdir(index_dir)
+            }
+            assert stats["comma_bytes"] == sizes["LzyC"]
+            assert stats["newline_bytes"] == sizes["LzyN"]
+            assert stats["data_bytes"] == os.path.getsize(FPATH)
+            assert stats["checkpoint_bytes"] == 0
+            assert all(stats[k] >= 0 for k in self.KEYS if k.endswith("seconds"))
+
+    def test_malformed_rows(self):
+        data = b"a,b,c\n1,2\n3,4,5,6\n7,8,9\n"
+        with prepped_file(data) as tempf, pytest.warns(RuntimeWarning):
+            stats = lazycsv.LazyCSV(tempf.name).stats()
+        assert stats["overflow_rows"] == 1
+        assert stats["underflow_rows"] == 1
+        assert stats["escaped_quotes"] == 0
+
+    def test_long_row_anchors(self):
+        # the flat comma index of two rows of two fields holds six values, and
+        # only fields longer than those can hold need anchors
+        with prepped_file(b"a,b\n1,2\n") as tempf:
+            width = lazycsv.LazyCSV(tempf.name).stats()["comma_bytes"] // 6
+        if width > 2:
+            pytest.skip("index dtype wider than uint16_t")
+        data = b"a,b\n" + b"x" * (256**width + 1000) + b",y\n"
+        with prepped_file(data) as tempf:
+            stats = lazycsv.LazyCSV(tempf.name).stats()
+        assert stats["anchors"] >= 1
+        assert stats["max_row_anchors"] >= 1
+
+    def test_counters(self, lazy):
+        iterator = lazy.sequence(col=1)
+        if not hasattr(iterator, "stats"):
+            pytest.skip("built without LAZYCSV_INCLUDE_COUNTERS")
+        assert iterator.to_list() == [b"a0", b"a1"]
+        assert iterator.stats() == {"values_served": 2, "bytes_served": 4}
+        del iterator
+        assert lazy[0, 0] == b"0"
+        stats = lazy.stats()
+        assert stats["values_served"] == 3
+        assert stats["bytes_served"] == 5
+
+
+class TestShare:
+    @pytest.mark.parametrize(
+        "options",
+        [{}, {"index_mode": "compressed"}, {"index_mode": "rows"}],
+    )
+    def test_pickle(self, file_1000r_1000c, options):
+        lazy = lazycsv.LazyCSV(file_1000r_1000c.name, **options)
+        shared = pickle.loads(pickle.dumps(lazy))
+        assert shared.headers == lazy.headers
+        assert (shared.rows, shared.cols) == (lazy.rows, lazy.cols)
+        assert shared.sequence(row=999).to_list() == lazy.sequence(row=999).to_list()
+        assert list(shared[::-1, 500]) == list(lazy[::-1, 500])
+
+    def test_pool(self):
+        lazy = lazycsv.LazyCSV(FPATH)
+        with multiprocessing.get_context("spawn").Pool(2) as pool:
+            cols = pool.map(read_shared_col, [(lazy, i) for i in range(lazy.cols)])
+        assert cols == [[b"0", b"1"], [b"a0", b"a1"], [b"b0", b"b1"]]
+
+    def test_owner_removes_files(self):
+        with tempfile.TemporaryDirectory() as index_dir:
+            lazy = lazycsv.LazyCSV(FPATH, index_dir=index_dir)
+            shared = lazycsv.LazyCSV.attach(lazy.share())
+            del shared
+            gc.collect()
+            assert len(os.listdir(index_dir)) == 3
+
+            pid = os.fork()
+            if not pid:
+                del lazy
+                os._exit(0)
+            os.waitpid(pid, 0)
+            assert len(os.listdir(index_dir)) == 3
+
+            share = lazy.share()
+            del lazy
+            gc.collect()
+            assert os.listdir(index_dir) == []
+            with pytest.raises(FileNotFoundError):
+                lazycsv.LazyCSV.attach(share)
+
+    def test_relative_paths(self, tmp_path, monkeypatch):
+        (tmp_path / "index").mkdir()
+        (tmp_path / "file.csv").write_bytes(b"a,b\n1,2\n")
+        monkeypatch.chdir(tmp_path)
+        lazy = lazycsv.LazyCSV("file.csv", index_dir="index")
+        share = lazy.share()
+        monkeypatch.chdir(tmp_path / "index")
+        shared = lazycsv.LazyCSV.attach(share)
+        assert shared.sequence(row=0).to_list() == [b"1", b"2"]
+        assert all(os.path.isabs(name) for name in share[:6] if name)
+
+    def test_stream(self):
+        lazy = lazycsv.LazyCSV(io.BytesIO(b"a,b\n1,2\n"))
+        shared = lazycsv.LazyCSV.attach(lazy.share())
+        assert shared.name == lazy.name
+        assert shared.sequence(row=0).to_list() == [b"1", b"2"]
+
+    def test_changed_files(self):
+        with prepped_file(b"a,b\n1,2\n") as tempf:
+            # the owner is kept alive so that its index files remain
+            lazy = lazycsv.LazyCSV(tempf.name)
+            share = lazy.share()
+            tempf.write(b"3,4\n")
+            tempf.flush()
+            with pytest.raises(ValueError) as err:
+                lazycsv.LazyCSV.attach(share)
+        assert err.value.args == (
+            "shared index file has changed since it was shared",
+        )
+
+    def test_bad_share(self):
+        with pytest.raises(ValueError) as err:
+            lazycsv.LazyCSV.attach((b"file.csv",))
+        assert err.value.args == (
+            "argument must be a tuple returned by LazyCSV.share()",
+        )
+
+
+class TestKeyIndex:
+    @pytest.mark.parametrize("index_mode", ["flat", "compressed", "rows"])
+    def test_lookup(self, index_mode):
+        keys = [b"%d" % (i * 7919 % 5000) for i in range(5000)]
+        data = b"id,value\n" + b"".join(b"%s,v%d\n" % (k, i) for i, k in enumerate(keys))
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode=index_mode)
+            lazy.build_key_index(0)
+            for i, key in enumerate(keys):
+                assert lazy.lookup(0, key) == i
+            lazy.build_key_index(-1)
+            assert lazy.lookup(1, b"v10") == 10
+            with pytest.raises(KeyError):
+                lazy.lookup(0, b"5000")
+
+    def test_duplicates_and_quotes(self):
+        data = b'k\nx\n"y,z"\nx\n"q""t"\n\n"y,z"\n'
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            lazy.build_key_index(-1)
+            lazy.build_key_index(0)
+            assert lazy.lookup(0, b"x") == 0
+            assert lazy.lookup(0, b"y,z") == 1
+            assert lazy.lookup(0, b'q"t') == 3
+            assert lazy.lookup(0, b"") == 4
+            assert lazy.lookup(0, "y,z") == 1
+
+    def test_encoding(self):
+        with prepped_file("k\nä\nb\n".encode("latin-1")) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, encoding="latin-1")
+            lazy.build_key_index(0)
+            assert lazy.lookup(0, "ä") == 0
+            assert lazy.lookup(0, b"\xe4") == 0
+
+    def test_index_file(self):
+        with tempfile.TemporaryDirectory() as index_dir:
+            lazy = lazycsv.LazyCSV(FPATH, index_dir=index_dir)
+            lazy.build_key_index(1)
+            assert len(os.listdir(index_dir)) == 4
+            assert lazy.lookup(1, b"a1") == 1
+            del lazy
+            gc.collect()
+            assert os.listdir(index_dir) == []
+
+    def test_concurrent_builds(self):
+        # builds and lookups racing on one table leave a single key index
+        data = b"k\n" + b"".join(b"%d\n" % i for i in range(50000))
+        barrier = threading.Barrier(4)
+
+        def build(lazy, i):
+            barrier.wait()
+            lazy.build_key_index(0)
+            return lazy.lookup(0, b"%d" % (i * 1000))
+
+        with tempfile.TemporaryDirectory() as index_dir:
+            with prepped_file(data) as tempf:
+                for _ in range(5):
+                    lazy = lazycsv.LazyCSV(tempf.name, index_dir=index_dir)
+                    with concurrent.futures.ThreadPoolExecutor(4) as pool:
+                        results = list(pool.map(build, [lazy] * 4, range(4)))
+                    assert results == [0, 1000, 2000, 3000]
+                    keys = [f for f in os.listdir(index_dir) if f.startswith("LzyK_")]
+                    assert len(keys) == 1
+                    del lazy
+                    gc.collect()
+            assert os.listdir(index_dir) == []
+
+    def test_errors(self, lazy):
+        with pytest.raises(ValueError) as err:
+            lazy.lookup(0, b"0")
+        assert err.value.args == ("no key index has been built for the column",)
+        with pytest.raises(ValueError):
+            lazy.build_key_index(3)
+        lazy.build_key_index(0)
+        with pytest.raises(TypeError):
+            lazy.lookup(0, 0)
+
+
+class TestColumnCache:
+    @pytest.fixture
+    def data(self):
+        rng = random.Random(0)
+        values = [b"1", b"2.5", b"", b'"q,""x"""', b"abc", b"-7e3"]
+        rows = [(b"%d" % i, rng.choice(values)) for i in range(20000)]
+        return b"i,v\n" + b"".join(b"%s,%s\n" % row for row in rows)
+
+    def read(self, lazy):
+        reads = []
+        for col in range(lazy.cols):
+            reads.append(lazy.sequence(col=col).to_list())
+            reads.append(list(lazy[::-3, col]))
+            reads.append(lazy.value_counts(col))
+            if hasattr(lazy.sequence(col=col), "to_numpy"):
+                reads.append(lazy.sequence(col=col).to_numpy().tolist())
+                reads.append(lazy[5::7, col].to_numpy(dtype="float64").tolist())
+        reads.append(lazy.reduce(1, ops=["count", "nulls", "sum"], threads=4))
+        reads.append(list(lazy.argsort(1)))
+        return reads
+
+    @pytest.mark.parametrize("compress", [False, True])
+    @pytest.mark.parametrize("index_mode", ["flat", "compressed", "rows"])
+    @pytest.mark.parametrize("numeric", [False, True])
+    def test_cached_reads(self, data, compress, index_mode, numeric):
+        if compress and index_mode == "rows":
+            pytest.skip("index_mode='rows' is not supported for compressed files")
+        with prepped_file(gzip.compress(data) if compress else data) as tempf:
+            lazy = TestCompression.lazy_or_skip(
+                tempf.name, index_mode=index_mode, encoding="utf-8"
+            )
+            expected = self.read(lazy)
+            lazy.cache_columns(numeric=numeric)
+            assert repr(self.read(lazy)) == repr(expected)
+
+    def test_index_file(self):
+        with tempfile.TemporaryDirectory() as index_dir:
+            lazy = lazycsv.LazyCSV(FPATH, index_dir=index_dir)
+            iterator = lazy.sequence(col=1)
+            lazy.cache_columns([-1, 1])
+            lazy.cache_columns([1], numeric=True)
+            assert len(os.listdir(index_dir)) == 5
+            assert iterator.to_list() == lazy.sequence(col=1).to_list() == [b"a0", b"a1"]
+            del lazy, iterator
+            gc.collect()
+            assert os.listdir(index_dir) == []
+
+    def test_changed_file(self):
+        with prepped_file(b"a\n1\n") as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            os.utime(tempf.name, (0, 0))
+            with pytest.raises(ValueError):
+                lazy.cache_columns()
+
+    def test_errors(self, lazy):
+        with pytest.raises(ValueError):
+            lazy.cache_columns([3])
+        if hasattr(lazy.sequence(col=0), "to_numpy"):
+            with pytest.raises(ValueError):
+                lazy.sequence(col=0).to_numpy(dtype="int32")
+            assert lazy.sequence(col=0).to_numpy(dtype="float64").tolist() == [0, 1]
+
+
+class TestDatetime:
+    def lazy(self, values):
+        data = "t\n" + "".join(f"{v}\n" for v in values)
+        with prepped_file(data.encode()) as tempf:
+            return lazycsv.LazyCSV(tempf.name)
+
+    @pytest.mark.parametrize("unit", ["s", "ms", "us"])
+    def test_iso(self, unit):
+        rng = random.Random(0)
+        formats = ["%Y-%m-%d", "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S.%f"]
+        values = []
+        for _ in range(5000):
+            seconds = rng.randrange(-2208988800, 4102444800)
+            value = datetime.datetime(1970, 1, 1) + datetime.timedelta(
+                seconds=seconds, microseconds=rng.randrange(10**6)
+            )
+            values.append(value.strftime(rng.choice(formats)))
+        values[10] = ""
+        lazy = self.lazy(values)
+        if not hasattr(lazy.sequence(col=0), "to_numpy"):
+            pytest.skip("lazycsv was built without numpy")
+        dtype = f"datetime64[{unit}]"
+        actual = lazy.sequence(col=0).to_numpy(dtype=dtype)
+        assert actual.dtype == np.dtype(dtype)
+        assert np.array_equal(actual, np.array(values, dtype=dtype), equal_nan=True)
+        reversed_values = lazy[::-1, 0].to_numpy(dtype=dtype)
+        assert np.array_equal(reversed_values, actual[::-1], equal_nan=True)
+
+    def test_time_zones(self):
+        values = ["2020-01-02T03:04:05+05:30", "2020-01-02T03:04Z", "1969-12-31 23:59:59.5-0100"]
+        lazy = self.lazy(values)
+        if not hasattr(lazy.sequence(col=0), "to_numpy"):
+            pytest.skip("lazycsv was built without numpy")
+        assert lazy.sequence(col=0).to_numpy(dtype="datetime64[ms]").tolist() == [
+            datetime.datetime(2020, 1, 1, 21, 34, 5),
+            datetime.datetime(2020, 1, 2, 3, 4),
+            datetime.datetime(1970, 1, 1, 0, 59, 59, 500000),
+        ]
+
+    def test_format(self):
+        values = ["02/Jan/20:03:04:05 +0530", "", '"31/dec/99:23:59:59 -0000"', "1/FEB/68:1:2:3 +01"]
+        lazy = self.lazy(values)
+        if not hasattr(lazy.sequence(col=0), "to_numpy"):
+            pytest.skip("lazycsv was built without numpy")
+        actual = lazy.sequence(col=0).to_numpy(
+            dtype="datetime64[s]", format="%d/%b/%y:%H:%M:%S %z"
+        )
+        assert actual.astype(str).tolist() == [
+            "2020-01-01T21:34:05",
+            "NaT",
+            "1999-12-31T23:59:59",
+            "2068-02-01T00:02:03",
+        ]
+
+    @pytest.mark.parametrize(
+        "value", ["2020-02-30", "2020-13-01", "2020-01-01T24:00", "2020-01-01T00:00+", "x"]
+    )
+    def test_errors(self, value):
+        lazy = self.lazy([value])
+        if not hasattr(lazy.sequence(col=0), "to_numpy"):
+            pytest.skip("lazycsv was built without numpy")
+        with pytest.raises(ValueError):
+            lazy.sequence(col=0).to_numpy(dtype="datetime64[s]")
+        with pytest.raises(ValueError):
+            lazy.sequence(col=0).to_numpy(dtype="datetime64[ns]")
+        with pytest.raises(ValueError):
+            lazy.sequence(col=0).to_numpy(format="%Y")
+
+
+class TestArgsort:
+    @pytest.fixture
+    def values(self):
+        rng = random.Random(0)
+        words = [b"", b"a", b"ab", b"abcdefgh", b"abcdefghi", b"abcdefgh\x00", b"zz", b'"q""x"']
+        values = [rng.choice(words) + b"%d" % rng.randrange(50) for _ in range(20000)]
+        values += [b"prefix_shared_%d" % rng.randrange(1000) for _ in range(20000)]
+        return values
+
+    @pytest.mark.parametrize("threads", [1, 3])
+    @pytest.mark.parametrize("index_mode", ["flat", "compressed", "rows"])
+    def test_bytes(self, values, threads, index_mode):
+        data = b"v\n" + b"".join(b'"%s"\n' % v.replace(b'"', b'""') for v in values)
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode=index_mode)
+            order = lazy.argsort(0, threads=threads)
+            assert list(order) == sorted(range(len(values)), key=lambda i: values[i])
+            assert [lazy[i, 0] for i in order[:5]] == sorted(values)[:5]
+
+    def test_numeric(self):
+        values = [b"10", b"-1.5", b"x", b"2e3", b"", b"-0", b"0", b"nan", b" 3 ", b"-inf", b"2"]
+        data = b"a,v\n" + b"".join(b"%d,%s\n" % (i, v) for i, v in enumerate(values))
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            order = lazy.argsort(-1, numeric=True, threads=2)
+            assert [values[i] for i in order] == [
+                b"-inf", b"-1.5", b"-0", b"0", b"2", b" 3 ", b"10", b"2e3", b"x", b"", b"nan"
+            ]
+            assert list(lazy.argsort(1)) == sorted(range(len(values)), key=lambda i: values[i])
+
+    def test_errors(self, lazy):
+        assert list(lazy.argsort(1)) == [0, 1]
+        with pytest.raises(ValueError):
+            lazy.argsort(3)
+        with pytest.raises(ValueError):
+            lazy.argsort(0, threads=0)
+        with prepped_file(b"a,b\n") as tempf:
+            assert len(lazycsv.LazyCSV(tempf.name).argsort(0)) == 0
+
+
+class TestGroupBy:
+    @pytest.fixture
+    def rows(self):
+        rng = random.Random(0)
+        keys = [b"a", b"b", b"", b"long key value", b'"q"', b"c,d"]
+        values = [b"1", b"2.5", b"-3", b"x", b"", b"1e2"]
+        return [(rng.choice(keys), rng.choice(values)) for _ in range(40000)]
+
+    def write(self, rows):
+        quote = lambda v: b'"%s"' % v.replace(b'"', b'""')
+        return b"k,v\n" + b"".join(b"%s,%s\n" % (quote(k), v) for k, v in rows)
+
+    @pytest.mark.parametrize("threads", [1, 4])
+    def test_value_counts(self, rows, threads):
+        with prepped_file(self.write(rows)) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            keys, counts = lazy.value_counts(0, threads=threads)
+        expected = collections.Counter(k for k, _ in rows).most_common()
+        assert list(zip(list(keys), [int(c) for c in counts])) == expected
+
+    @pytest.mark.parametrize("threads", [1, 4])
+    @pytest.mark.parametrize("index_mode", ["flat", "rows"])
+    def test_groupby_agg(self, rows, threads, index_mode):
+        with prepped_file(self.write(rows)) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode=index_mode)
+            keys, aggs = lazy.groupby_agg(0, -1, threads=threads)
+        assert sorted(aggs) == ["count", "max", "mean", "min", "sum"]
+        expected = {}
+        for k, v in rows:
+            expected.setdefault(k, [])
+            try:
+                expected[k].append(float(v))
+            except ValueError:
+                pass
+        assert list(keys) == list(expected)
+        for i, k in enumerate(expected):
+            numbers = expected[k]
+            assert aggs["count"][i] == len(numbers)
+            assert aggs["sum"][i] == pytest.approx(sum(numbers))
+            assert aggs["mean"][i] == pytest.approx(sum(numbers) / len(numbers))
+            assert aggs["min"][i] == min(numbers)
+            assert aggs["max"][i] == max(numbers)
+
+    def test_no_numbers(self):
+        with prepped_file(b"k,v\na,x\nb,1\na,\n") as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            keys, aggs = lazy.groupby_agg(0, 1, ops=["rows", "count", "mean", "sum"])
+        assert list(keys) == [b"a", b"b"]
+        assert list(aggs["rows"]) == [2, 1]
+        assert list(aggs["count"]) == [0, 1]
+        assert math.isnan(aggs["mean"][0]) and aggs["mean"][1] == 1
+        assert list(aggs["sum"]) == [0, 1]
+
+    def test_encoding(self):
+        # keys are decoded as values are, trailing NUL bytes and all
+        data = "k,v\nå,1\n\"a\0\",2\na,3\nå,4\n".encode()
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, encoding="utf-8")
+            keys, counts = lazy.value_counts(0)
+            grouped, aggs = lazy.groupby_agg(0, 1, ops=["sum"])
+        assert list(keys) == ["å", "a\0", "a"] and list(counts) == [2, 1, 1]
+        assert list(grouped) == ["å", "a\0", "a"] and list(aggs["sum"]) == [5, 2, 3]
+
+    def test_errors(self, lazy):
+        with pytest.raises(ValueError):
+            lazy.groupby_agg(0, 1, ops=["median"])
+        with pytest.raises(ValueError):
+            lazy.groupby_agg(0, 3)
+        with pytest.raises(ValueError):
+            lazy.value_counts(0, threads=0)
+        keys, counts = lazy.value_counts(1)
+        assert list(keys) == [b"a0", b"a1"] and list(counts) == [1, 1]
+
+
+class TestReduce:
+    @pytest.fixture
+    def values(self):
+        rng = random.Random(0)
+        choices = [lambda: b"%d" % rng.randrange(-100, 100), lambda: b"x", lambda: b""]
+        choices.append(lambda: b"%.3f" % rng.uniform(-10, 10))
+        return [rng.choice(choices)() for _ in range(40000)]
+
+    def expected(self, values):
+        numbers = []
+        for v in values:
+            try:
+                numbers.append(float(v))
+            except ValueError:
+                pass
+        return numbers
+
+    @pytest.mark.parametrize("threads", [1, 4])
+    @pytest.mark.parametrize("index_mode", ["flat", "rows"])
+    def test_reduce(self, values, threads, index_mode):
+        data = b"i,v\n" + b"".join(b"%d,%s\n" % (i, v) for i, v in enumerate(values))
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode=index_mode)
+            result = lazy.reduce(1, threads=threads)
+            sliced = lazy.reduce(-1, start=100, stop=-100, threads=threads)
+        numbers = self.expected(values)
+        assert sorted(result) == ["count", "max", "mean", "min", "nulls", "sum"]
+        assert result["count"] == len(numbers)
+        assert result["nulls"] == len(values) - len(numbers)
+        assert result["sum"] == pytest.approx(sum(numbers))
+        assert result["mean"] == pytest.approx(sum(numbers) / len(numbers))
+        assert (result["min"], result["max"]) == (min(numbers), max(numbers))
+        numbers = self.expected(values[100:-100])
+        assert sliced["count"] == len(numbers)
+        assert sliced["sum"] == pytest.approx(sum(numbers))
+
+    @pytest.mark.parametrize("threads", [1, 4])
+    def test_histogram(self, values, threads):
+        data = b"v\n" + b"".join(b"%s\n" % v for v in values)
+        numbers = self.expected(values)
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            counts, edges = lazy.reduce(0, ops=["histogram"], threads=threads)["histogram"]
+            ranged = lazy.reduce(0, ops=["histogram"], bins=4, range=(0, 10))
+        assert len(counts) == 10 and len(edges) == 11
+        assert sum(counts) == len(numbers)
+        assert (edges[0], edges[-1]) == (min(numbers), max(numbers))
+        counts, edges = ranged["histogram"]
+        assert list(edges) == [0, 2.5, 5, 7.5, 10]
+        assert sum(counts) == len([n for n in numbers if 0 <= n <= 10])
+        if hasattr(counts, "dtype"):
+            expected, expected_edges = np.histogram(numbers, bins=4, range=(0, 10))
+            assert counts.tolist() == expected.tolist()
+            assert edges.tolist() == expected_edges.tolist()
+
+    def test_no_numbers(self):
+        with prepped_file(b"v\nx\n\n") as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            result = lazy.reduce(0, ops=["count", "nulls", "mean", "histogram"])
+        assert (result["count"], result["nulls"]) == (0, 2)
+        assert math.isnan(result["mean"])
+        counts, edges = result["histogram"]
+        assert list(counts) == [0] * 10 and (edges[0], edges[-1]) == (0, 1)
+
+    def test_infinite(self):
+        # infinite values are counted but left out of the histogram
+        with prepped_file(b"a\nnan\ninf\n-inf\n1\n") as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            result = lazy.reduce(0, ops=["count", "nulls", "min", "max", "histogram"])
+        with prepped_file(b"a\n-1e308\n1e308\n") as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            with pytest.raises(ValueError):
+                lazy.reduce(0, ops=["histogram"])
+        assert (result["count"], result["nulls"]) == (3, 1)
+        assert (result["min"], result["max"]) == (-math.inf, math.inf)
+        counts, edges = result["histogram"]
+        assert list(counts) == [0] * 5 + [1] + [0] * 4
+        assert (edges[0], edges[-1]) == (0.5, 1.5)
+        if hasattr(counts, "dtype"):
+            expected, expected_edges = np.histogram([1.0])
+            assert counts.tolist() == expected.tolist()
+            assert edges.tolist() == expected_edges.tolist()
+
+    @pytest.mark.parametrize("range_", [None, (2, 2)])
+    def test_single_value(self, range_):
+        with prepped_file(b"a\n2\n2\nx\n") as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            counts, edges = lazy.reduce(0, ops=["histogram"], range=range_)["histogram"]
+        assert list(counts) == [0] * 5 + [2] + [0] * 4
+        assert (edges[0], edges[-1]) == (1.5, 2.5)
+        if hasattr(counts, "dtype"):
+            expected, expected_edges = np.histogram([2.0, 2.0], range=range_)
+            assert counts.tolist() == expected.tolist()
+            assert edges.tolist() == expected_edges.tolist()
+
+    def test_errors(self, lazy):
+        with pytest.raises(ValueError):
+            lazy.reduce(0, ops=["median"])
+        with pytest.raises(ValueError):
+            lazy.reduce(3)
+        with pytest.raises(ValueError):
+            lazy.reduce(0, threads=0)
+        with pytest.raises(ValueError):
+            lazy.reduce(0, ops=["histogram"], bins=0)
+        with pytest.raises(ValueError):
+            lazy.reduce(0, ops=["histogram"], range=(1, 0))
+
+
+class TestWriteCSV:
+    @pytest.fixture
+    def rows(self):
+        rng = random.Random(0)
+        values = ["a", "b,c", 'q"x', "", "line\nbreak"]
+        return [[str(i), rng.choice(values), str(rng.random())] for i in range(20000)]
+
+    def write(self, rows, lineterminator="\n"):
+        buffer = io.StringIO()
+        writer = csv.writer(buffer, lineterminator=lineterminator)
+        writer.writerow(["i", "s", "f"])
+        writer.writerows(rows)
+        return buffer.getvalue().encode()
+
+    def read(self, path):
+        with open(path, newline="") as f:
+            return list(csv.reader(f))
+
+    @pytest.mark.parametrize("lineterminator", ["\n", "\r\n"])
+    @pytest.mark.parametrize("index_mode", ["flat", "compressed", "rows"])
+    def test_whole_rows(self, rows, tmp_path, lineterminator, index_mode):
+        data = self.write(rows, lineterminator)
+        with prepped_file(data) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, index_mode=index_mode)
+            lazy.write_csv(tmp_path / "all.csv")
+            lazy.write_csv(tmp_path / "some.csv", rows=[5, 6, 7, 1, 2, 19999])
+            lazy.write_csv(tmp_path / "none.csv", rows=[], header=False)
+        assert (tmp_path / "all.csv").read_bytes() == data
+        assert self.read(tmp_path / "some.csv")[1:] == [
+            rows[i] for i in [5, 6, 7, 1, 2, 19999]
+        ]
+        assert (tmp_path / "none.csv").read_bytes() == b""
+
+    @pytest.mark.parametrize("compress", [False, True])
+    def test_subset(self, rows, tmp_path, compress):
+        data = self.write(rows)
+        with prepped_file(gzip.compress(data) if compress else data) as tempf:
+            lazy = TestCompression.lazy_or_skip(tempf.name)
+            lazy.write_csv(tmp_path / "a.csv", rows=slice(None, None, -3), cols=[2, 0])
+            lazy.write_csv(tmp_path / "b.csv", rows=lazy.argsort(2), cols=[-2])
+        assert self.read(tmp_path / "a.csv") == [["f", "i"]] + [
+            [r[2], r[0]] for r in rows[::-3]
+        ]
+        expected = [[r[1]] for r in sorted(rows, key=lambda r: r[2])]
+        assert self.read(tmp_path / "b.csv") == [["s"]] + expected
+
+    def test_overwrite(self, tmp_path):
+        path = tmp_path / "out.csv"
+        path.write_bytes(b"x" * 1000)
+        with prepped_file(b"a,b\n1,2\n3\n") as tempf, pytest.warns(RuntimeWarning):
+            lazy = lazycsv.LazyCSV(tempf.name, skip_headers=True)
+            lazy.write_csv(str(path), cols=[1, 0])
+            with pytest.raises(ValueError):
+                lazy.write_csv(tempf.name)
+            with open(tempf.name, "rb") as f:
+                assert f.read() == b"a,b\n1,2\n3\n"
+        assert path.read_bytes() == b"b,a\n2,1\n,3\n"
+
+    def test_errors(self, lazy, tmp_path):
+        with pytest.raises(ValueError):
+            lazy.write_csv(tmp_path / "out.csv", rows=[2])
+        with pytest.raises(ValueError):
+            lazy.write_csv(tmp_path / "out.csv", cols=[0, 3])
+        with pytest.raises(TypeError):
+            lazy.write_csv(tmp_path / "out.csv", rows=["a"])
+        with pytest.raises(FileNotFoundError):
+            lazy.write_csv(tmp_path / "missing" / "out.csv")
+
+
+class TestDiff:
+    def expected(self, old, new):
+        keys = {}
+        for i, row in enumerate(old):
+            keys.setdefault(row[0], []).append(i)
+        added, changed, paired = [], [], set()
+        for j, row in enumerate(new):
+            if not keys.get(row[0]):
+                added.append(j)
+                continue
+            i = keys[row[0]].pop(0)
+            paired.add(i)
+            if old[i] != row:
+                changed.append(j)
+        removed = [i for i in range(len(old)) if i not in paired]
+        return added, removed, changed
+
+    @pytest.mark.parametrize(
+        "compress, index_mode",
+        [(False, "flat"), (False, "compressed"), (False, "rows"), (True, "flat")],
+    )
+    def test_keyed(self, compress, index_mode):
+        rng = random.Random(0)
+        old = [[str(rng.randrange(15000)), str(rng.random())] for _ in range(20000)]
+        new = [row[:] for row in old if rng.random() > 0.01]
+        for row in rng.sample(new, 200):
+            row[1] = "changed"
+        new += [[str(rng.randrange(30000)), "added"] for _ in range(200)]
+        rng.shuffle(new)
+
+        def data(rows):
+            data = "id,value\n" + "".join(f"{k},{v}\n" for k, v in rows)
+            return gzip.compress(data.encode()) if compress else data.encode()
+
+        with prepped_file(data(old)) as oldf, prepped_file(data(new)) as newf:
+            lazy_old = TestCompression.lazy_or_skip(oldf.name, index_mode=index_mode)
+            lazy_new = TestCompression.lazy_or_skip(newf.name, index_mode=index_mode)
+            actual = lazycsv.diff(lazy_old, lazy_new, key_col=0, threads=4)
+        assert [list(rows) for rows in actual] == list(self.expected(old, new))
+        assert all(len(rows) for rows in actual)
+
+    def test_positional(self):
+        old = b"a,b\n1,2\n3,4\n5,6\n7,8\n"
+        new = b"a,b\r\n1,2\r\n3,5\r\n5,6\r\n"
+        with prepped_file(old) as oldf, prepped_file(new) as newf:
+            lazy_old = lazycsv.LazyCSV(oldf.name)
+            lazy_new = lazycsv.LazyCSV(newf.name)
+            added, removed, changed = lazycsv.diff(lazy_old, lazy_new)
+            assert (list(added), list(removed), list(changed)) == ([], [3], [1])
+            added, removed, changed = lazycsv.diff(lazy_new, lazy_old)
+            assert (list(added), list(removed), list(changed)) == ([3], [], [1])
+
+    def test_keys(self):
+        # keys are compared unquoted, rows as they are in the file
+        old = b'id,v\n"x",1\n"a""b",2\n'
+        new = b'id,v\n"a""b",2\nx,1\n'
+        with prepped_file(old) as oldf, prepped_file(new) as newf:
+            lazy_old = lazycsv.LazyCSV(oldf.name)
+            lazy_new = lazycsv.LazyCSV(newf.name)
+            added, removed, changed = lazycsv.diff(lazy_old, lazy_new, key_col=-2)
+        assert (list(added), list(removed), list(changed)) == ([], [], [1])
+
+    def test_errors(self, lazy):
+        with prepped_file(b"a\n1\n") as tempf:
+            narrow = lazycsv.LazyCSV(tempf.name)
+            with pytest.raises(ValueError):
+                lazycsv.diff(lazy, narrow, key_col=1)
+            with pytest.raises(ValueError):
+                lazycsv.diff(lazy, narrow, key_col=-1)
+        with pytest.raises(ValueError):
+            lazycsv.diff(lazy, lazy, threads=0)
+        with pytest.raises(TypeError):
+            lazycsv.diff(lazy, "file.csv")
+
+
+class TestSample:
+    @pytest.fixture
+    def rows(self):
+        rng = random.Random(0)
+        return [[str(i), rng.choice("aaaabbc"), str(rng.random())] for i in range(20000)]
+
+    def data(self, rows):
+        return ("i,g,f\n" + "".join(",".join(row) + "\n" for row in rows)).encode()
+
+    @pytest.mark.parametrize(
+        "compress, index_mode",
+        [(False, "flat"), (False, "compressed"), (False, "rows"), (True, "flat")],
+    )
+    def test_uniform(self, rows, compress, index_mode):
+        data = self.data(rows)
+        with prepped_file(gzip.compress(data) if compress else data) as tempf:
+            lazy = TestCompression.lazy_or_skip(tempf.name, index_mode=index_mode)
+            sampled, values = lazy.sample(500, seed=7, cols=[2, -3])
+            again, _ = lazy.sample(500, seed=7)
+            other, _ = lazy.sample(500, seed=8)
+        assert list(sampled) == sorted(set(sampled)) and len(sampled) == 500
+        assert list(sampled) == list(again) != list(other)
+        assert values == [[rows[r][2].encode(), rows[r][0].encode()] for r in sampled]
+
+    def test_every_row(self, rows):
+        with prepped_file(self.data(rows[:10])) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            seen = collections.Counter()
+            for seed in range(2000):
+                seen.update(list(lazy.sample(3, seed=seed)[0]))
+            assert sorted(seen) == list(range(10))
+            assert min(seen.values()) > 500
+            assert list(lazy.sample(10)[0]) == list(range(10))
+            assert lazy.sample(20, cols=[])[1] == [[]] * 10
+            empty, values = lazy.sample(0)
+            assert len(empty) == 0 and values == []
+
+    def test_random_seed(self, rows):
+        with prepped_file(self.data(rows)) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            random.seed(3)
+            first, _ = lazy.sample(100)
+            random.seed(3)
+            second, _ = lazy.sample(100)
+        assert list(first) == list(second)
+
+    def test_stratified(self, rows):
+        with prepped_file(self.data(rows)) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            sampled, values = lazy.sample(1000, seed=1, cols=[1], stratify_col=1, threads=4)
+        counts = collections.Counter(row[1] for row in rows)
+        shares = collections.Counter(value for value, in values)
+        for key, count in counts.items():
+            assert abs(shares[key.encode()] - 1000 * count / len(rows)) < 1
+        assert sum(shares.values()) == 1000
+        assert values == [[rows[r][1].encode()] for r in sampled]
+
+    def test_errors(self, lazy):
+        with pytest.raises(ValueError):
+            lazy.sample(-1)
+        with pytest.raises(ValueError):
+            lazy.sample(1, threads=0)
+        with pytest.raises(ValueError):
+            lazy.sample(1, stratify_col=3)
+        with pytest.raises(ValueError):
+            lazy.sample(1, cols=[3])
+        with pytest.raises(TypeError):
+            lazy.sample(1, seed="a")
+
+
+class TestThreads:
+    def test_concurrent_reads(self, file_1000r_1000c):
+        lazy = lazycsv.LazyCSV(file_1000r_1000c.name)
+        cols = range(0, 1000, 50)
+
+        def read(col):
+            values = lazy.sequence(col=col).to_list()
+            iterator = lazy.sequence(col=col)
+            if hasattr(iterator, "to_numpy"):
+                assert iterator.to_numpy().tolist() == values
+            return values, list(lazy[::-1, col])[::-1], lazy[999, col]
+
+        with concurrent.futures.ThreadPoolExecutor(8) as pool:
+            results = list(pool.map(read, cols))
+        for col, (values, reversed_values, last) in zip(cols, results):
+            assert values == reversed_values == [str(col).encode()] * 1000
+            assert last == str(col).encode()
+
+    def test_stream_from_thread(self):
+        def index(data):
+            return lazycsv.LazyCSV(io.BytesIO(data)).sequence(col=1).to_list()
+
+        with concurrent.futures.ThreadPoolExecutor(4) as pool:
+            results = list(pool.map(index, [b"a,b\n1,%d\n" % i for i in range(8)]))
+        assert results == [[b"%d" % i] for i in range(8)]
+
+
+class TestEncoding:
+    def test_utf8(self):
+        lazy = lazycsv.LazyCSV(FPATH, encoding="utf-8")
+        assert lazy.headers == ("", "ALPHA", "BETA")
+        assert lazy.sequence(col=1).to_list() == ["a0", "a1"]
+        assert list(lazy[1, :]) == ["1", "a1", "b1"]
+        assert lazy[0, 2] == "b0"
+
+    def test_non_ascii(self):
+        text = "héllo,naïve,x\n日本,ß,\"a,é\"\n"
+        with prepped_file(text.encode("utf8")) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, encoding="utf8")
+            assert lazy.headers == ("héllo", "naïve", "x")
+            assert lazy.sequence(row=0).to_list() == ["日本", "ß", "a,é"]
+
+    def test_single_bytes(self):
+        with prepped_file(b"a,b\n\xff,\x7f\n") as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name)
+            assert lazy.sequence(row=0).to_list() == [b"\xff", b"\x7f"]
+            lazy = lazycsv.LazyCSV(tempf.name, encoding="latin-1")
+            assert lazy.sequence(row=0).to_list() == ["\xff", "\x7f"]
+            lazy = lazycsv.LazyCSV(tempf.name, encoding="utf-8")
+            with pytest.raises(UnicodeDecodeError):
+                lazy[0, 0]
+            assert lazy[0, 1] == "\x7f"
+
+    def test_other_codec(self):
+        text = "a,b\nж,ф\n"
+        with prepped_file(text.encode("cp1251")) as tempf:
+            lazy = lazycsv.LazyCSV(tempf.name, encoding="cp1251")
+            assert lazy.sequence(row=0).to_list() == ["ж", "ф"]
+
+    def test_unknown_encoding(self):
+        with pytest.raises(ValueError) as err:
+            lazycsv.LazyCSV(FPATH, encoding="not-a-codec")
+        assert err.value.args == (
+            "encoding must be the name of a codec known to python",
+        )
+
+    def test_pickle(self):
+        lazy = lazycsv.LazyCSV(FPATH, encoding="utf-8")
+        shared = pickle.loads(pickle.dumps(lazy))
+        assert shared.headers == ("", "ALPHA", "BETA")
+        assert shared[1, 1] == "a1"
+
+    def test_dataset(self):
+        dataset = lazycsv.LazyCSVDataset([FPATH, FPATH], encoding="utf-8")
+        assert dataset.headers == ("", "ALPHA", "BETA")
+        assert dataset.sequence(col=1).to_list() == ["a0", "a1", "a0", "a1"]
+
+    @pytest.mark.skipif(
+        not hasattr(lazycsv.LazyCSV(FPATH).sequence(col=0), "to_numpy"),
+        reason="built without numpy",
+    )
+    def test_numpy(self):
+        lazy = lazycsv.LazyCSV(FPATH, encoding="utf-8")
+        assert lazy.sequence(col=1).to_numpy().tolist() == [b"a0", b"a1"]
+
+
 class TestCRLF:
     def test_crlf1(self):
         lazy = lazycsv.LazyCSV("fixtures/file_crlf.csv")
@@ -430,6 +1787,14 @@ class TestUnorderedFiles:
         assert list(lazy.sequence(col=0)) == [b"", b"0"]
         assert list(lazy.sequence(col=25)) == [b"", b"1"]
 
+    def test_missing_col_last_row(self):
+        data = "x,y,z\n1,2,3\n4".encode()
+        for index_mode in ("flat", "compressed"):
+            with prepped_file(data) as tempf, pytest.warns(RuntimeWarning):
+                lazy = lazycsv.LazyCSV(tempf.name, index_mode=index_mode)
+                actual = list(list(lazy.sequence(col=i)) for i in range(lazy.cols))
+            assert actual == [[b"1", b"4"], [b"2", b""], [b"3", b""]]
+
     def test_extra_col(self):
         data = "x,y\r\n1,2,3\r\n4,5\r\n".encode()
         with prepped_file(data) as tempf, pytest.warns(RuntimeWarning):